@@ -0,0 +1,122 @@
+// bake_bench.cpp measuring how long textures take to load from image files,
+// decoded and mipmapped at load time, and from baked files made ahead of time
+// Published under Creative Commons CC-BY
+
+#include <glad.h>
+#include <glfw3.h>
+
+#include "glazy.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <vector>
+#include <chrono>
+#include <cstring>
+
+
+size_t const repeats = 20;
+
+std::vector<std::string> const images = {
+	"assets/blank.png", "assets/o.png", "assets/x.png",
+	"assets/draw.png", "assets/o_win.png", "assets/x_win.png",
+};
+
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+// Decodes each image and has the driver build its mips, as apps did before
+// baking
+double from_images() {
+	auto start = std::chrono::steady_clock::now();
+	for (size_t repeat = 0; repeat < repeats; repeat++) {
+		for (std::string const& path : images) {
+			int width, height, channels;
+			unsigned char* data = stbi_load(path.c_str(), &width, &height, &channels, 4);
+			if (data == nullptr) {
+				throw std::runtime_error("Failed to load image '" + path + "'.");
+			}
+			std::span<glazy::format::RGBA8 const> texels(reinterpret_cast<glazy::format::RGBA8 const*>(data), size_t(width) * height);
+			glazy::Texture2D<glazy::format::RGBA8> texture(texels, width, height, true);
+			stbi_image_free(data);
+		}
+	}
+	glFinish();
+	return seconds_since(start);
+}
+
+double from_baked(std::vector<std::filesystem::path> const& baked) {
+	auto start = std::chrono::steady_clock::now();
+	for (size_t repeat = 0; repeat < repeats; repeat++) {
+		for (std::filesystem::path const& path : baked) {
+			glazy::BakedTexture texture(path);
+		}
+	}
+	glFinish();
+	return seconds_since(start);
+}
+
+std::vector<std::filesystem::path> bake_all(glazy::bake::Format format, std::string const& suffix) {
+	std::vector<std::filesystem::path> result;
+	for (std::string const& path : images) {
+		int width, height, channels;
+		unsigned char* data = stbi_load(path.c_str(), &width, &height, &channels, 4);
+		if (data == nullptr) {
+			throw std::runtime_error("Failed to load image '" + path + "'.");
+		}
+		std::vector<glazy::format::RGBA8> texels(size_t(width) * height);
+		std::memcpy(texels.data(), data, texels.size() * sizeof(glazy::format::RGBA8));
+		stbi_image_free(data);
+		std::filesystem::path baked = std::filesystem::temp_directory_path()
+			/ (std::filesystem::path(path).stem().string() + suffix + ".glzt");
+		glazy::bake::write(baked, format, glazy::bake::mip_chain(std::move(texels), width, height), width, height);
+		result.push_back(baked);
+	}
+	return result;
+}
+
+
+int main() {
+
+	std::vector<glazy::context::WindowHint> hints = {
+		{GLFW_VISIBLE, GLFW_FALSE}
+	};
+	GLFWwindow* window = glazy::context::setup({ 0, 0 }, { 64, 64 }, "Bake Benchmark", hints);
+
+	{
+		std::vector<std::filesystem::path> rgba8 = bake_all(glazy::bake::Format::rgba8, "_rgba8");
+		std::vector<std::filesystem::path> bc1;
+		if (glazy::context::capabilities().s3tc) {
+			bc1 = bake_all(glazy::bake::Format::bc1, "_bc1");
+		}
+
+		// Discarded, so that file caches and driver start-up costs land
+		// before any timed run
+		from_images();
+		from_baked(rgba8);
+
+		std::cout << images.size() << " images, loaded " << repeats << " times\n"
+			<< "\tdecoded and mipmapped  " << from_images() * 1000.0 << " ms\n"
+			<< "\tbaked rgba8            " << from_baked(rgba8) * 1000.0 << " ms\n";
+		if (!bc1.empty()) {
+			std::cout << "\tbaked bc1              " << from_baked(bc1) * 1000.0 << " ms\n";
+		}
+		else {
+			std::cout << "\tbaked bc1              not supported\n";
+		}
+
+		for (auto const& path : rgba8) {
+			std::filesystem::remove(path);
+		}
+		for (auto const& path : bc1) {
+			std::filesystem::remove(path);
+		}
+	}
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	return 0;
+}
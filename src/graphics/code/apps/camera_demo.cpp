@@ -9,6 +9,7 @@
 #include "glazy.h"
 #include "shape.h"
 #include <vector>
+#include <unordered_map>
 
 
 
@@ -21,13 +22,37 @@ GLboolean show_model = false;
 GLboolean show_world = false;
 GLboolean show_view = false;
 
-std::vector<glm::vec3> points;
+glazy::shape::Indexed<glm::vec3> sphere;
+
+// Matches the Camera uniform block of the demo's shaders
+struct Camera {
+	glm::mat4 view_transform;
+	glm::mat4 proj_transform;
+};
+
+template<> struct glazy::BlockLayout<Camera> : glazy::std140::Fields<
+	GLAZY_BLOCK_FIELD(Camera, view_transform),
+	GLAZY_BLOCK_FIELD(Camera, proj_transform)
+> {};
+
+// The grids shown are compiled into the fragment shader, one program per
+// combination, in the order of the feature list
+std::vector<std::string> const grid_features = { "SHOW_MODEL", "SHOW_WORLD", "SHOW_VIEW" };
+
+glazy::ProgramVariants::Key grid_key() {
+	return (show_model ? 1 : 0) | (show_world ? 2 : 0) | (show_view ? 4 : 0);
+}
+
+// The "modl_transform" uniform of every variant, resolved as each is built or
+// rebuilt. A rebuild takes over the id of the new program, so entries are keyed
+// by program id.
+std::unordered_map<GLuint, glazy::UniformHandle<glm::mat4>> modl_transforms;
 
 
 
 GLFWwindow *setup();
 void key_handler(GLFWwindow* window, int key, int scancode, int action, int mods);
-void display(GLFWwindow*w,glazy::GPUProgram &prog);
+void display(GLFWwindow*w, glazy::ProgramVariants &variants, glazy::UniformBlock<Camera> &camera, glazy::IndexBuffer &indices);
 
 
 
@@ -37,32 +62,54 @@ int main() {
 	GLFWwindow* window = setup(window_pos, window_dims, "Camera Demo", hints);
 	glfwSetKeyCallback(window, key_handler);
 	
-	glazy::GPUProgram program(
-		glazy::Shader<GL_VERTEX_SHADER>::from_file("./shaders/camera_demo/camera.vert"),
-		{},
-		{},
-		{},
-		glazy::Shader<GL_FRAGMENT_SHADER>::from_file("./shaders/camera_demo/camera.frag")
+	glazy::ProgramFiles files;
+	files.vertex = "./shaders/camera_demo/camera.vert";
+	files.fragment = "./shaders/camera_demo/camera.frag";
+
+	glazy::ShaderPreprocessor preprocessor({ "./shaders/common" });
+	glazy::ProgramCache programs("./cache/programs");
+	// Edits to the shaders show up without a restart
+	glazy::ShaderWatcher watcher;
+	glazy::UniformBlock<Camera> camera(0);
+	glazy::ProgramVariants variants(
+		preprocessor,
+		files,
+		grid_features,
+		[&camera](glazy::GPUProgram& program) {
+			camera.attach(program, "Camera");
+			modl_transforms[program] = program.uniform_handle<glm::mat4>("modl_transform");
+		},
+		&programs,
+		&watcher
 	);
+	glazy::GPUProgram& program = variants.get(grid_key());
+	glazy::ProgramCache::Stats const& cache_stats = programs.stats();
+	std::cout << "Program cache: " << cache_stats.hits << " hits, " << cache_stats.misses << " misses, "
+		<< cache_stats.rejected << " rejected, " << cache_stats.seconds_saved << "s saved\n";
 
 
 	glazy::SharedVAO vao;
 	glazy::SharedBuffer<glm::vec3> pos;
-	points = glazy::shape::sphere(100, 100, 1);
-	pos.set_data(points, GL_STATIC_DRAW);
+	glazy::IndexBuffer indices;
+	sphere = glazy::shape::indexed_sphere(100, 100, 1);
+	pos.set_data(sphere.vertices, GL_STATIC_DRAW);
+	indices.set_data(sphere.indices, GL_STATIC_DRAW);
 
 	GLint pos_index = program.attribute_index("point");
 	{
 		glazy::VAO::BindGuard guard (vao);
 		vao[pos_index].enable();
 		vao[pos_index] = (glazy::Buffer<glm::vec3>&) pos;
+		vao.set_indices(indices);
 
-		glEnable(GL_DEPTH_TEST);
-
-		glUseProgram(program);
+		glazy::StateCache& state = glazy::StateCache::current();
+		state.enable(GL_DEPTH_TEST);
 
 		while (!glfwWindowShouldClose(window)) {
-			display(window, program);
+			for (std::string const& error : watcher.poll().errors) {
+				std::cout << error << '\n';
+			}
+			display(window, variants, camera, indices);
 		}
 	}
 
@@ -93,7 +140,7 @@ void key_handler(GLFWwindow* window, int key, int scancode, int action, int mods
 
 
 
-void display(GLFWwindow* w, glazy::GPUProgram &program) {
+void display(GLFWwindow* w, glazy::ProgramVariants &variants, glazy::UniformBlock<Camera> &camera, glazy::IndexBuffer &indices) {
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	GLfloat time = (float) glfwGetTime();
@@ -111,18 +158,28 @@ void display(GLFWwindow* w, glazy::GPUProgram &program) {
 	view_transform = glm::translate(view_transform, glm::vec3{ 0, 0, -7 + cos(time*0.5f)*4});
 
 
-	program[{"modl_transform"}] = modl_transform;
-	program[{"view_transform"}] = view_transform;
-	program[{"proj_transform"}] = proj_transform;
-	program[{"show_model"}]     = show_model;
-	program[{"show_world"}]     = show_world;
-	program[{"show_view"}]      = show_view;
+	// Built on the first frame it is needed, then reused
+	glazy::GPUProgram& program = variants.get(grid_key());
+	glazy::StateCache::current().use_program(program);
+	// The handle is only looked up again when the variant changes or is
+	// rebuilt, which changes the program's id
+	static GLuint handle_program = 0;
+	static glazy::UniformHandle<glm::mat4>* modl_handle = nullptr;
+	if (handle_program != program) {
+		modl_handle = &modl_transforms.at(program);
+		handle_program = program;
+	}
+	*modl_handle = modl_transform;
+	camera = Camera{ view_transform, proj_transform };
 
-	glDrawArrays(GL_TRIANGLES, 0, points.size());
+	glazy::draw::elements(GL_TRIANGLES, indices);
 
 	glFlush();
 
 	glfwSwapBuffers(w);
+	// Objects released this frame, such as programs replaced by a reload, are
+	// deleted once the GPU has finished with them
+	glazy::ContextObjects::current().deletions.end_frame();
 	glfwPollEvents();
 
 }
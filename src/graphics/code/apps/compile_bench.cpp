@@ -0,0 +1,204 @@
+// compile_bench.cpp measuring how long a batch of programs takes to build
+// when each is waited on in turn, and when all are submitted before any is checked,
+// and how combining separable stages compares to linking every combination
+// Published under Creative Commons CC-BY
+
+#include <glad.h>
+#include <glfw3.h>
+
+#include "glazy.h"
+#include <vector>
+#include <chrono>
+
+
+size_t const program_count = 200;
+
+std::string const vertex_source = R"(#version 140
+in vec3 point;
+void main() {
+	gl_Position = vec4(point, 1.0);
+}
+)";
+
+// Every program gets a fragment shader of its own, so that the driver cannot
+// reuse an earlier compile
+std::string fragment_source(size_t variant, size_t batch) {
+	return "#version 140\n"
+		"#define VARIANT " + std::to_string(variant) + "\n"
+		"#define BATCH " + std::to_string(batch) + "\n"
+		"out vec4 color;\n"
+		"void main() {\n"
+		"	vec3 sum = vec3(0.0);\n"
+		"	for (int i = 0; i < 16 + VARIANT % 7; i++) {\n"
+		"		sum += sin(gl_FragCoord.xyz * float(i + VARIANT + BATCH));\n"
+		"	}\n"
+		"	color = vec4(sum, 1.0);\n"
+		"}\n";
+}
+
+// Sources for the combination benchmark. Separable vertex stages must declare
+// the built-in outputs they write.
+size_t const vertex_variants = 10;
+size_t const fragment_variants = 20;
+
+std::string combo_vertex_source(size_t variant) {
+	return "#version 410 core\n"
+		"#define VARIANT " + std::to_string(variant) + "\n"
+		"in vec3 point;\n"
+		"out vec3 shade;\n"
+		"out gl_PerVertex { vec4 gl_Position; };\n"
+		"void main() {\n"
+		"	shade = sin(point * float(VARIANT + 1));\n"
+		"	gl_Position = vec4(point, 1.0);\n"
+		"}\n";
+}
+
+std::string combo_fragment_source(size_t variant) {
+	return "#version 410 core\n"
+		"#define VARIANT " + std::to_string(variant) + "\n"
+		"in vec3 shade;\n"
+		"out vec4 color;\n"
+		"void main() {\n"
+		"	color = vec4(cos(shade * float(VARIANT + 1)), 1.0);\n"
+		"}\n";
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+
+// Builds each program and waits for it before starting the next, as
+// constructing GPUPrograms one after another does
+double serial(size_t batch) {
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < program_count; i++) {
+		glazy::GPUProgram program(
+			glazy::Shader<GL_VERTEX_SHADER>(vertex_source),
+			{},
+			{},
+			{},
+			glazy::Shader<GL_FRAGMENT_SHADER>(fragment_source(i, batch))
+		);
+		glDeleteProgram(program);
+	}
+	return seconds_since(start);
+}
+
+// Submits every program, then polls them as a renderer would between frames
+double submitted(size_t batch, size_t& polls) {
+	auto start = std::chrono::steady_clock::now();
+	std::vector<glazy::ProgramFuture> futures;
+	futures.reserve(program_count);
+	for (size_t i = 0; i < program_count; i++) {
+		futures.emplace_back(
+			glazy::Shader<GL_VERTEX_SHADER>(vertex_source),
+			glazy::Shader<GL_TESS_CONTROL_SHADER>(),
+			glazy::Shader<GL_TESS_EVALUATION_SHADER>(),
+			glazy::Shader<GL_GEOMETRY_SHADER>(),
+			glazy::Shader<GL_FRAGMENT_SHADER>(fragment_source(i, batch))
+		);
+	}
+	size_t remaining = program_count;
+	std::vector<bool> done(program_count, false);
+	polls = 0;
+	while (remaining > 0) {
+		polls++;
+		for (size_t i = 0; i < program_count; i++) {
+			if (!done[i] && (futures[i].poll() != nullptr)) {
+				done[i] = true;
+				remaining--;
+			}
+		}
+	}
+	double result = seconds_since(start);
+	for (glazy::ProgramFuture& future : futures) {
+		glDeleteProgram(future.get());
+	}
+	return result;
+}
+
+
+// Links every vertex and fragment combination as its own program
+double monolithic() {
+	auto start = std::chrono::steady_clock::now();
+	for (size_t v = 0; v < vertex_variants; v++) {
+		for (size_t f = 0; f < fragment_variants; f++) {
+			glazy::GPUProgram program(
+				glazy::Shader<GL_VERTEX_SHADER>(combo_vertex_source(v)),
+				{},
+				{},
+				{},
+				glazy::Shader<GL_FRAGMENT_SHADER>(combo_fragment_source(f))
+			);
+			glDeleteProgram(program);
+		}
+	}
+	return seconds_since(start);
+}
+
+// Links each stage once, then combines them in pipelines
+double pipelined() {
+	auto start = std::chrono::steady_clock::now();
+	std::vector<glazy::GPUProgram> vertex_stages;
+	std::vector<glazy::GPUProgram> fragment_stages;
+	for (size_t v = 0; v < vertex_variants; v++) {
+		vertex_stages.push_back(glazy::GPUProgram::separable(glazy::Shader<GL_VERTEX_SHADER>(combo_vertex_source(v))));
+	}
+	for (size_t f = 0; f < fragment_variants; f++) {
+		fragment_stages.push_back(glazy::GPUProgram::separable(glazy::Shader<GL_FRAGMENT_SHADER>(combo_fragment_source(f))));
+	}
+	std::vector<glazy::ProgramPipeline> pipelines;
+	pipelines.reserve(vertex_variants * fragment_variants);
+	for (glazy::GPUProgram& vertex : vertex_stages) {
+		for (glazy::GPUProgram& fragment : fragment_stages) {
+			pipelines.emplace_back();
+			pipelines.back().use_stage(GL_VERTEX_SHADER, vertex);
+			pipelines.back().use_stage(GL_FRAGMENT_SHADER, fragment);
+			pipelines.back().validate();
+		}
+	}
+	double result = seconds_since(start);
+	pipelines.clear();
+	for (glazy::GPUProgram& program : vertex_stages) {
+		glDeleteProgram(program);
+	}
+	for (glazy::GPUProgram& program : fragment_stages) {
+		glDeleteProgram(program);
+	}
+	return result;
+}
+
+
+int main() {
+
+	std::vector<glazy::context::WindowHint> hints = {
+		{GLFW_VISIBLE, GLFW_FALSE}
+	};
+	GLFWwindow* window = glazy::context::setup({ 0, 0 }, { 64, 64 }, "Compile Benchmark", hints);
+
+	std::cout << "Parallel shader compile: "
+		<< (glazy::context::capabilities().parallel_shader_compile ? "supported" : "not supported") << "\n";
+
+	// Each run uses different sources, so driver-side shader caches only help
+	// within a run
+	double serial_seconds = serial(0);
+	size_t polls = 0;
+	double submitted_seconds = submitted(1, polls);
+
+	std::cout << program_count << " programs\n"
+		<< "\twaited on in turn  " << serial_seconds * 1000.0 << " ms\n"
+		<< "\tsubmitted first    " << submitted_seconds * 1000.0 << " ms (" << polls << " polling passes)\n";
+
+	double monolithic_seconds = monolithic();
+	double pipelined_seconds = pipelined();
+
+	std::cout << vertex_variants << " vertex x " << fragment_variants << " fragment shaders\n"
+		<< "\tlinked per combination  " << monolithic_seconds * 1000.0 << " ms\n"
+		<< "\tseparable pipelines     " << pipelined_seconds * 1000.0 << " ms\n";
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	return 0;
+}
@@ -0,0 +1,75 @@
+// dsa_bench.cpp measuring glazy buffer uploads and attribute setup
+// with and without direct state access
+// Published under Creative Commons CC-BY
+
+#include <glad.h>
+#include <glfw3.h>
+
+#include "glazy.h"
+#include <vector>
+#include <chrono>
+
+
+size_t const iterations = 100000;
+
+// Calls per second achieved by running 'body' for each iteration
+template<typename F>
+double calls_per_second(F&& body) {
+	glFinish();
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; i++) {
+		body(i);
+	}
+	glFinish();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return iterations / elapsed.count();
+}
+
+
+void run(char const* label) {
+	std::vector<glm::vec3> points(256, glm::vec3{ 1, 2, 3 });
+
+	glazy::Buffer<glm::vec3> pos;
+	pos.set_data(points, GL_DYNAMIC_DRAW);
+	glazy::VAO vao;
+
+	double uploads = calls_per_second([&](size_t i) {
+		pos.update(i % points.size(), std::span<glm::vec3 const>(points.data(), 1));
+	});
+
+	double reallocations = calls_per_second([&](size_t) {
+		pos.set_data(points, GL_DYNAMIC_DRAW);
+	});
+
+	double attributes = calls_per_second([&](size_t i) {
+		vao[i % 8] = pos;
+	});
+
+	std::cout << label << '\n'
+		<< "\tBuffer::update      " << uploads << " calls/s\n"
+		<< "\tBuffer::set_data    " << reallocations << " calls/s\n"
+		<< "\tAttribute::operator= " << attributes << " calls/s\n";
+}
+
+
+int main() {
+
+	std::vector<glazy::context::WindowHint> hints = {
+		{GLFW_VISIBLE, GLFW_FALSE}
+	};
+	GLFWwindow* window = glazy::context::setup({ 0, 0 }, { 64, 64 }, "DSA Benchmark", hints);
+
+	if (glazy::context::capabilities().direct_state_access) {
+		run("Direct state access:");
+	}
+	else {
+		std::cout << "Direct state access is not supported by this context.\n";
+	}
+
+	glazy::context::capabilities().direct_state_access = false;
+	run("Bind-and-restore:");
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	return 0;
+}
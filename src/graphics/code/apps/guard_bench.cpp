@@ -0,0 +1,86 @@
+// guard_bench.cpp measuring the per-call overhead of glazy's safety guards
+// Build with -DGLAZY_GUARD_POLICY=GLAZY_GUARD_OFF, _SAMPLED or _FULL to compare policies
+// Published under Creative Commons CC-BY
+
+#include <glad.h>
+#include <glfw3.h>
+
+#include "glazy.h"
+#include <vector>
+#include <chrono>
+
+
+size_t const iterations = 1000000;
+
+// Nanoseconds per iteration spent running 'body'
+template<typename F>
+double nanoseconds_per_call(F&& body) {
+	glFinish();
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; i++) {
+		body(i);
+	}
+	glFinish();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / iterations;
+}
+
+
+char const* policy_name() {
+	#if GLAZY_GUARD_POLICY == GLAZY_GUARD_OFF
+	return "off";
+	#elif GLAZY_GUARD_POLICY == GLAZY_GUARD_SAMPLED
+	return "sampled";
+	#else
+	return "full";
+	#endif
+}
+
+
+// Times a cheap GL call with and without guards around it, so the difference
+// is the cost of the guards alone
+void run(char const* label) {
+	double bare = nanoseconds_per_call([](size_t i) {
+		glVertexAttrib1f(0, static_cast<float>(i));
+	});
+
+	double guarded = nanoseconds_per_call([](size_t i) {
+		glazy::safety::entry_guard("guard_bench");
+		glVertexAttrib1f(0, static_cast<float>(i));
+		glazy::safety::exit_guard("guard_bench");
+	});
+
+	std::cout << label << '\n'
+		<< "\tunguarded call  " << bare << " ns\n"
+		<< "\tguarded call    " << guarded << " ns\n"
+		<< "\tguard overhead  " << (guarded - bare) << " ns\n";
+}
+
+
+int main() {
+
+	std::vector<glazy::context::WindowHint> hints = {
+		{GLFW_VISIBLE, GLFW_FALSE},
+		{GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE}
+	};
+	GLFWwindow* window = glazy::context::setup({ 0, 0 }, { 64, 64 }, "Guard Benchmark", hints);
+
+	std::cout << "Guard policy: " << policy_name() << "\n";
+
+	run("Polling glGetError:");
+
+	if (glazy::safety::use_debug_output(true)) {
+		run("KHR_debug callback:");
+		glazy::safety::use_debug_output(false);
+	}
+	else {
+		std::cout << "KHR_debug is not supported by this context.\n";
+	}
+
+	glazy::flags::debug = false;
+	run("Disabled through flags::debug:");
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	return 0;
+}
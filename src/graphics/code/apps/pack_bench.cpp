@@ -0,0 +1,87 @@
+// pack_bench.cpp measuring how fast the skyline and max-rects packers place
+// thousands of rectangles, and how much of the bin each manages to cover
+// Published under Creative Commons CC-BY
+
+#include <glad.h>
+#include <glfw3.h>
+
+#include "glazy.h"
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+
+int const bin_size = 3584;
+size_t const rect_count = 5000;
+size_t const trials = 5;
+
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+struct Size {
+	int width;
+	int height;
+};
+
+// Sprite-like sizes, mostly small, with the odd large one
+std::vector<Size> random_sizes(unsigned int seed) {
+	std::mt19937 generator(seed);
+	std::uniform_int_distribution<int> small(8, 64);
+	std::uniform_int_distribution<int> large(64, 160);
+	std::uniform_int_distribution<int> pick(0, 9);
+	std::vector<Size> sizes;
+	for (size_t i = 0; i < rect_count; i++) {
+		std::uniform_int_distribution<int>& side = (pick(generator) == 0) ? large : small;
+		sizes.push_back({ side(generator), side(generator) });
+	}
+	// Largest first, as TextureAtlas does
+	std::sort(sizes.begin(), sizes.end(), [](Size a, Size b) {
+		return std::max(a.width, a.height) > std::max(b.width, b.height);
+	});
+	return sizes;
+}
+
+struct Result {
+	double seconds;
+	size_t placed;
+	double occupancy;
+};
+
+template<typename Packer>
+Result run(std::vector<Size> const& sizes) {
+	auto start = std::chrono::steady_clock::now();
+	Packer packer(bin_size, bin_size);
+	size_t placed = 0;
+	for (Size size : sizes) {
+		if (packer.insert(size.width, size.height)) {
+			placed++;
+		}
+	}
+	return { seconds_since(start), placed, packer.occupancy() };
+}
+
+template<typename Packer>
+void report(char const* name) {
+	Result total = { 0, 0, 0 };
+	for (size_t trial = 0; trial < trials; trial++) {
+		Result result = run<Packer>(random_sizes(trial));
+		total.seconds += result.seconds;
+		total.placed += result.placed;
+		total.occupancy += result.occupancy;
+	}
+	std::cout << name << ":\n"
+		<< "\t" << (total.seconds / trials) * 1000.0 << " ms per " << rect_count << " rectangles\n"
+		<< "\t" << total.placed / trials << " placed\n"
+		<< "\t" << (total.occupancy / trials) * 100.0 << "% of the bin covered\n";
+}
+
+int main() {
+	std::cout << bin_size << "x" << bin_size << " bin, averaged over " << trials << " trials\n";
+	report<glazy::pack::Skyline>("Skyline");
+	report<glazy::pack::MaxRects>("MaxRects");
+	return 0;
+}
@@ -48,8 +48,9 @@ int main() {
 		vao[pos_index] = (glazy::Buffer<glm::vec3>&) pos;
 
 
-		glEnable(GL_DEPTH_TEST);
-		glUseProgram(program);
+		glazy::StateCache& state = glazy::StateCache::current();
+		state.enable(GL_DEPTH_TEST);
+		state.use_program(program);
 
 		while (!glfwWindowShouldClose(window)) {
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
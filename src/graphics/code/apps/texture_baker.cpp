@@ -0,0 +1,105 @@
+// texture_baker.cpp converting images into baked textures, with their mip
+// chains built and block-compressed ahead of time
+// Published under Creative Commons CC-BY
+
+#include <glad.h>
+#include <glfw3.h>
+
+#include "glazy.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <vector>
+#include <chrono>
+#include <cstring>
+
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+// Baking needs no GL context, as all of the work is done on the CPU
+int main(int argc, char** argv) {
+
+	// Options come before the format
+	glazy::mip::Options options;
+	int arg = 1;
+	try {
+		for (; (arg + 1 < argc) && (std::strncmp(argv[arg], "--", 2) == 0); arg += 2) {
+			std::string name = argv[arg];
+			std::string value = argv[arg + 1];
+			if (name == "--filter") {
+				if (value == "box") {
+					options.filter = glazy::mip::Filter::box;
+				}
+				else if (value == "kaiser") {
+					options.filter = glazy::mip::Filter::kaiser;
+				}
+				else if (value == "lanczos") {
+					options.filter = glazy::mip::Filter::lanczos;
+				}
+				else {
+					throw std::runtime_error("Unknown filter '" + value + "'.");
+				}
+			}
+			else if (name == "--coverage") {
+				options.alpha_coverage = std::stof(value);
+			}
+			else {
+				throw std::runtime_error("Unknown option '" + name + "'.");
+			}
+		}
+	}
+	catch (std::exception const& error) {
+		std::cerr << error.what() << "\n";
+		return 1;
+	}
+
+	if ((argc - arg < 3) || (((argc - arg) % 2) != 1)) {
+		std::cerr << "Usage: " << argv[0] << " [--filter box|kaiser|lanczos] [--coverage <alpha threshold>]"
+			<< " <format> <input> <output> [<input> <output>]...\n"
+			<< "Formats: rgba8, srgb8_a8, bc1, bc1_srgb, bc3, bc3_srgb\n";
+		return 1;
+	}
+
+	try {
+		glazy::bake::Format format = glazy::bake::parse_format(argv[arg]);
+		// sRGB texels are filtered as the linear values they stand for
+		options.srgb = glazy::bake::is_srgb(format);
+		for (arg++; arg < argc; arg += 2) {
+			char const* input = argv[arg];
+			char const* output = argv[arg + 1];
+
+			auto start = std::chrono::steady_clock::now();
+			int width, height, channels;
+			unsigned char* data = stbi_load(input, &width, &height, &channels, 4);
+			if (data == nullptr) {
+				throw std::runtime_error(std::string("Failed to load image '") + input + "'.");
+			}
+			std::vector<glazy::format::RGBA8> texels(size_t(width) * height);
+			std::memcpy(texels.data(), data, texels.size() * sizeof(glazy::format::RGBA8));
+			stbi_image_free(data);
+			double decode_seconds = seconds_since(start);
+
+			start = std::chrono::steady_clock::now();
+			auto levels = glazy::bake::mip_chain(std::move(texels), width, height, options);
+			double mip_seconds = seconds_since(start);
+
+			start = std::chrono::steady_clock::now();
+			glazy::bake::write(output, format, levels, width, height);
+			double encode_seconds = seconds_since(start);
+
+			std::cout << input << " -> " << output << " (" << width << "x" << height << ", "
+				<< levels.size() << " levels, " << std::filesystem::file_size(output) << " bytes)\n"
+				<< "\tdecode " << decode_seconds * 1000.0 << " ms, mips " << mip_seconds * 1000.0
+				<< " ms, encode and write " << encode_seconds * 1000.0 << " ms\n";
+		}
+	}
+	catch (std::exception const& error) {
+		std::cerr << error.what() << "\n";
+		return 1;
+	}
+	return 0;
+}
@@ -21,8 +21,19 @@ GLboolean show_model = false;
 GLboolean show_world = false;
 GLboolean show_view = false;
 
-std::vector<glm::vec3> pos_cpu;
-std::vector<glm::vec2> uv_cpu;
+glazy::shape::Indexed<glm::vec3> pos_cpu;
+glazy::shape::Indexed<glm::vec2> uv_cpu;
+
+// Matches the Camera uniform block of the demo's shaders
+struct Camera {
+	glm::mat4 view_transform;
+	glm::mat4 proj_transform;
+};
+
+template<> struct glazy::BlockLayout<Camera> : glazy::std140::Fields<
+	GLAZY_BLOCK_FIELD(Camera, view_transform),
+	GLAZY_BLOCK_FIELD(Camera, proj_transform)
+> {};
 
 
 
@@ -30,7 +41,7 @@ GLFWwindow *setup();
 void key_handler(GLFWwindow* window, int key, int scancode, int action, int mods);
 GLuint create_vertex_buffer(std::vector<glm::vec3> pos_cpu);
 void set_point_buffer(GLuint buffer);
-void display(GLFWwindow*w,glazy::GPUProgram &prog, glazy::Texture &the_texture);
+void display(GLFWwindow*w,glazy::GPUProgram &prog, glazy::UniformBlock<Camera> &camera, glazy::TextureStorage &the_texture, glazy::IndexBuffer &indices);
 
 
 
@@ -47,34 +58,42 @@ int main() {
 		{},
 		glazy::Shader<GL_FRAGMENT_SHADER>::from_file("./shaders/texture/texture.frag")
 	);
+	glazy::UniformBlock<Camera> camera(0);
+	camera.attach(program, "Camera");
 
-	std::vector<glazy::Texture::RGB8> texture_data;
+	// Four bytes a texel, so every row is uploaded 4-byte aligned
+	std::vector<glazy::format::RGBA8> texture_data;
 	texture_data.resize(128 * 128);
 	for (int y = 0; y < 128; y++) {
 		for (int x = 0; x < 128; x++) {
-			texture_data[y * 128 + x] = glazy::Texture::RGB8{
+			texture_data[y * 128 + x] = glazy::format::RGBA8{
 				static_cast<unsigned char>(y*2),
 				static_cast<unsigned char>(x*2),
+				255,
 				255
 			};
 			if (((x % 10) == 0) || ((y%10) == 0)) {
-				texture_data[y * 128 + x] = glazy::Texture::RGB8{ 0,0,0 };
+				texture_data[y * 128 + x] = glazy::format::RGBA8{ 0,0,0,255 };
 			}
 		}
 	}
 
-	glazy::Texture the_texture(texture_data, 128, 128, true);
+	glazy::Texture2D<glazy::format::RGBA8> the_texture(texture_data, 128, 128, true);
 	
 
 	glazy::SharedVAO vao;
 	
 	glazy::SharedBuffer<glm::vec3> pos;
-	pos_cpu = glazy::shape::sphere(100, 100, 1);
-	pos.set_data(pos_cpu, GL_STATIC_DRAW);
+	pos_cpu = glazy::shape::indexed_sphere(100, 100, 1);
+	pos.set_data(pos_cpu.vertices, GL_STATIC_DRAW);
 	
 	glazy::SharedBuffer<glm::vec2> uv;
-	uv_cpu = glazy::shape::uv_grid(100, 100);
-	uv.set_data(uv_cpu, GL_STATIC_DRAW);
+	uv_cpu = glazy::shape::indexed_uv_grid(100, 100);
+	uv.set_data(uv_cpu.vertices, GL_STATIC_DRAW);
+
+	// The sphere and uv grid share the same vertex layout, and so the same indices
+	glazy::IndexBuffer indices;
+	indices.set_data(pos_cpu.indices, GL_STATIC_DRAW);
 
 
 	GLint pos_index = program.attribute_index("pos");
@@ -85,19 +104,19 @@ int main() {
 		vao[pos_index] = (glazy::Buffer<glm::vec3>&) pos;
 		vao[uv_index].enable();
 		vao[uv_index] = (glazy::Buffer<glm::vec2>&) uv;
+		vao.set_indices(indices);
 
-		glEnable(GL_DEPTH_TEST);
+		glazy::StateCache& state = glazy::StateCache::current();
+		state.enable(GL_DEPTH_TEST);
 
-		glUseProgram(program);
+		state.use_program(program);
 	
-		glazy::safety::auto_throw("Before ActiveTexture");
-		glActiveTexture(GL_TEXTURE0);
-		glazy::safety::auto_throw("After ActiveTexture");
-		glBindTexture(GL_TEXTURE_2D,(GLuint) the_texture);
+		glazy::safety::auto_throw("Before BindTexture");
+		state.bind_texture(0, GL_TEXTURE_2D, the_texture);
 		glazy::safety::auto_throw("After BindTexture");
 
 		while (!glfwWindowShouldClose(window)) {
-			display(window, program,the_texture);
+			display(window, program, camera, the_texture, indices);
 		}
 	}
 
@@ -128,7 +147,7 @@ void key_handler(GLFWwindow* window, int key, int scancode, int action, int mods
 
 
 
-void display(GLFWwindow* w, glazy::GPUProgram &program, glazy::Texture &the_texture) {
+void display(GLFWwindow* w, glazy::GPUProgram &program, glazy::UniformBlock<Camera> &camera, glazy::TextureStorage &the_texture, glazy::IndexBuffer &indices) {
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	GLfloat time = (float) glfwGetTime();
@@ -151,10 +170,9 @@ void display(GLFWwindow* w, glazy::GPUProgram &program, glazy::Texture &the_text
 //	program[{"time"}] = time;
 //	program[{"the_texture"}]    = (GLint) 0;
 	program[{"modl_transform"}] = modl_transform;
-	program[{"view_transform"}] = view_transform;
-	program[{"proj_transform"}] = proj_transform;
+	camera = Camera{ view_transform, proj_transform };
 
-	glDrawArrays(GL_TRIANGLES, 0, pos_cpu.size());
+	glazy::draw::elements(GL_TRIANGLES, indices);
 
 	glFlush();
 
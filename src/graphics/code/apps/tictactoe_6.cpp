@@ -2,6 +2,9 @@
 #include <glad.h>
 #include <glfw3.h>
 #include <glm/glm.hpp>
+#include "glazy_state.h"
+#include "glazy_block.h"
+#include "glazy_atlas.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -9,8 +12,10 @@
 #include <vector>
 #include <string>
 #include <stdexcept>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <future>
 
 
 struct WindowHint {
@@ -40,51 +45,21 @@ GLFWwindow* setup(glm::ivec2 position, glm::ivec2 dimensions, const char* title,
 std::string read_file_to_string(std::string file_path);
 
 
-class Texture {
-	GLuint id;
-public:
-
-	Texture(std::string file_path, bool mipmap) {
-		// Allocate id
-		id = 0;
-		glGenTextures(1, &id);
-		if (id == 0) {
-			throw std::runtime_error("Failed to allocate texture id.");
-		}
-		// Load image data, width, and height
-		int width, height, n;
-		unsigned char* data = stbi_load(file_path.c_str(), &width, &height, &n, 3);
-
-		// Store image data to texture
-		glBindTexture(GL_TEXTURE_2D, id);
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-
-		// Set up mipmaps, if necessary. We'll assume you want GL_NEAREST if you don't want mipmaps
-		if (mipmap) {
-			glGenerateMipmap(GL_TEXTURE_2D);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		}
-		else {
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		}
-
-		// Unbind the texture, to avoid foot rakes
-		glBindTexture(GL_TEXTURE_2D, 0);
-	}
-	// Free id at end of lifetime
-	~Texture() {
-		glDeleteTextures(1, &id);
-	}
-	// No copies, to avoid double-deletes
-	Texture(Texture&) = delete;
-	// Allow class to automatically cast into its id
-	operator GLuint() {
-		return id;
-	}
-};
+// Loads an image file for packing into a texture atlas
+glazy::Image load_image(std::string file_path) {
+	int width, height, n;
+	unsigned char* data = stbi_load(file_path.c_str(), &width, &height, &n, 3);
+	if (data == nullptr) {
+		throw std::runtime_error("Failed to load image '" + file_path + "'.");
+	}
+	glazy::Image image;
+	image.width = width;
+	image.height = height;
+	image.pixels.resize(size_t(width) * height);
+	std::memcpy(image.pixels.data(), data, image.pixels.size() * sizeof(glazy::Texture::RGB8));
+	stbi_image_free(data);
+	return image;
+}
 
 
 
@@ -266,15 +241,39 @@ public:
 
 
 
+// The per-tile values of the "Tile" uniform block
+struct TileConstants {
+	glm::vec2 offset;
+	glm::vec2 scale;
+	// Where the tile's image sits within the atlas
+	glm::vec2 uv_offset;
+	glm::vec2 uv_scale;
+	GLfloat   dim;
+};
+
+// Lets glazy check, at compile time, that TileConstants is laid out
+// the way GLSL lays out the block
+template<> struct glazy::BlockLayout<TileConstants> : glazy::std140::Fields<
+	GLAZY_BLOCK_FIELD(TileConstants, offset),
+	GLAZY_BLOCK_FIELD(TileConstants, scale),
+	GLAZY_BLOCK_FIELD(TileConstants, uv_offset),
+	GLAZY_BLOCK_FIELD(TileConstants, uv_scale),
+	GLAZY_BLOCK_FIELD(TileConstants, dim)
+> {};
+
+
 class GameState {
 
-	// Textures needed for tic tac toe
-	Texture x_tex; // For tiles marked 'x'
-	Texture o_tex; // For tiles marked 'o'
-	Texture blank_tex; // For blank tiles
-	Texture x_wins_tex; // Message for when x wins
-	Texture o_wins_tex; // Message for when o wins
-	Texture draw_tex;   // Message for draws (aka ties)
+	// Every image needed for tic tac toe, packed into one texture, so
+	// that it only needs to be bound once per frame
+	glazy::TextureAtlas atlas;
+	// Where each image sits within the atlas
+	glazy::TextureAtlas::UVRect x_uv; // For tiles marked 'x'
+	glazy::TextureAtlas::UVRect o_uv; // For tiles marked 'o'
+	glazy::TextureAtlas::UVRect blank_uv; // For blank tiles
+	glazy::TextureAtlas::UVRect x_wins_uv; // Message for when x wins
+	glazy::TextureAtlas::UVRect o_wins_uv; // Message for when o wins
+	glazy::TextureAtlas::UVRect draw_uv;   // Message for draws (aka ties)
 
 	// The shaders/program used for rendering quads
 	Shader<GL_VERTEX_SHADER> vertex;
@@ -287,12 +286,9 @@ class GameState {
 	GLint uv_index;
 	// Index of the "the_texture" uniform
 	GLint tex_index;
-	// Index of the "offset" uniform
-	GLint offset_index;
-	// Index of the "scale" uniform
-	GLint scale_index;
-	// Index of the "dim" uniform
-	GLint dim_index;
+	// Where each tile's offset, scale and dim are packed, with room
+	// for every tile in the grid
+	glazy::DrawConstants<TileConstants> tiles;
 
 	// Create Buffer Object for quad vertex positions
 	Buffer<glm::vec3> pos;
@@ -340,22 +336,45 @@ public:
 
 
 GameState::GameState()
-	: x_tex("assets/x.png",false)
-	, o_tex("assets/o.png",false)
-	, blank_tex("assets/blank.png",false)
-	, x_wins_tex("assets/x_win.png",false)
-	, o_wins_tex("assets/o_win.png",false)
-	, draw_tex("assets/draw.png",false)
-	, vertex(read_file_to_string("shaders/tictactoe/tictactoe4.vert"))
+	: vertex(read_file_to_string("shaders/tictactoe/tictactoe4.vert"))
 	, fragment(read_file_to_string("shaders/tictactoe/tictactoe4.frag"))
 	, program(vertex,fragment)
 	, pos_index(program.attribute_index("pos"))
 	, uv_index(program.attribute_index("uv"))
 	, tex_index(glGetUniformLocation(program,"the_texture"))
-	, offset_index(glGetUniformLocation(program,"offset"))
-	, scale_index(glGetUniformLocation(program,"scale"))
-	, dim_index(glGetUniformLocation(program,"dim"))
+	, tiles(0, 9)
 {
+	// Decoding is the slow part of loading, and needs no GL context,
+	// so every image is decoded on a thread of its own
+	auto x_image = std::async(std::launch::async, load_image, "assets/x.png");
+	auto o_image = std::async(std::launch::async, load_image, "assets/o.png");
+	auto blank_image = std::async(std::launch::async, load_image, "assets/blank.png");
+	auto x_wins_image = std::async(std::launch::async, load_image, "assets/x_win.png");
+	auto o_wins_image = std::async(std::launch::async, load_image, "assets/o_win.png");
+	auto draw_image = std::async(std::launch::async, load_image, "assets/draw.png");
+	size_t x_index = atlas.add(x_image.get());
+	size_t o_index = atlas.add(o_image.get());
+	size_t blank_index = atlas.add(blank_image.get());
+	size_t x_wins_index = atlas.add(x_wins_image.get());
+	size_t o_wins_index = atlas.add(o_wins_image.get());
+	size_t draw_index = atlas.add(draw_image.get());
+	// No mipmaps, as the images are drawn at close to their own size
+	glazy::AtlasOptions options;
+	options.mipmap = false;
+	atlas.build(options);
+	x_uv = atlas.uv(x_index);
+	o_uv = atlas.uv(o_index);
+	blank_uv = atlas.uv(blank_index);
+	x_wins_uv = atlas.uv(x_wins_index);
+	o_wins_uv = atlas.uv(o_wins_index);
+	draw_uv = atlas.uv(draw_index);
+
+	// This program always samples from texture unit zero, so the
+	// uniform only needs setting once
+	glProgramUniform1i(program, tex_index, 0);
+
+	// Have the "Tile" block read from the binding point of the tiles
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Tile"), tiles.binding_point());
 
 	pos = quad_pos_cpu;
 	uv = quad_uv_cpu;
@@ -508,88 +527,94 @@ void GameState::move(int x_delta, int y_delta) {
 
 // Render the gamestate to the screen
 void GameState::render() {
+	// The state cache remembers what we set last frame, so each of
+	// the calls below only reaches the driver if it changes something
+	glazy::StateCache& state = glazy::StateCache::current();
 	// Make our GPU program the current one for the context
-	glUseProgram(program);
+	state.use_program(program);
 	// Make sure things that are in front stay in front
-	glEnable(GL_DEPTH_TEST);
+	state.enable(GL_DEPTH_TEST);
 	// Technically unnecessary, but the initial VAO binding may be
 	// different in larger projects, when multiple VAOs are used
-	glBindVertexArray(vao);
-	// Also technically unnecessary, since this program always
-	// uses texture unit zero, but its good to make sure anyway
-	glUniform1i(tex_index, 0);
-	glActiveTexture(GL_TEXTURE0);
+	state.bind_vertex_array(vao);
+	// The program's texture uniform was pointed at unit zero in the
+	// constructor, so only the unit needs to be made active
+	state.active_texture(0);
+	// Every tile reads from the atlas, so one bind covers the frame
+	state.bind_texture(GL_TEXTURE_2D, atlas.get_texture());
+	// Start writing tile constants into this frame's part of the buffer
+	tiles.begin_frame();
 
 	// If the game has ended, show the endgame message
 	if (endgame) {
-		// A message id to set based upon the winner
-		GLuint message;
+		// A message to show based upon the winner
+		glazy::TextureAtlas::UVRect message;
 		if (winner == 'x') {
-			message = x_wins_tex;
+			message = x_wins_uv;
 		}
 		else if (winner == 'o') {
-			message = o_wins_tex;
+			message = o_wins_uv;
 		}
 		else {
-			message = draw_tex;
+			message = draw_uv;
 		}
-		// Bind the correct message to the texture for the quad
-		glBindTexture(GL_TEXTURE_2D, message);
 		// Place the message in the center of the window
 		glm::vec2 offset(0,0);
 		glm::vec2 scale (0.6,0.6);
-		glUniform1i(tex_index, 0);
-		glUniform2fv(offset_index, 1, (GLfloat*) & offset);
-		glUniform2fv(scale_index,  1, (GLfloat*) & scale);
 		// Endgame messages should never be dimmed
-		glUniform1i (dim_index,1.0);
+		tiles.push({ offset, scale, message.offset, message.scale, 1.0f });
 		// Draw the quad
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 	}
 	else {
 		glm::vec2 scale (1.f/5.f,1.f/5.f);
-		glUniform2fv(scale_index,  1, (GLfloat*) & scale);
 		// Iterate through the grid to draw each tile
 		for (int y = 0; y < 3; y++) {
 			for (int x = 0; x < 3; x++) {
 				std::cout << '[' << grid[x][y] << ']';
-				// Select the correct texture for the tile
-				GLint tile_image;
+				// Select the correct image for the tile
+				glazy::TextureAtlas::UVRect tile_image;
 				if (grid[x][y] == 'o') {
-					tile_image = o_tex;
+					tile_image = o_uv;
 				}
 				else if (grid[x][y] == 'x') {
-					tile_image = x_tex;
+					tile_image = x_uv;
 				}
 				else {
-					tile_image = blank_tex;
+					tile_image = blank_uv;
 				}
-				// Bind the correct texture
-				glBindTexture(GL_TEXTURE_2D, tile_image);
 				// Offset the quad to the correct grid position
 				glm::vec2 offset((x-1)/2.f,(y-1)/2.f);
-				glUniform2fv(offset_index, 1, (GLfloat*) & offset);
 				// If the user is selecting an already filled tile,
 				// that tile should be dimmed to show it as a recieved,
 				// but invalid input.
+				GLfloat dim = 1.0f;
 				if ((x == x_select) && (y == y_select)) {
 					if (bad) {
-						glUniform1f(dim_index, 0.25f);
+						dim = 0.25f;
 					}
 					else {
-						glUniform1f(dim_index, 0.5f);
+						dim = 0.5f;
 					}
 				}
-				else {
-					glUniform1f(dim_index, 1.0f);
-				}
-				// Draw the quad
-				glDrawArrays(GL_TRIANGLES, 0, 6);
+				// Write this tile's constants, to be drawn once every
+				// tile's constants are written
+				tiles.write({ offset, scale, tile_image.offset, tile_image.scale, dim });
 			}
 			std::cout << std::endl;
 		}
 		std::cout << std::endl;
+		// Send every tile's constants to the GPU at once
+		tiles.upload();
+		for (size_t slot = 0; slot < 9; slot++) {
+			// Point the "Tile" block at this tile's constants
+			tiles.bind(slot);
+			// Draw the quad
+			glDrawArrays(GL_TRIANGLES, 0, 6);
+		}
 	}
+	// Let the buffer know this frame's tiles have all been drawn
+	tiles.end_frame();
 }
 
 
@@ -730,6 +755,8 @@ GLFWwindow* setup(glm::ivec2 position, glm::ivec2 dimensions, const char* title,
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
 		throw std::runtime_error("Failed to initialize OpenGL context.");
 	}
+	// Let glazy know which extensions it can use, such as persistent mapping
+	glazy::context::detect_capabilities();
 	return result;
 }
 
@@ -5,10 +5,23 @@
 
 
 #include "glazy_common.h"
+#include "glazy_state.h"
+#include "glazy_objects.h"
 #include "glazy_buffer.h"
 #include "glazy_vao.h"
 #include "glazy_program.h"
+#include "glazy_block.h"
+#include "glazy_cache.h"
+#include "glazy_reload.h"
+#include "glazy_preprocess.h"
+#include "glazy_pipeline.h"
 #include "glazy_texture.h"
+#include "glazy_mip.h"
+#include "glazy_atlas.h"
+#include "glazy_stream.h"
+#include "glazy_bake.h"
+#include "glazy_arena.h"
+#include "glazy_upload.h"
 
 
 #endif
@@ -0,0 +1,274 @@
+
+
+#ifndef GLAZY_ARENA
+#define GLAZY_ARENA
+
+#include "glazy_vao.h"
+#include <map>
+
+
+namespace glazy {
+
+	// Hands out non-overlapping ranges of a fixed-capacity space, using a free
+	// list ordered by offset. Allocation is first-fit, and released ranges are
+	// merged with their free neighbors so that the list stays short.
+	class RangeAllocator {
+
+		size_t total;
+		size_t used_total;
+		std::map<size_t, size_t> free_ranges;
+
+	public:
+
+		static size_t const npos = static_cast<size_t>(-1);
+
+		RangeAllocator(size_t capacity);
+
+		// Returns the offset of the new range, or npos if no free range is large enough
+		size_t allocate(size_t length);
+		void release(size_t offset, size_t length);
+
+		// Adds space to the end of the allocator
+		void grow(size_t new_capacity);
+		// Marks [0, used) as allocated and everything after it as free
+		void reset(size_t used);
+
+		size_t capacity() const;
+		size_t used() const;
+		size_t largest_free() const;
+		size_t free_block_count() const;
+		// Zero when all free space is contiguous, approaching one as it is split
+		// into many small pieces
+		float fragmentation() const;
+
+	};
+
+
+	// Many meshes, packed into one large vertex buffer and one large index buffer
+	// that share a single VAO. Each mesh is drawn with a base-vertex draw, so
+	// drawing any number of meshes needs only one VAO binding.
+	//
+	// Meshes are referred to through handles, rather than by their location in the
+	// buffers, so that the arena is free to move them when it defragments or grows.
+	template<typename V>
+	class MeshArena {
+
+	public:
+
+		// A slot of the arena, and which of the meshes to have held that slot
+		// it refers to, so that handles to removed meshes are caught even once
+		// the slot is reused
+		struct Handle {
+			size_t   slot;
+			uint32_t generation;
+		};
+
+		struct Stats {
+			size_t mesh_count;
+			size_t vertex_capacity;
+			size_t vertex_used;
+			size_t index_capacity;
+			size_t index_used;
+			size_t free_blocks;
+			float  vertex_fragmentation;
+			float  index_fragmentation;
+		};
+
+	private:
+
+		struct Mesh {
+			size_t vertex_first;
+			size_t vertex_count;
+			size_t index_first;
+			size_t index_count;
+			bool   live;
+			// Bumped each time the slot's mesh is removed
+			uint32_t generation;
+		};
+
+		Buffer<V>      vertices;
+		Buffer<GLuint> indices;
+		VAO            vao;
+		GLenum         usage;
+		std::vector<layout::Format> formats;
+		RangeAllocator vertex_ranges;
+		RangeAllocator index_ranges;
+		std::vector<Mesh>   meshes;
+		std::vector<size_t> free_slots;
+
+		Mesh& lookup(Handle handle) {
+			if ((handle.slot >= meshes.size()) || !meshes[handle.slot].live
+				|| (meshes[handle.slot].generation != handle.generation)) {
+				throw std::runtime_error("Invalid MeshArena handle.");
+			}
+			return meshes[handle.slot];
+		}
+
+		void attach() {
+			vao.set_vertices(vertices, sizeof(V), formats.data(), formats.size());
+			vao.set_indices(indices);
+		}
+
+		// Copies each live mesh into a fresh pair of buffers, packed from the start
+		// and in their current order. The copies are done entirely on the GPU.
+		void repack(size_t vertex_capacity, size_t index_capacity) {
+			std::vector<size_t> order;
+			for (size_t slot = 0; slot < meshes.size(); slot++) {
+				if (meshes[slot].live) {
+					order.push_back(slot);
+				}
+			}
+			std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+				return meshes[a].vertex_first < meshes[b].vertex_first;
+			});
+
+			Buffer<V> new_vertices;
+			Buffer<GLuint> new_indices;
+			new_vertices.allocate(vertex_capacity, usage);
+			new_indices.allocate(index_capacity, usage);
+
+			size_t vertex_cursor = 0;
+			size_t index_cursor = 0;
+			for (size_t slot : order) {
+				Mesh& mesh = meshes[slot];
+				compat::copy_named_buffer_sub_data(vertices, new_vertices,
+					sizeof(V) * mesh.vertex_first, sizeof(V) * vertex_cursor, sizeof(V) * mesh.vertex_count);
+				compat::copy_named_buffer_sub_data(indices, new_indices,
+					sizeof(GLuint) * mesh.index_first, sizeof(GLuint) * index_cursor, sizeof(GLuint) * mesh.index_count);
+				mesh.vertex_first = vertex_cursor;
+				mesh.index_first = index_cursor;
+				vertex_cursor += mesh.vertex_count;
+				index_cursor += mesh.index_count;
+			}
+
+			vertices = std::move(new_vertices);
+			indices = std::move(new_indices);
+			vertex_ranges.grow(vertex_capacity);
+			index_ranges.grow(index_capacity);
+			vertex_ranges.reset(vertex_cursor);
+			index_ranges.reset(index_cursor);
+			attach();
+		}
+
+		// Makes room for a mesh of the given size, defragmenting if there is
+		// enough free space overall, and growing the buffers otherwise.
+		void make_room(size_t vertex_count, size_t index_count) {
+			size_t vertex_free = vertex_ranges.capacity() - vertex_ranges.used();
+			size_t index_free = index_ranges.capacity() - index_ranges.used();
+			size_t vertex_capacity = vertex_ranges.capacity();
+			size_t index_capacity = index_ranges.capacity();
+			if (vertex_free < vertex_count) {
+				vertex_capacity = std::max(vertex_capacity * 2, vertex_ranges.used() + vertex_count);
+			}
+			if (index_free < index_count) {
+				index_capacity = std::max(index_capacity * 2, index_ranges.used() + index_count);
+			}
+			repack(vertex_capacity, index_capacity);
+		}
+
+	public:
+
+		template<typename... FIELDS>
+		MeshArena(layout::VertexLayout<FIELDS...> const& layout, size_t vertex_capacity, size_t index_capacity, GLenum usage = GL_STATIC_DRAW)
+			: usage(usage)
+			, vertex_ranges(vertex_capacity)
+			, index_ranges(index_capacity)
+		{
+			static_assert(
+				std::is_same<V, typename layout::VertexLayout<FIELDS...>::vertex_type>::value,
+				"Vertex layout does not describe the arena's vertex type."
+			);
+			auto layout_formats = layout.formats();
+			formats.assign(layout_formats.begin(), layout_formats.end());
+			vertices.allocate(vertex_capacity, usage);
+			indices.allocate(index_capacity, usage);
+			attach();
+		}
+
+		MeshArena(MeshArena&) = delete;
+
+		operator VAO& () {
+			return vao;
+		}
+
+		// Copies a mesh into the arena. Indices are relative to the mesh's own
+		// vertices, exactly as they would be for a standalone mesh.
+		Handle add(std::span<V const> mesh_vertices, std::span<GLuint const> mesh_indices) {
+			safety::entry_guard("MeshArena::add");
+			size_t vertex_first = vertex_ranges.allocate(mesh_vertices.size());
+			size_t index_first = index_ranges.allocate(mesh_indices.size());
+			if ((vertex_first == RangeAllocator::npos) || (index_first == RangeAllocator::npos)) {
+				if (vertex_first != RangeAllocator::npos) {
+					vertex_ranges.release(vertex_first, mesh_vertices.size());
+				}
+				if (index_first != RangeAllocator::npos) {
+					index_ranges.release(index_first, mesh_indices.size());
+				}
+				make_room(mesh_vertices.size(), mesh_indices.size());
+				vertex_first = vertex_ranges.allocate(mesh_vertices.size());
+				index_first = index_ranges.allocate(mesh_indices.size());
+			}
+			vertices.update(vertex_first, mesh_vertices);
+			indices.update(index_first, mesh_indices);
+
+			Mesh mesh = { vertex_first, mesh_vertices.size(), index_first, mesh_indices.size(), true, 0 };
+			Handle handle;
+			if (free_slots.empty()) {
+				handle.slot = meshes.size();
+				meshes.push_back(mesh);
+			}
+			else {
+				handle.slot = free_slots.back();
+				free_slots.pop_back();
+				mesh.generation = meshes[handle.slot].generation;
+				meshes[handle.slot] = mesh;
+			}
+			handle.generation = mesh.generation;
+			safety::exit_guard("MeshArena::add");
+			return handle;
+		}
+
+		void remove(Handle handle) {
+			Mesh& mesh = lookup(handle);
+			vertex_ranges.release(mesh.vertex_first, mesh.vertex_count);
+			index_ranges.release(mesh.index_first, mesh.index_count);
+			mesh.live = false;
+			mesh.generation++;
+			free_slots.push_back(handle.slot);
+		}
+
+		// Draws a single mesh. The arena's VAO must be bound.
+		void draw(Handle handle, GLenum mode = GL_TRIANGLES) {
+			safety::entry_guard("MeshArena::draw");
+			Mesh& mesh = lookup(handle);
+			void const* offset = reinterpret_cast<void const*>(sizeof(GLuint) * mesh.index_first);
+			glDrawElementsBaseVertex(mode, mesh.index_count, GL_UNSIGNED_INT, offset, mesh.vertex_first);
+			safety::exit_guard("MeshArena::draw");
+		}
+
+		// Moves every mesh to the front of the buffers, leaving all free space
+		// in one contiguous block at the end.
+		void defragment() {
+			safety::entry_guard("MeshArena::defragment");
+			repack(vertex_ranges.capacity(), index_ranges.capacity());
+			safety::exit_guard("MeshArena::defragment");
+		}
+
+		Stats stats() const {
+			Stats result;
+			result.mesh_count = meshes.size() - free_slots.size();
+			result.vertex_capacity = vertex_ranges.capacity();
+			result.vertex_used = vertex_ranges.used();
+			result.index_capacity = index_ranges.capacity();
+			result.index_used = index_ranges.used();
+			result.free_blocks = vertex_ranges.free_block_count() + index_ranges.free_block_count();
+			result.vertex_fragmentation = vertex_ranges.fragmentation();
+			result.index_fragmentation = index_ranges.fragmentation();
+			return result;
+		}
+
+	};
+
+}
+
+#endif
@@ -0,0 +1,192 @@
+
+
+#ifndef GLAZY_ATLAS
+#define GLAZY_ATLAS
+
+#include "glazy_texture.h"
+#include <optional>
+#include <memory>
+
+
+namespace glazy {
+
+	// Rectangle packers, which place rectangles one at a time within a fixed
+	// bin, never moving one once placed. Both are CPU-only.
+	namespace pack {
+
+		struct Rect {
+			int x;
+			int y;
+			int width;
+			int height;
+		};
+
+		// Keeps the outline of the placed rectangles' top edges and puts each new
+		// rectangle where it would sit lowest. Fast, with little bookkeeping, but
+		// cannot use space hidden under overhangs.
+		class Skyline {
+
+			struct Segment {
+				int x;
+				int y;
+				int width;
+			};
+
+			int bin_width;
+			int bin_height;
+			size_t used;
+			std::vector<Segment> segments;
+
+			// The lowest y at which a rectangle starting at segment 'index' fits,
+			// or -1 if it does not fit there
+			int fit(size_t index, int width, int height) const;
+
+		public:
+
+			Skyline(int width, int height);
+
+			std::optional<Rect> insert(int width, int height);
+
+			int width() const;
+			int height() const;
+			// Fraction of the bin covered by placed rectangles
+			double occupancy() const;
+
+		};
+
+		// Tracks every maximal free rectangle and places each new rectangle in
+		// the free one that leaves the shortest leftover side. Packs tighter than
+		// Skyline, at a higher cost per rectangle.
+		class MaxRects {
+
+			int bin_width;
+			int bin_height;
+			size_t used;
+			std::vector<Rect> free;
+
+			// Replaces the free rectangles the placed one overlaps with the parts
+			// of them it leaves uncovered
+			void split(Rect const& placed);
+			// Drops any new piece or free rectangle contained in another, then adds
+			// the remaining pieces to the free list
+			void prune(std::vector<Rect>& pieces);
+
+		public:
+
+			MaxRects(int width, int height);
+
+			std::optional<Rect> insert(int width, int height);
+
+			int width() const;
+			int height() const;
+			double occupancy() const;
+
+		};
+
+	}
+
+
+	// Pixels of an image, one row after another
+	struct Image {
+		std::vector<Texture::RGB8> pixels;
+		size_t width;
+		size_t height;
+	};
+
+
+	struct AtlasOptions {
+		enum Packer {
+			skyline,
+			max_rects,
+		};
+
+		// Texels around each image, filled by repeating its edge, so that
+		// filtering near the edge does not pick up neighbours. Mip levels up to
+		// log2(padding) stay clean.
+		int    padding  = 2;
+		int    max_size = 4096;
+		bool   mipmap   = true;
+		Packer packer   = max_rects;
+	};
+
+
+	// Packs many small images into one texture, so that drawing any of them
+	// needs the same texture bound. Images are added first, then packed and
+	// uploaded together by 'build'.
+	class TextureAtlas {
+
+	public:
+
+		// Where an image sits within the atlas, as a transform from the image's
+		// own texture coordinates: atlas_uv = offset + uv * scale
+		struct UVRect {
+			glm::vec2 offset;
+			glm::vec2 scale;
+		};
+
+	private:
+
+		std::vector<Image> images;
+		std::vector<pack::Rect> rects;
+		glm::ivec2 dimensions;
+		std::unique_ptr<Texture> texture;
+
+		// Tries to pack every image into a bin of the given size
+		bool pack(glm::ivec2 size, AtlasOptions const& options);
+
+	public:
+
+		TextureAtlas();
+		TextureAtlas(TextureAtlas&) = delete;
+
+		// Returns the index the image's rectangle will have
+		size_t add(Image image);
+
+		// Packs the added images into the smallest power-of-two texture they
+		// fit, and uploads it. The added images are released afterward. Throws
+		// if they do not fit within options.max_size.
+		void build(AtlasOptions options = {});
+
+		// The rectangle of an image, padding excluded, in texels
+		pack::Rect rect(size_t index) const;
+		UVRect uv(size_t index) const;
+
+		glm::ivec2 size() const;
+		// Only valid after 'build'
+		Texture& get_texture();
+
+	};
+
+
+	// A GL_TEXTURE_2D_ARRAY, holding same-sized images as layers that shaders
+	// pick by index. Unlike an atlas, layers never bleed into one another, so
+	// no padding is needed and every mip level is usable.
+	class TextureArray {
+
+		GLuint id;
+		size_t width;
+		size_t height;
+		size_t layers;
+		bool   mipmap;
+
+	public:
+
+		TextureArray(size_t width, size_t height, size_t layers, bool mipmap);
+		// Makes an array with one layer per image, which must all be the same
+		// size
+		TextureArray(std::vector<Image> const& images, bool mipmap);
+		TextureArray(TextureArray&) = delete;
+		~TextureArray();
+
+		void set_layer(size_t layer, Image const& image);
+		// Rebuilds the mip levels from level zero of every layer
+		void generate_mipmaps();
+
+		size_t layer_count() const;
+		operator GLuint();
+
+	};
+
+}
+
+#endif
@@ -0,0 +1,119 @@
+
+
+#ifndef GLAZY_BAKE
+#define GLAZY_BAKE
+
+#include "glazy_texture.h"
+#include "glazy_mip.h"
+#include <filesystem>
+#include <cstdint>
+
+
+namespace glazy {
+
+	// Offline preparation of textures, so that loading one at runtime is a
+	// matter of reading bytes that GL can take as they are.
+	//
+	// A baked file holds a Header, then one LevelEntry per mip level, largest
+	// level first, then the levels' payloads, each starting on a 16-byte
+	// boundary. All fields are little-endian.
+	namespace bake {
+
+		enum class Format : uint32_t {
+			rgba8    = 0,
+			srgb8_a8 = 1,
+			// Opaque, 8 bytes per 4x4 block
+			bc1      = 2,
+			bc1_srgb = 3,
+			// With alpha, 16 bytes per 4x4 block
+			bc3      = 4,
+			bc3_srgb = 5,
+		};
+
+		struct Header {
+			char     magic[4];
+			uint32_t version;
+			uint32_t format;
+			uint32_t width;
+			uint32_t height;
+			uint32_t level_count;
+		};
+
+		struct LevelEntry {
+			uint64_t offset;
+			uint64_t size;
+			uint32_t width;
+			uint32_t height;
+		};
+
+		GLenum internal_format(Format format);
+		// Bytes per 4x4 block, or zero for uncompressed formats
+		size_t block_size(Format format);
+		bool is_srgb(Format format);
+		// Parses a name such as "bc1_srgb", throwing if it is not a format
+		Format parse_format(std::string const& name);
+
+		// Builds a mip chain from level zero down to 1x1, largest level first.
+		// A box filter over linear values unless 'options' says otherwise.
+		std::vector<std::vector<format::RGBA8>> mip_chain(std::vector<format::RGBA8> level, size_t width, size_t height, mip::Options const& options = {});
+
+		// Block-compresses an image. Edges of images whose sides are not a
+		// multiple of four are filled by repeating the last row or column.
+		std::vector<unsigned char> encode_bc1(std::span<format::RGBA8 const> texels, size_t width, size_t height);
+		std::vector<unsigned char> encode_bc3(std::span<format::RGBA8 const> texels, size_t width, size_t height);
+
+		// Encodes every level of a mip chain, as built by 'mip_chain', and
+		// writes them to a baked file
+		void write(std::filesystem::path const& path, Format kind, std::vector<std::vector<format::RGBA8>> const& levels, size_t width, size_t height);
+
+	}
+
+
+	// A read-only view of a whole file, mapped into memory rather than read,
+	// so that its pages are only loaded as they are touched. Where mmap is not
+	// available, the file is read into memory up front instead.
+	class MappedFile {
+
+		unsigned char const* start;
+		size_t length;
+		// The file's contents when they were read rather than mapped
+		std::vector<unsigned char> contents;
+
+	public:
+
+		MappedFile(std::filesystem::path const& path);
+		MappedFile(MappedFile&& other);
+		MappedFile(MappedFile&) = delete;
+		~MappedFile();
+
+		unsigned char const* data() const;
+		size_t size() const;
+
+	};
+
+
+	// A texture loaded from a baked file. Every level is handed to GL straight
+	// from the mapped file, with no decoding and no mip generation.
+	class BakedTexture : public TextureStorage {
+
+		bake::Format stored_format;
+
+		// Checks that the file is a complete, well-formed baked texture
+		static bake::Header const& validate(MappedFile const& file);
+
+		BakedTexture(MappedFile const& file);
+		BakedTexture(MappedFile const& file, bake::Header const& header);
+
+	public:
+
+		// Throws if the file is malformed, or if its format is not supported
+		// by the current context
+		BakedTexture(std::filesystem::path const& path);
+
+		bake::Format format() const;
+
+	};
+
+}
+
+#endif
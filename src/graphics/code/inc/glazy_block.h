@@ -0,0 +1,313 @@
+
+
+#ifndef GLAZY_BLOCK
+#define GLAZY_BLOCK
+
+#include "glazy_buffer.h"
+#include "glazy_program.h"
+#include <array>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <type_traits>
+
+
+namespace glazy {
+
+	// The std140 layout rules, used to check at compile time that a C++ struct
+	// lays its members out exactly as GLSL lays out the matching uniform block.
+	namespace std140 {
+
+		constexpr size_t round_up(size_t value, size_t alignment) {
+			return ((value + alignment - 1) / alignment) * alignment;
+		}
+
+		// Base alignment and size of a member type. Booleans are four bytes in
+		// GLSL, so they are written as GLint or GLuint.
+		template<typename T> struct Rules;
+
+		template<> struct Rules<GLfloat> { static size_t const align = 4; static size_t const size = 4; };
+		template<> struct Rules<GLint>   { static size_t const align = 4; static size_t const size = 4; };
+		template<> struct Rules<GLuint>  { static size_t const align = 4; static size_t const size = 4; };
+
+		// Two-component vectors align to twice their scalar, and three- and
+		// four-component vectors to four times it
+		template<glm::length_t L, typename S, glm::qualifier Q>
+		struct Rules<glm::vec<L, S, Q>> {
+			static size_t const align = ((L == 2) ? 2 : 4) * Rules<S>::size;
+			static size_t const size = L * Rules<S>::size;
+		};
+
+		// Matrices are stored as arrays of column vectors, and array elements are
+		// padded out to the size of a vec4
+		template<glm::length_t C, glm::length_t R, glm::qualifier Q>
+		struct Rules<glm::mat<C, R, GLfloat, Q>> {
+			static size_t const align = 16;
+			static size_t const size = 16 * C;
+		};
+
+		template<typename T, size_t N>
+		struct Rules<std::array<T, N>> {
+			static size_t const align = round_up(Rules<T>::align, 16);
+			static size_t const size = round_up(Rules<T>::size, 16) * N;
+		};
+
+
+		template<typename M, size_t OFFSET>
+		struct Field {
+			static_assert(
+				sizeof(M) == Rules<M>::size,
+				"Member type has a different size in std140, where matrix columns and "
+				"array elements are padded to a vec4, and bools take four bytes."
+			);
+			static size_t const offset = OFFSET;
+			static size_t const align = Rules<M>::align;
+			static size_t const size = Rules<M>::size;
+		};
+
+
+		template<typename... FIELDS>
+		struct Fields {
+
+			static size_t const count = sizeof...(FIELDS);
+
+			// True if each field, in order, sits exactly where std140 places it
+			static constexpr bool matches() {
+				std::array<size_t, count> offsets = { FIELDS::offset... };
+				std::array<size_t, count> aligns = { FIELDS::align... };
+				std::array<size_t, count> sizes = { FIELDS::size... };
+				size_t end = 0;
+				for (size_t i = 0; i < count; i++) {
+					if (offsets[i] != round_up(end, aligns[i])) {
+						return false;
+					}
+					end = offsets[i] + sizes[i];
+				}
+				return true;
+			}
+
+			// The end of the last field
+			static constexpr size_t size() {
+				size_t result = 0;
+				((result = std::max(result, FIELDS::offset + FIELDS::size)), ...);
+				return result;
+			}
+
+		};
+
+	}
+
+	// Describes a block's members to UniformBlock. Specialize it for each block
+	// struct, deriving from std140::Fields with every member listed in order:
+	//
+	//     template<> struct glazy::BlockLayout<Camera> : glazy::std140::Fields<
+	//         GLAZY_BLOCK_FIELD(Camera, view_transform),
+	//         GLAZY_BLOCK_FIELD(Camera, proj_transform)
+	//     > {};
+	template<typename T>
+	struct BlockLayout;
+
+	#define GLAZY_BLOCK_FIELD(STRUCT, MEMBER) \
+		::glazy::std140::Field<decltype(STRUCT::MEMBER), offsetof(STRUCT, MEMBER)>
+
+
+	// A uniform buffer holding one T, attached to a fixed binding point. Every
+	// program whose block is bound to that point reads the same buffer, so the
+	// data is uploaded once per change rather than once per program.
+	template<typename T>
+	class UniformBlock {
+
+		static_assert(std::is_trivially_copyable<T>::value, "Uniform block structs must be trivially copyable.");
+		static_assert(BlockLayout<T>::matches(), "Uniform block struct does not follow the std140 layout.");
+		static_assert(sizeof(T) >= BlockLayout<T>::size(), "Uniform block layout lists members past the end of the struct.");
+
+		Buffer<T> buffer;
+		GLuint    binding;
+
+	public:
+
+		UniformBlock(GLuint binding, GLenum usage = GL_DYNAMIC_DRAW)
+			: binding(binding)
+		{
+			buffer.allocate(1, usage);
+			bind();
+		}
+
+		UniformBlock(UniformBlock&) = delete;
+
+		void set(T const& value) {
+			buffer.update(0, std::span<T const>(&value, 1));
+		}
+
+		UniformBlock& operator=(T const& value) {
+			set(value);
+			return *this;
+		}
+
+		// Reattaches the buffer to its binding point, in case it was replaced
+		void bind() {
+			StateCache::current().bind_buffer_base(GL_UNIFORM_BUFFER, binding, buffer);
+		}
+
+		// Points the named block of 'program' at this block's binding point
+		void attach(GPUProgram& program, uniform::Name name) {
+			program.bind_block(name, binding, sizeof(T));
+		}
+
+		GLuint binding_point() const {
+			return binding;
+		}
+
+	};
+
+
+	// Per-draw constants, packed one after another into a ring of uniform
+	// buffer space. Changing per-draw state costs one pointer bump and one
+	// glBindBufferRange of the draw's slice, regardless of member count.
+	//
+	// Frames that know their draws ahead of time should 'write' every draw's
+	// constants, 'upload' once, then 'bind' each slot before its draw. Without
+	// persistent mapping, writes go to a CPU staging block that 'upload' sends
+	// in a single glBufferSubData. 'push' writes and binds in one call, which
+	// is just as cheap with persistent mapping, but costs an upload per draw
+	// without it.
+	//
+	// Slices are spaced by GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, and the ring has
+	// a region per frame in flight, as with StreamBuffer.
+	template<typename T>
+	class DrawConstants {
+
+		static_assert(std::is_trivially_copyable<T>::value, "Uniform block structs must be trivially copyable.");
+		static_assert(BlockLayout<T>::matches(), "Uniform block struct does not follow the std140 layout.");
+		static_assert(sizeof(T) >= BlockLayout<T>::size(), "Uniform block layout lists members past the end of the struct.");
+
+	public:
+
+		struct Counters {
+			size_t draws;
+			size_t bytes_written;
+			size_t binds;
+		};
+
+	private:
+
+		size_t stride;
+		GLuint binding;
+		bool persistent;
+		StreamBuffer<unsigned char> ring;
+		// Constants written but not yet uploaded, when not persistent
+		std::vector<unsigned char> staging;
+		size_t staged;
+		// Ring offset of each slot written this frame
+		std::vector<size_t> offsets;
+		Counters frame_counters;
+
+		static size_t slice_stride() {
+			GLint alignment = 0;
+			glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+			return std140::round_up(sizeof(T), std::max<size_t>(alignment, 1));
+		}
+
+	public:
+
+		DrawConstants(GLuint binding, size_t max_draws_per_frame, size_t frame_count = 3)
+			: stride(slice_stride())
+			, binding(binding)
+			, persistent(compat::has_buffer_storage())
+			, ring(stride * max_draws_per_frame, frame_count)
+			, staging(persistent ? 0 : (stride * max_draws_per_frame), 0)
+			, staged(0)
+			, frame_counters{ 0, 0, 0 }
+		{
+			offsets.reserve(max_draws_per_frame);
+		}
+
+		DrawConstants(DrawConstants&) = delete;
+
+		void begin_frame() {
+			ring.begin_frame();
+			staged = 0;
+			offsets.clear();
+			frame_counters = { 0, 0, 0 };
+		}
+
+		// Writes the constants of a draw, returning the slot to bind for it
+		// once uploaded
+		size_t write(T const& value) {
+			safety::entry_guard("DrawConstants::write");
+			if (persistent) {
+				auto slice = ring.allocate(stride);
+				std::memcpy(slice.data, &value, sizeof(T));
+				offsets.push_back(slice.offset());
+			}
+			else {
+				if ((staged + 1) * stride > staging.size()) {
+					throw std::runtime_error("DrawConstants wrote more draws than it has room for in a frame.");
+				}
+				std::memcpy(staging.data() + staged * stride, &value, sizeof(T));
+				staged++;
+				// Placed once uploaded
+				offsets.push_back(0);
+			}
+			frame_counters.bytes_written += sizeof(T);
+			safety::exit_guard("DrawConstants::write");
+			return offsets.size() - 1;
+		}
+
+		// Makes every slot written so far readable by GL. Without persistent
+		// mapping, this is the frame's one upload.
+		void upload() {
+			safety::entry_guard("DrawConstants::upload");
+			if (!persistent && (staged != 0)) {
+				auto block = ring.write(staging.data(), staged * stride);
+				size_t first = offsets.size() - staged;
+				for (size_t slot = 0; slot < staged; slot++) {
+					offsets[first + slot] = block.offset() + slot * stride;
+				}
+				staged = 0;
+			}
+			safety::exit_guard("DrawConstants::upload");
+		}
+
+		// Binds an uploaded slot for the next draw
+		void bind(size_t slot) {
+			safety::entry_guard("DrawConstants::bind");
+			StateCache::current().bind_buffer_range(GL_UNIFORM_BUFFER, binding, ring, offsets[slot], sizeof(T));
+			frame_counters.draws++;
+			frame_counters.binds++;
+			safety::exit_guard("DrawConstants::bind");
+		}
+
+		// Writes the constants for the next draw and binds them
+		void push(T const& value) {
+			safety::entry_guard("DrawConstants::push");
+			size_t slot = write(value);
+			upload();
+			bind(slot);
+			safety::exit_guard("DrawConstants::push");
+		}
+
+		// Should be called after the frame's last draw has been issued
+		void end_frame() {
+			ring.end_frame();
+		}
+
+		// Points the named block of 'program' at this ring's binding point
+		void attach(GPUProgram& program, uniform::Name name) {
+			program.bind_block(name, binding, sizeof(T));
+		}
+
+		// Counts for the current frame so far
+		Counters counters() const {
+			return frame_counters;
+		}
+
+		GLuint binding_point() const {
+			return binding;
+		}
+
+	};
+
+}
+
+#endif
@@ -4,25 +4,147 @@
 #define GLAZY_BUFFER
 
 #include "glazy_common.h"
+#include "glazy_state.h"
+#include <span>
+#include <algorithm>
 
 
 namespace glazy {
 
 	namespace compat {
 
-		// macOS does not support OpenGL 4.5, and so does not have compat::named_buffer_data.
-		// To fix this, we have the janky solution of rapidly swapping the original
-		// GL_ARRAY_BUFFER out, binding our buffer briefly to perform the operation,
-		// and then swapping the original back in. This is less inefficient, but it
-		// is the price that must be paid for ergonomic data movement without
+		// macOS does not support OpenGL 4.5, and so does not have glNamedBufferData.
+		// Where direct state access is available, these forward to the glNamedBuffer*
+		// family. Otherwise, we have the janky solution of rapidly swapping the
+		// original GL_ARRAY_BUFFER out, binding our buffer briefly to perform the
+		// operation, and then swapping the original back in. This is less efficient,
+		// but it is the price that must be paid for ergonomic data movement without
 		// introducing nasty, hard-to-debug side effects.
+		//
+		// The original binding is tracked on the CPU rather than queried from GL,
+		// so GL_ARRAY_BUFFER should only ever be bound through bind_array_buffer.
+
+		GLuint bound_array_buffer();
+		void bind_array_buffer(GLuint id);
+		GLuint create_buffer();
+		void delete_buffer(GLuint id);
 
 		void named_buffer_data(GLuint id, size_t size, void* data, GLenum usage);
+		void named_buffer_sub_data(GLuint id, size_t offset, size_t size, void const* data);
 		void* map_named_buffer(GLuint id, GLenum access);
 		void unmap_named_buffer(GLuint id);
+
+		// Immutable buffer storage requires OpenGL 4.4, which macOS also lacks.
+		// When it is unavailable, the store is allocated once with glBufferData
+		// and never respecified, which is the closest approximation we can get.
+
+		bool has_buffer_storage();
+		void named_buffer_storage(GLuint id, size_t size, void* data, GLbitfield flags);
+		void* map_named_buffer_range(GLuint id, size_t offset, size_t length, GLbitfield access);
+		void flush_named_buffer_range(GLuint id, size_t offset, size_t length);
+		void copy_named_buffer_sub_data(GLuint source, GLuint dest, size_t source_offset, size_t dest_offset, size_t size);
 	}
 
 
+	// A mapping of a contiguous range of a buffer's elements into client memory.
+	// Element access is a plain pointer dereference, with no checks or GL calls,
+	// so views can be handed to standard algorithms or filled by vectorized loops.
+	// The buffer is unmapped when the view goes out of scope.
+	template<typename T>
+	class MappedView {
+
+		GLuint buffer;
+		T*     start;
+		size_t first_index;
+		size_t count;
+
+	public:
+
+		using value_type = T;
+		using iterator = T*;
+		using const_iterator = T const*;
+
+		MappedView(GLuint buffer, T* start, size_t first_index, size_t count)
+			: buffer(buffer)
+			, start(start)
+			, first_index(first_index)
+			, count(count)
+		{}
+
+		MappedView(MappedView&& other)
+			: buffer(other.buffer)
+			, start(other.start)
+			, first_index(other.first_index)
+			, count(other.count)
+		{
+			other.start = nullptr;
+		}
+
+		MappedView& operator=(MappedView&& other) {
+			if (this != &other) {
+				unmap();
+				buffer = other.buffer;
+				start = other.start;
+				first_index = other.first_index;
+				count = other.count;
+				other.start = nullptr;
+			}
+			return *this;
+		}
+
+		MappedView(MappedView const&) = delete;
+		MappedView& operator=(MappedView const&) = delete;
+
+		~MappedView() {
+			unmap();
+		}
+
+		T* data() const { return start; }
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		T* begin() const { return start; }
+		T* end() const { return start + count; }
+		T& operator[](size_t index) const { return start[index]; }
+
+		// Buffer-wide index of the view's first element
+		size_t first() const {
+			return first_index;
+		}
+
+		std::span<T> span() const {
+			return std::span<T>(start, count);
+		}
+
+		operator std::span<T>() const {
+			return span();
+		}
+
+		bool is_mapped() const {
+			return start != nullptr;
+		}
+
+		// Marks view elements [first, first+count) as modified. Only needed if the
+		// range was mapped with GL_MAP_FLUSH_EXPLICIT_BIT.
+		void flush(size_t first, size_t length) {
+			safety::entry_guard("MappedView::flush");
+			if ((start == nullptr) || (first > count) || (length > (count - first))) {
+				throw std::runtime_error("Attempted to flush a range outside of a MappedView.");
+			}
+			compat::flush_named_buffer_range(buffer, sizeof(T) * first, sizeof(T) * length);
+			safety::exit_guard("MappedView::flush");
+		}
+
+		// Unmaps the buffer early. Further element access is invalid.
+		void unmap() {
+			if (start != nullptr) {
+				compat::unmap_named_buffer(buffer);
+				start = nullptr;
+			}
+		}
+
+	};
+
+
 	template<typename T>
 	class SharedBuffer;
 
@@ -35,18 +157,17 @@ namespace glazy {
 		friend class ArrayBindGuard<T>;
 
 		GLuint  id;
-		void* mapping;
+		size_t length;
 
 	public:
 
 
 
 		Buffer()
-			: mapping(nullptr)
+			: length(0)
 		{
 			safety::entry_guard("Buffer::Buffer()");
-			id = 0;
-			glGenBuffers(1, &id);
+			id = compat::create_buffer();
 			if (id == 0) {
 				throw std::runtime_error("Failed to allocate id for buffer.");
 			}
@@ -56,35 +177,58 @@ namespace glazy {
 
 		Buffer(Buffer&& other)
 			: id(other.id)
-			, mapping(other.mapping)
+			, length(other.length)
 		{
 			safety::entry_guard("Buffer::Buffer(Buffer&&)");
 			other.id = 0;
-			other.mapping = nullptr;
+			other.length = 0;
 			safety::exit_guard("Buffer::Buffer(Buffer&&)");
 		}
 
-		~Buffer() {
-			if (glIsBuffer(id)) {
-				glDeleteBuffers(1, &id);
+		Buffer& operator=(Buffer&& other) {
+			if (this != &other) {
+				compat::delete_buffer(id);
+				id = other.id;
+				length = other.length;
+				other.id = 0;
+				other.length = 0;
 			}
+			return *this;
+		}
+
+		~Buffer() {
+			compat::delete_buffer(id);
 		}
 
 		operator GLuint() const {
 			return id;
 		}
 
+		// Number of elements in the buffer's store
+		size_t size() const {
+			return length;
+		}
+
 		void bind(GLenum target) {
 			safety::entry_guard("Buffer::bind");
-			glBindBuffer(target, id);
+			StateCache::current().bind_buffer(target, id);
 			safety::exit_guard("Buffer::bind");
 		}
 
 
 
+		// Respecifies the store to hold 'count' elements, leaving their content undefined
+		void allocate(size_t count, GLenum usage) {
+			safety::entry_guard("Buffer::allocate");
+			compat::named_buffer_data(id, sizeof(T) * count, nullptr, usage);
+			length = count;
+			safety::exit_guard("Buffer::allocate");
+		}
+
 		void set_data(T& data, GLenum usage) {
 			safety::entry_guard("Buffer::set_data");
 			compat::named_buffer_data(id, sizeof(T), &data, usage);
+			length = 1;
 			safety::exit_guard("Buffer::set_data");
 		}
 		void set_data(T&& data, GLenum usage) {
@@ -94,86 +238,103 @@ namespace glazy {
 		void set_data(std::vector<T>& data, GLenum usage) {
 			safety::entry_guard("Buffer::set_data");
 			compat::named_buffer_data(id, sizeof(T) * data.size(), data.data(), usage);
+			length = data.size();
 			safety::exit_guard("Buffer::set_data");
 		}
 		void set_data(std::vector<T>&& data, GLenum usage) {
 			set_data(data, usage);
 		}
 
-		void map(GLenum access) {
-			safety::entry_guard("Buffer::map");
-			void* new_mapping = compat::map_named_buffer(id, access);
-			if (new_mapping != nullptr) {
-				mapping = new_mapping;
+		// Overwrites the elements starting at 'offset' without respecifying the store
+		void update(size_t offset, std::span<T const> data) {
+			safety::entry_guard("Buffer::update");
+			if ((offset > length) || (data.size() > (length - offset))) {
+				throw std::runtime_error("Buffer update of range [" + std::to_string(offset) + ", "
+					+ std::to_string(offset + data.size()) + ") exceeds buffer size of "
+					+ std::to_string(length) + ".");
 			}
-			safety::exit_guard("Buffer::map");
+			if (!data.empty()) {
+				compat::named_buffer_sub_data(id, sizeof(T) * offset, sizeof(T) * data.size(), data.data());
+			}
+			safety::exit_guard("Buffer::update");
 		}
 
-		void unmap() {
+		// Maps the whole buffer, returning a view that unmaps it when destroyed
+		[[nodiscard]] MappedView<T> map(GLenum access) {
 			safety::entry_guard("Buffer::map");
-			compat::unmap_named_buffer(id);
-			mapping = 0;
+			void* mapping = compat::map_named_buffer(id, access);
+			if (mapping == nullptr) {
+				throw std::runtime_error("Failed to map buffer.");
+			}
 			safety::exit_guard("Buffer::map");
+			return MappedView<T>(id, reinterpret_cast<T*>(mapping), 0, length);
 		}
 
-		T& operator[](size_t index) {
-			safety::entry_guard("Buffer::operator[]");
+		// Maps only the elements [first, first+count). Passing GL_MAP_INVALIDATE_RANGE_BIT
+		// avoids reading back the old content, and GL_MAP_FLUSH_EXPLICIT_BIT limits the
+		// upload to the ranges passed to MappedView::flush.
+		[[nodiscard]] MappedView<T> map_range(size_t first, size_t count, GLbitfield flags) {
+			safety::entry_guard("Buffer::map_range");
+			if ((first > length) || (count > (length - first))) {
+				throw std::runtime_error("Buffer mapping of range [" + std::to_string(first) + ", "
+					+ std::to_string(first + count) + ") exceeds buffer size of "
+					+ std::to_string(length) + ".");
+			}
+			void* mapping = compat::map_named_buffer_range(id, sizeof(T) * first, sizeof(T) * count, flags);
 			if (mapping == nullptr) {
-				throw std::runtime_error("Attempted to index Buffer without an active mapping.");
+				throw std::runtime_error("Failed to map buffer range.");
 			}
-			safety::exit_guard("Buffer::operator[]");
-			return (reinterpret_cast<T*>(mapping))[index];
+			safety::exit_guard("Buffer::map_range");
+			return MappedView<T>(id, reinterpret_cast<T*>(mapping), first, count);
 		}
 
 
 	};
 
+	// Binds a buffer to GL_ARRAY_BUFFER for the guard's lifetime. A guard nested
+	// inside another restores the enclosing guard's binding when it ends. The
+	// outermost guard leaves its buffer bound, since unbinding it would only
+	// cost a call that the next bind makes redundant.
 	template<typename T>
 	class ArrayBindGuard {
 
-		static std::stack<GLuint> bind_stack;
+		GLuint previous;
+		bool   nested;
 
-		Buffer<T>& buffer;
-
-	public:
-		ArrayBindGuard(Buffer<T>& buffer)
-			: buffer(buffer)
-		{
+		void bind(GLuint id) {
 			safety::entry_guard("Buffer::BindGuard::BindGuard");
-			if (bind_stack.empty() || (bind_stack.top() != buffer.id)) {
-				glBindBuffer(GL_ARRAY_BUFFER, buffer.id);
-			}
-			bind_stack.push(buffer.id);
+			StateCache& cache = StateCache::current();
+			previous = cache.bound_buffer(GL_ARRAY_BUFFER);
+			nested = (cache.guard_depth.array_buffer++ > 0);
+			cache.bind_buffer(GL_ARRAY_BUFFER, id);
 			safety::exit_guard("Buffer::BindGuard::BindGuard");
 		}
 
-		ArrayBindGuard(SharedBuffer<T>& sbuf)
-			: buffer(sbuf)
-		{
-			safety::entry_guard("Buffer::BindGuard::BindGuard");
-			if (bind_stack.empty() || (bind_stack.top() != buffer.id)) {
-				glBindBuffer(GL_ARRAY_BUFFER, buffer.id);
-			}
-			bind_stack.push(buffer.id);
-			safety::exit_guard("Buffer::BindGuard::BindGuard");
+	public:
+		ArrayBindGuard(Buffer<T>& buffer) {
+			bind(buffer.id);
+		}
+
+		ArrayBindGuard(SharedBuffer<T>& sbuf) {
+			bind(static_cast<Buffer<T>&>(sbuf).id);
 		}
 
+		ArrayBindGuard(ArrayBindGuard&) = delete;
+
 		~ArrayBindGuard() {
-			if (bind_stack.empty()) {
+			StateCache& cache = StateCache::current();
+			if (cache.guard_depth.array_buffer == 0) {
 				std::cerr << "ERROR: BindGuard has run more destructors than constructors! "
 					"Do not manually invoke the destructor of a BindGuard!\n";
 				return;
 			}
-			bind_stack.pop();
-			if ((!bind_stack.empty()) && (bind_stack.top() != buffer.id)) {
-				glBindBuffer(GL_ARRAY_BUFFER, bind_stack.top());
+			cache.guard_depth.array_buffer--;
+			if (nested) {
+				cache.bind_buffer(GL_ARRAY_BUFFER, previous);
 			}
 		}
 	};
 
-	template<typename T>
-	std::stack<GLuint> ArrayBindGuard<T>::bind_stack;
-
 
 	template <typename T>
 	class SharedBuffer {
@@ -215,16 +376,396 @@ namespace glazy {
 			buffer->set_data(data, usage);
 		}
 
-		void map(GLenum access) {
-			buffer->map(access);
+		size_t size() const {
+			return buffer->size();
 		}
 
-		void unmap() {
-			buffer->unmap();
+		void update(size_t offset, std::span<T const> data) {
+			buffer->update(offset, data);
+		}
+
+		[[nodiscard]] MappedView<T> map(GLenum access) {
+			return buffer->map(access);
+		}
+
+		[[nodiscard]] MappedView<T> map_range(size_t first, size_t count, GLbitfield flags) {
+			return buffer->map_range(first, count, flags);
+		}
+
+	};
+
+
+	// A buffer of vertex indices for indexed draws. Indices are given as 32-bit
+	// values, but are stored as 16-bit values whenever they all fit, halving the
+	// size of the buffer.
+	class IndexBuffer {
+
+		GLuint id;
+		GLenum index_type;
+		size_t length;
+
+	public:
+
+		IndexBuffer();
+		IndexBuffer(IndexBuffer&& other);
+		IndexBuffer(IndexBuffer&) = delete;
+		~IndexBuffer();
+
+		operator GLuint() const;
+
+		void set_data(std::vector<GLuint> const& indices, GLenum usage);
+
+		// Number of indices in the buffer
+		size_t size() const;
+		// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+		GLenum type() const;
+		// Size of a single index, in bytes
+		size_t index_size() const;
+
+	};
+
+
+	// A buffer paired with a CPU-side copy of its content. Writes go to the
+	// copy and record which elements were touched. On flush, the touched
+	// ranges are sorted and coalesced, and only those ranges are uploaded,
+	// using as few glBufferSubData calls as possible. Ranges separated by no
+	// more than 'coalesce_gap' untouched elements are merged, trading a little
+	// bandwidth for fewer calls.
+	template <typename T>
+	class ShadowedBuffer {
+
+		struct Range {
+			size_t first;
+			size_t count;
+		};
+
+		Buffer<T> buffer;
+		std::vector<T> shadow;
+		std::vector<Range> dirty;
+		size_t coalesce_gap;
+
+	public:
+
+		ShadowedBuffer(std::vector<T> data, GLenum usage, size_t coalesce_gap = 0)
+			: shadow(std::move(data))
+			, coalesce_gap(coalesce_gap)
+		{
+			buffer.set_data(shadow, usage);
+		}
+
+		operator GLuint() const {
+			return buffer;
+		}
+
+		operator Buffer<T>& () {
+			return buffer;
+		}
+
+		size_t size() const {
+			return shadow.size();
+		}
+
+		T const& operator[](size_t index) const {
+			return shadow[index];
+		}
+
+		void write(size_t index, T const& value) {
+			shadow[index] = value;
+			mark_dirty(index, 1);
+		}
+
+		// Returns a pointer to elements [first, first+count) of the copy,
+		// which are assumed to be modified.
+		T* edit(size_t first, size_t count) {
+			if ((first > shadow.size()) || (count > (shadow.size() - first))) {
+				throw std::runtime_error("ShadowedBuffer edit of range [" + std::to_string(first) + ", "
+					+ std::to_string(first + count) + ") exceeds buffer size of "
+					+ std::to_string(shadow.size()) + ".");
+			}
+			mark_dirty(first, count);
+			return shadow.data() + first;
+		}
+
+		void mark_dirty(size_t first, size_t count) {
+			if (count == 0) {
+				return;
+			}
+			// Consecutive writes are very common, so extend the last range in place
+			if (!dirty.empty()) {
+				Range& last = dirty.back();
+				if ((first >= last.first) && (first <= (last.first + last.count))) {
+					last.count = std::max(last.count, first + count - last.first);
+					return;
+				}
+			}
+			dirty.push_back({ first, count });
+		}
+
+		// Number of elements that would be uploaded if flushed now
+		size_t dirty_count() const {
+			size_t result = 0;
+			for (Range const& range : dirty) {
+				result += range.count;
+			}
+			return result;
+		}
+
+		// Uploads the touched ranges, returning how many upload calls were made
+		size_t flush() {
+			safety::entry_guard("ShadowedBuffer::flush");
+			if (dirty.empty()) {
+				return 0;
+			}
+			std::sort(dirty.begin(), dirty.end(), [](Range const& a, Range const& b) {
+				return a.first < b.first;
+			});
+			size_t uploads = 0;
+			Range current = dirty.front();
+			for (size_t i = 1; i <= dirty.size(); i++) {
+				if (i < dirty.size()) {
+					Range const& next = dirty[i];
+					if (next.first <= (current.first + current.count + coalesce_gap)) {
+						current.count = std::max(current.count, next.first + next.count - current.first);
+						continue;
+					}
+				}
+				buffer.update(current.first, std::span<T const>(shadow.data() + current.first, current.count));
+				uploads++;
+				if (i < dirty.size()) {
+					current = dirty[i];
+				}
+			}
+			dirty.clear();
+			safety::exit_guard("ShadowedBuffer::flush");
+			return uploads;
+		}
+
+	};
+
+
+	// A buffer for geometry that is rewritten every frame. A single store is
+	// allocated up front and split into 'frame_count' regions, which are used
+	// round-robin. Each frame hands out sub-allocations from its region that
+	// may be written to directly, and a fence placed at the end of the frame
+	// ensures a region is only reused once the GPU is done reading it.
+	//
+	// Where immutable storage is available, the whole store is mapped once
+	// with persistent, coherent mapping. Otherwise, the region is mapped on
+	// demand with unsynchronized writes (the fences already provide the
+	// synchronization), and 'commit' must be called before drawing with it.
+	template <typename T>
+	class StreamBuffer {
+
+		GLuint id;
+		size_t frame_capacity;
+		size_t frame_count;
+		size_t frame;
+		size_t cursor;
+		size_t map_start;
+		bool   persistent;
+		T*     mapping;
+		std::vector<GLsync> fences;
+
+		size_t frame_base() const {
+			return frame * frame_capacity;
+		}
+
+		void wait_for_frame() {
+			GLsync& fence = fences[frame];
+			if (fence == nullptr) {
+				return;
+			}
+			GLbitfield wait_flags = 0;
+			while (true) {
+				GLenum status = glClientWaitSync(fence, wait_flags, 1000000);
+				if ((status == GL_ALREADY_SIGNALED) || (status == GL_CONDITION_SATISFIED)) {
+					break;
+				}
+				else if (status == GL_WAIT_FAILED) {
+					throw std::runtime_error("Failed to wait on StreamBuffer fence.");
+				}
+				wait_flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+			}
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+
+		void map_remaining() {
+			size_t length = (frame_capacity - cursor) * sizeof(T);
+			GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+				| GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT;
+			void* region = compat::map_named_buffer_range(id, (frame_base() + cursor) * sizeof(T), length, access);
+			if (region == nullptr) {
+				throw std::runtime_error("Failed to map StreamBuffer region.");
+			}
+			mapping = reinterpret_cast<T*>(region);
+			map_start = cursor;
+		}
+
+	public:
+
+		struct Allocation {
+			// Where the elements should be written
+			T*     data;
+			// Index of the first element, relative to the start of the buffer
+			size_t first;
+			size_t count;
+
+			size_t offset() const {
+				return first * sizeof(T);
+			}
+		};
+
+		StreamBuffer(size_t frame_capacity, size_t frame_count = 3)
+			: id(0)
+			, frame_capacity(frame_capacity)
+			, frame_count(frame_count)
+			, frame(0)
+			, cursor(0)
+			, map_start(0)
+			, persistent(compat::has_buffer_storage())
+			, mapping(nullptr)
+			, fences(frame_count, nullptr)
+		{
+			safety::entry_guard("StreamBuffer::StreamBuffer()");
+			if ((frame_capacity == 0) || (frame_count == 0)) {
+				throw std::runtime_error("StreamBuffer must have a non-zero frame capacity and frame count.");
+			}
+			id = compat::create_buffer();
+			if (id == 0) {
+				throw std::runtime_error("Failed to allocate id for buffer.");
+			}
+			size_t size = frame_capacity * frame_count * sizeof(T);
+			if (persistent) {
+				GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+				compat::named_buffer_storage(id, size, nullptr, flags);
+				void* store = compat::map_named_buffer_range(id, 0, size, flags);
+				if (store == nullptr) {
+					throw std::runtime_error("Failed to persistently map StreamBuffer.");
+				}
+				mapping = reinterpret_cast<T*>(store);
+			}
+			else {
+				compat::named_buffer_data(id, size, nullptr, GL_STREAM_DRAW);
+			}
+			safety::exit_guard("StreamBuffer::StreamBuffer()");
+		}
+
+		StreamBuffer(StreamBuffer&& other)
+			: id(other.id)
+			, frame_capacity(other.frame_capacity)
+			, frame_count(other.frame_count)
+			, frame(other.frame)
+			, cursor(other.cursor)
+			, map_start(other.map_start)
+			, persistent(other.persistent)
+			, mapping(other.mapping)
+			, fences(std::move(other.fences))
+		{
+			other.id = 0;
+			other.mapping = nullptr;
+		}
+
+		StreamBuffer(StreamBuffer&) = delete;
+
+		~StreamBuffer() {
+			for (GLsync fence : fences) {
+				if (fence != nullptr) {
+					glDeleteSync(fence);
+				}
+			}
+			// Deleting a buffer implicitly unmaps it
+			compat::delete_buffer(id);
+		}
+
+		operator GLuint() const {
+			return id;
+		}
+
+		// Number of elements that may be allocated in a single frame
+		size_t capacity() const {
+			return frame_capacity;
+		}
+
+		// Number of elements allocated so far this frame
+		size_t size() const {
+			return cursor;
+		}
+
+		// Moves to the next region of the ring, waiting on its fence only if
+		// the GPU is still reading from it, 'frame_count' frames later.
+		void begin_frame() {
+			safety::entry_guard("StreamBuffer::begin_frame");
+			wait_for_frame();
+			cursor = 0;
+			safety::exit_guard("StreamBuffer::begin_frame");
+		}
+
+		Allocation allocate(size_t count) {
+			safety::entry_guard("StreamBuffer::allocate");
+			if (count > (frame_capacity - cursor)) {
+				throw std::runtime_error("StreamBuffer allocation of " + std::to_string(count)
+					+ " elements exceeds the remaining frame capacity of "
+					+ std::to_string(frame_capacity - cursor) + ".");
+			}
+			if (!persistent && (mapping == nullptr)) {
+				map_remaining();
+			}
+			T* data = persistent ? (mapping + frame_base() + cursor) : (mapping + (cursor - map_start));
+			Allocation result = { data, frame_base() + cursor, count };
+			cursor += count;
+			safety::exit_guard("StreamBuffer::allocate");
+			return result;
+		}
+
+		// Allocates 'count' elements and fills them from 'data'. Without
+		// persistent mapping this is a single buffer upload, with no mapping,
+		// and the allocation's 'data' is null.
+		Allocation write(T const* data, size_t count) {
+			safety::entry_guard("StreamBuffer::write");
+			if (count > (frame_capacity - cursor)) {
+				throw std::runtime_error("StreamBuffer write of " + std::to_string(count)
+					+ " elements exceeds the remaining frame capacity of "
+					+ std::to_string(frame_capacity - cursor) + ".");
+			}
+			Allocation result = { nullptr, frame_base() + cursor, count };
+			if (persistent) {
+				result.data = mapping + frame_base() + cursor;
+				std::copy(data, data + count, result.data);
+			}
+			else {
+				// Earlier allocations may still be mapped
+				commit();
+				compat::named_buffer_sub_data(id, result.offset(), count * sizeof(T), data);
+			}
+			cursor += count;
+			safety::exit_guard("StreamBuffer::write");
+			return result;
+		}
+
+		// Makes all writes to allocations handed out so far visible to GL.
+		// With coherent persistent mapping, this is a no-op.
+		void commit() {
+			safety::entry_guard("StreamBuffer::commit");
+			if (!persistent && (mapping != nullptr)) {
+				size_t length = (cursor - map_start) * sizeof(T);
+				if (length != 0) {
+					compat::flush_named_buffer_range(id, 0, length);
+				}
+				compat::unmap_named_buffer(id);
+				mapping = nullptr;
+			}
+			safety::exit_guard("StreamBuffer::commit");
 		}
 
-		T& operator[](size_t index) {
-			return (*buffer)[index];
+		// Should be called after the last draw that reads from this frame's
+		// region has been issued.
+		void end_frame() {
+			safety::entry_guard("StreamBuffer::end_frame");
+			commit();
+			fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			frame = (frame + 1) % frame_count;
+			safety::exit_guard("StreamBuffer::end_frame");
 		}
 
 	};
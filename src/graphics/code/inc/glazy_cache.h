@@ -0,0 +1,76 @@
+
+
+#ifndef GLAZY_CACHE
+#define GLAZY_CACHE
+
+#include "glazy_program.h"
+#include <filesystem>
+
+
+namespace glazy {
+
+	// The source of each stage of a program. Only the vertex and fragment
+	// stages are required.
+	struct ProgramSources {
+		std::string vertex;
+		std::string tess_control;
+		std::string tess_evaluation;
+		std::string geometry;
+		std::string fragment;
+
+		static ProgramSources from_files(std::string vertex_path, std::string fragment_path);
+
+		// Compiles and links the stages that have source
+		GPUProgram build(bool retrievable = false) const;
+	};
+
+
+	// Keeps linked program binaries on disk, so that later launches can skip
+	// compiling and linking. Entries are keyed by a hash of the program's
+	// sources together with the driver's vendor, renderer and version strings,
+	// since a binary is only good for the driver that produced it. A binary the
+	// driver rejects anyway is replaced by compiling from source.
+	class ProgramCache {
+
+	public:
+
+		struct Stats {
+			size_t hits;
+			size_t misses;
+			// Hits whose binary the driver refused to load
+			size_t rejected;
+			double seconds_loading;
+			double seconds_compiling;
+			// What the hits would have cost to compile, according to the
+			// compile times recorded with their binaries, less what they cost
+			// to load
+			double seconds_saved;
+		};
+
+	private:
+
+		std::filesystem::path directory;
+		std::string driver;
+		// The binary formats the driver accepts, asked for once
+		std::vector<GLenum> formats;
+		bool supported;
+		Stats totals;
+
+		std::filesystem::path entry_path(ProgramSources const& sources) const;
+		void store(std::filesystem::path const& path, GLuint program, double compile_seconds);
+
+	public:
+
+		// Must be constructed with a context current, as the driver's identity
+		// is part of every key
+		ProgramCache(std::filesystem::path directory);
+
+		GPUProgram load(ProgramSources const& sources);
+
+		Stats const& stats() const;
+
+	};
+
+}
+
+#endif
@@ -11,8 +11,44 @@
 #include <stack>
 #include <fstream>
 #include <string>
+#include <source_location>
 
 
+// How much error checking the safety guards do, chosen at compile time:
+//   GLAZY_GUARD_OFF     - guards compile to nothing
+//   GLAZY_GUARD_SAMPLED - guards check one call in every GLAZY_GUARD_SAMPLE_RATE
+//   GLAZY_GUARD_FULL    - guards check every call
+// The policy must be the same for every translation unit in a program.
+#define GLAZY_GUARD_OFF     0
+#define GLAZY_GUARD_SAMPLED 1
+#define GLAZY_GUARD_FULL    2
+
+#ifndef GLAZY_GUARD_POLICY
+#define GLAZY_GUARD_POLICY GLAZY_GUARD_FULL
+#endif
+
+#ifndef GLAZY_GUARD_SAMPLE_RATE
+#define GLAZY_GUARD_SAMPLE_RATE 64
+#endif
+
+// KHR_parallel_shader_compile, which the generated loader does not cover. The
+// ARB version of the extension uses the same values.
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR           0x91B1
+#endif
+
+// EXT_texture_compression_s3tc and EXT_texture_sRGB, which the generated
+// loader does not cover either
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT        0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT       0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT       0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
 
 namespace glazy {
 
@@ -61,13 +97,86 @@ namespace glazy {
 			static glm::length_t const value = L;
 		};
 
+		// Whether attributes of this type are integers, rather than floats.
+		// Throws for types that cannot be used as attributes.
+		bool is_integral(GLenum type);
+
+		// Matrices are handled one column at a time
+		template<typename T, glm::length_t C, glm::length_t R, glm::qualifier Q>
+		struct vec_length<glm::mat<C, R, T, Q>> {
+			static glm::length_t const value = R;
+		};
+
+		template<typename T>
+		struct column_count {
+			static glm::length_t const value = 1;
+		};
+
+		template<typename T, glm::length_t C, glm::length_t R, glm::qualifier Q>
+		struct column_count<glm::mat<C, R, T, Q>> {
+			static glm::length_t const value = C;
+		};
+
+		// The class and member types of a pointer-to-member
+		template<typename T>
+		struct member_traits;
+
+		template<typename C, typename M>
+		struct member_traits<M C::*> {
+			using class_type = C;
+			using member_type = M;
+		};
+
 	}
 
 
 	namespace safety {
 		void auto_throw(std::string context);
-		void entry_guard(std::string fn_name);
-		void exit_guard(std::string fn_name);
+
+		// Switches the calling thread's context between polling glGetError and
+		// receiving errors through a KHR_debug callback. With the callback, the
+		// guards only look at a recorded message, so checks no longer stall the
+		// pipeline. Returns false if the context lacks KHR_debug. Contexts made
+		// with the GLFW_OPENGL_DEBUG_CONTEXT hint report errors most reliably.
+		bool use_debug_output(bool enabled);
+		bool using_debug_output();
+
+		namespace detail {
+			// Throws if an error has been recorded, naming the guarded function
+			// and where the guard was called from
+			void check(bool entry, char const* fn_name, std::source_location where);
+
+			// Entry and exit guards come in pairs, so each kind keeps its own
+			// count, or one kind would never be sampled
+			template<bool ENTRY>
+			inline bool sample() {
+				#if GLAZY_GUARD_POLICY == GLAZY_GUARD_SAMPLED
+				static thread_local unsigned int count = 0;
+				return (++count % GLAZY_GUARD_SAMPLE_RATE) == 0;
+				#else
+				return true;
+				#endif
+			}
+		}
+
+		// Checks for errors left by code that ran before the named function.
+		// With guards compiled out, the arguments go unused.
+		inline void entry_guard([[maybe_unused]] char const* fn_name, [[maybe_unused]] std::source_location where = std::source_location::current()) {
+			#if GLAZY_GUARD_POLICY != GLAZY_GUARD_OFF
+			if (flags::debug && detail::sample<true>()) {
+				detail::check(true, fn_name, where);
+			}
+			#endif
+		}
+
+		// Checks for errors caused by the named function
+		inline void exit_guard([[maybe_unused]] char const* fn_name, [[maybe_unused]] std::source_location where = std::source_location::current()) {
+			#if GLAZY_GUARD_POLICY != GLAZY_GUARD_OFF
+			if (flags::debug && detail::sample<false>()) {
+				detail::check(false, fn_name, where);
+			}
+			#endif
+		}
 	}
 
 	namespace context {
@@ -75,8 +184,38 @@ namespace glazy {
 			int hint;
 			int value;
 		};
+
+		// Optional features of the current context, filled in by 'setup'.
+		// Fields may be cleared afterward to force the fallback paths.
+		struct Capabilities {
+			// glNamedBuffer*, glVertexArray* and glTexture* (GL 4.5 or ARB_direct_state_access)
+			bool direct_state_access;
+			// glBufferStorage and persistent mapping (GL 4.4)
+			bool buffer_storage;
+			// glTexStorage2D and glTexStorage3D (GL 4.2 or ARB_texture_storage)
+			bool texture_storage;
+			// BC1 and BC3 block compression (EXT_texture_compression_s3tc), and
+			// their sRGB variants (EXT_texture_sRGB)
+			bool s3tc;
+			bool s3tc_srgb;
+			// GL_COMPLETION_STATUS_KHR queries and compiler threads
+			// (KHR_parallel_shader_compile or ARB_parallel_shader_compile)
+			bool parallel_shader_compile;
+		};
+
+		Capabilities& capabilities();
+		void detect_capabilities();
+
+		// Sets how many threads the driver may use to compile shaders, with
+		// 0xFFFFFFFF leaving it to the driver. Does nothing without
+		// parallel_shader_compile.
+		void set_compiler_threads(GLuint count);
+
 		void error_callback(int error_code, char const* desc);
 		GLFWwindow* setup(glm::ivec2 position, glm::ivec2 dimensions, const char* title, std::vector<WindowHint> hints);
+		// Creates a hidden window whose context shares objects with that of
+		// 'share'. Must be called on the main thread, after 'setup'.
+		GLFWwindow* setup_shared(GLFWwindow* share);
 	}
 
 }
@@ -0,0 +1,71 @@
+
+
+#ifndef GLAZY_MIP
+#define GLAZY_MIP
+
+#include "glazy_texture.h"
+
+
+namespace glazy {
+
+	// Builds mip chains on the CPU, where the filter can be chosen, rather than
+	// leaving it to glGenerateMipmap. Each level is filtered from the one above
+	// it, in bands of rows spread over a pool of threads, and the filter loops
+	// use the widest vector instructions the CPU has.
+	namespace mip {
+
+		enum class Filter {
+			// Averages each 2x2 block. Fastest, but the softest and most
+			// prone to aliasing.
+			box,
+			// Sinc with a Kaiser window, over 8 taps. Sharper than box, with
+			// less ringing than Lanczos.
+			kaiser,
+			// Lanczos-3, over 12 taps. The sharpest, with slight ringing at
+			// hard edges.
+			lanczos,
+		};
+
+		// Which instructions the filter loops use. Every path gives the same
+		// results, bit for bit.
+		enum class Path {
+			scalar,
+			sse2,
+			avx2,
+			// The widest path the CPU supports
+			best,
+		};
+
+		struct Options {
+			Filter filter   = Filter::box;
+			// Whether the colour channels are sRGB-encoded, in which case they
+			// are filtered in linear light and re-encoded afterward. Alpha is
+			// always treated as linear.
+			bool   srgb     = false;
+			// If not negative, the alpha of each level is scaled so that the
+			// fraction of texels with alpha above this threshold matches level
+			// zero, which keeps alpha-tested cutouts from thinning out with
+			// distance
+			float  alpha_coverage = -1.0f;
+			Path   path     = Path::best;
+			// Zero uses as many threads as the hardware has. Callers that build
+			// several chains at once should pass one, rather than multiply the
+			// pools.
+			size_t threads  = 0;
+		};
+
+		// The path 'best' stands for on this CPU
+		Path best_path();
+
+		// Filters an image down to half its width and height, rounding down,
+		// but never below one texel
+		std::vector<format::RGBA8> downsample(std::span<format::RGBA8 const> texels, size_t width, size_t height, Options const& options = {});
+
+		// Builds every level from level zero down to 1x1, largest first
+		std::vector<std::vector<format::RGBA8>> chain(std::vector<format::RGBA8> level, size_t width, size_t height, Options const& options = {});
+
+	}
+
+}
+
+#endif
@@ -0,0 +1,142 @@
+
+
+#ifndef GLAZY_OBJECTS
+#define GLAZY_OBJECTS
+
+#include "glazy_state.h"
+#include <deque>
+
+
+namespace glazy {
+
+	// Names of one kind of GL object, generated in batches so that creating an
+	// object rarely costs a glGen* or glCreate* call of its own. With direct
+	// state access the names already refer to objects; otherwise, as with
+	// glGen*, the objects come into being when first bound.
+	class NamePool {
+
+	public:
+
+		enum class Kind {
+			buffer,
+			vertex_array,
+			// Textures are created for a target, so only 2D textures are pooled
+			texture_2d,
+			sampler,
+		};
+
+	private:
+
+		Kind kind;
+		size_t batch;
+		std::vector<GLuint> spare;
+
+		void refill();
+
+	public:
+
+		NamePool(Kind kind, size_t batch = 32);
+		NamePool(NamePool&) = delete;
+
+		GLuint acquire();
+
+		// Deletes the names not yet handed out. Must be called with the pool's
+		// context current; the destructor does not, as no context may be.
+		void release();
+
+	};
+
+
+	// GL objects whose owners are gone, deleted in batches at the end of a frame
+	// once the GPU has finished the commands that could still use them. This
+	// keeps deletions, and any synchronization the driver does for them, out of
+	// the middle of a frame.
+	//
+	// A context's deletions are only deferred once it has called 'end_frame'.
+	// Before that, objects are deleted right away, so programs that never call
+	// it do not leak.
+	class DeletionQueue {
+
+	public:
+
+		enum class Kind {
+			buffer,
+			vertex_array,
+			texture,
+			sampler,
+			program,
+			pipeline,
+		};
+
+		struct Counters {
+			size_t deferred;
+			size_t deleted;
+			size_t batches;
+		};
+
+	private:
+
+		static size_t const kind_count = 6;
+
+		struct Batch {
+			GLsync fence;
+			std::vector<GLuint> names[kind_count];
+		};
+
+		bool deferring;
+		// Names deferred since the last end of frame
+		Batch pending;
+		// Batches waiting on their fence, oldest first
+		std::deque<Batch> fenced;
+		Counters totals;
+
+		// Deletes the names of a batch, in one call per kind where GL allows
+		void destroy(Batch& batch);
+
+	public:
+
+		DeletionQueue();
+		DeletionQueue(DeletionQueue&) = delete;
+
+		void defer(Kind kind, GLuint id);
+
+		// Fences the names deferred this frame, then deletes every batch whose
+		// fence has signalled. Never waits on the GPU.
+		void end_frame();
+
+		// Deletes everything queued, waiting for the GPU where needed
+		void flush();
+
+		// Batches not yet deleted, including this frame's
+		size_t backlog() const;
+
+		Counters counters() const;
+
+	};
+
+
+	// The name pools and deletion queue of one context
+	class ContextObjects {
+
+	public:
+
+		NamePool buffers;
+		NamePool vertex_arrays;
+		NamePool textures;
+		NamePool samplers;
+		DeletionQueue deletions;
+
+		ContextObjects();
+		ContextObjects(ContextObjects&) = delete;
+
+		// The objects of the context that is current on the calling thread
+		static ContextObjects& current();
+		// Flushes the deletions and spare names of the current context, which
+		// must be 'window''s, then discards its record
+		static void release(GLFWwindow* window);
+
+	};
+
+}
+
+#endif
@@ -0,0 +1,82 @@
+
+
+#ifndef GLAZY_PIPELINE
+#define GLAZY_PIPELINE
+
+#include "glazy_preprocess.h"
+#include <unordered_map>
+
+
+namespace glazy {
+
+	// A program pipeline object, which draws with the stages of several
+	// separable programs (see GPUProgram::separable) rather than one linked
+	// program. Stages are matched by name or by location, as between the
+	// stages of a linked program, but the match is only checked by 'validate'.
+	//
+	// Uniforms belong to the stage programs, so they are set through the
+	// programs' handles. Attribute indices come from the vertex stage.
+	class ProgramPipeline {
+
+		GLuint id;
+		// The program used for each stage, in the order of 'stage_bits'
+		GPUProgram* stages[5];
+
+		static size_t stage_index(GLenum kind);
+
+	public:
+
+		ProgramPipeline();
+		ProgramPipeline(ProgramPipeline&) = delete;
+		ProgramPipeline(ProgramPipeline&& other);
+		~ProgramPipeline();
+
+		// Uses 'program' for the stage 'kind', such as GL_VERTEX_SHADER. The
+		// program must be separable and must outlive the pipeline.
+		void use_stage(GLenum kind, GPUProgram& program);
+		// The program used for a stage, or nullptr
+		GPUProgram* stage(GLenum kind) const;
+
+		// Throws with the driver's log if the stages cannot be used together
+		void validate();
+
+		// Binds the pipeline, which also stops using any current program
+		void bind();
+
+		operator GLuint() const;
+
+	};
+
+
+	// Separable stage programs, each compiled once, and the pipelines composed
+	// from them on demand. With N vertex shaders and M fragment shaders, this
+	// links N + M programs rather than N * M.
+	class PipelineCache {
+
+		ShaderPreprocessor const* preprocessor;
+		// Keyed by kind and path, separated by a newline
+		std::unordered_map<std::string, GPUProgram> stages;
+		// Keyed by the paths of every stage, separated by newlines
+		std::unordered_map<std::string, ProgramPipeline> pipelines;
+
+	public:
+
+		// Sources are run through 'preprocessor' if one is given
+		PipelineCache(ShaderPreprocessor const* preprocessor = nullptr);
+		PipelineCache(PipelineCache&) = delete;
+
+		// The separable program for one stage, compiling it on first use
+		GPUProgram& stage(GLenum kind, std::string const& path);
+
+		// The pipeline for a set of stage files, composing it on first use
+		ProgramPipeline& pipeline(ProgramFiles const& files);
+		ProgramPipeline& pipeline(std::string const& vertex_path, std::string const& fragment_path);
+
+		size_t stage_count() const;
+		size_t pipeline_count() const;
+
+	};
+
+}
+
+#endif
@@ -0,0 +1,108 @@
+
+
+#ifndef GLAZY_PREPROCESS
+#define GLAZY_PREPROCESS
+
+#include "glazy_reload.h"
+#include <filesystem>
+#include <unordered_map>
+
+
+namespace glazy {
+
+	// Expands #include directives in GLSL source and injects #defines, so that
+	// shaders can share code and be specialized at compile time.
+	//
+	// Included files are searched for next to the file including them, then in
+	// each include path in order. A file containing '#pragma once' is included
+	// at most once; ordinary #ifndef guards also work, as GLSL has its own
+	// preprocessor. Includes are expanded whether or not they sit inside an
+	// #if block, since that is only evaluated later, by the driver.
+	//
+	// '#line' directives are emitted around each included file, so that the
+	// driver's error logs give the file's line numbers. The source string
+	// number in those logs is an index into the output's 'files'.
+	class ShaderPreprocessor {
+
+		std::vector<std::filesystem::path> include_paths;
+
+		struct State;
+		std::filesystem::path resolve(std::string const& name, std::filesystem::path const& from) const;
+		void expand(std::filesystem::path const& path, State& state, bool root) const;
+
+	public:
+
+		struct Output {
+			std::string text;
+			// Every file read, by canonical path, with the root file first
+			std::vector<std::string> files;
+		};
+
+		ShaderPreprocessor(std::vector<std::string> include_paths = {});
+
+		// Each define is either a name, or a name and a value separated by a
+		// space. They are placed just after the root file's #version line.
+		Output process(std::string const& path, std::vector<std::string> const& defines = {}) const;
+
+	};
+
+
+	// The specializations of one program over a set of features, each built the
+	// first time it is asked for. Bit i of a key turns on features[i], which is
+	// passed to the shaders as a define, so each variant is compiled with only
+	// the code its features need rather than branching on uniforms.
+	//
+	// Variants are built through a ProgramCache and watched by a ShaderWatcher,
+	// if given. Both must outlive the variants.
+	class ProgramVariants {
+
+	public:
+
+		typedef uint32_t Key;
+		// Run on each variant once it is built, such as to attach uniform blocks
+		typedef std::function<void(GPUProgram&)> Setup;
+
+	private:
+
+		ShaderPreprocessor const& preprocessor;
+		ProgramFiles files;
+		std::vector<std::string> features;
+		Setup setup;
+		ProgramCache* cache;
+		ShaderWatcher* watcher;
+		// Node-based, so that variants stay put for the watcher
+		std::unordered_map<Key, GPUProgram> variants;
+
+		GPUProgram build(Key key, std::vector<std::string>& dependencies) const;
+
+	public:
+
+		ProgramVariants(
+			ShaderPreprocessor const& preprocessor,
+			ProgramFiles files,
+			std::vector<std::string> features,
+			Setup setup = {},
+			ProgramCache* cache = nullptr,
+			ShaderWatcher* watcher = nullptr
+		);
+		ProgramVariants(ProgramVariants&) = delete;
+		~ProgramVariants();
+
+		// The key with the named features turned on. Throws on unknown names.
+		Key key(std::vector<std::string> const& names) const;
+
+		// The sources of a variant, with the files they were read from
+		// appended to 'dependencies' if given
+		ProgramSources sources(Key key, std::vector<std::string>* dependencies = nullptr) const;
+
+		// Builds the variant if it has not been built yet
+		GPUProgram& get(Key key);
+
+		// The number of variants built so far
+		size_t size() const;
+
+	};
+
+}
+
+#endif
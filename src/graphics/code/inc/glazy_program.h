@@ -3,6 +3,12 @@
 #define GLAZY_PROGRAM
 
 #include "glazy_common.h"
+#include "glazy_state.h"
+#include <string_view>
+#include <span>
+#include <optional>
+#include <memory>
+#include <deque>
 
 
 namespace glazy {
@@ -14,6 +20,11 @@ namespace glazy {
 		bool   empty;
 		GLuint id;
 
+	public:
+
+		// Blocks until the shader has compiled, throwing if compilation failed.
+		// Programs check their shaders when they fail to link, so this is only
+		// needed to catch errors before linking.
 		void check_compilation() {
 			safety::entry_guard("Shader::check_compilation");
 			GLint status;
@@ -32,10 +43,10 @@ namespace glazy {
 			safety::exit_guard("Shader::check_compilation");
 		}
 
-	public:
-
 		Shader() : id(0), empty(true) {}
 
+		// Submits the source for compilation without waiting for the result, so
+		// that the driver can compile many shaders at once
 		Shader(std::string text) :
 			id(glCreateShader(KIND)),
 			empty(false)
@@ -48,7 +59,6 @@ namespace glazy {
 			GLchar const* code = reinterpret_cast<GLchar const*>(text.c_str());
 			glShaderSource(id, 1, &code, &length);
 			glCompileShader(id);
-			check_compilation();
 			safety::exit_guard("Shader::Shader(std::string)");
 		}
 
@@ -98,11 +108,42 @@ namespace glazy {
 		template<> void SetUniformV(GLint loc, size_t c, glm::mat3x4* ptr);
 		template<> void SetUniformV(GLint loc, size_t c, glm::mat4x3* ptr);
 
+		// As SetUniformV, but for a given program rather than the current one
+		template<typename T> void ProgramUniformV(GLuint program, GLint loc, size_t c, T const* ptr) {
+			throw std::runtime_error("Templated type deduction not supported for this input type.");
+		}
+
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, GLfloat const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::vec2 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::vec3 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::vec4 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, GLint const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::ivec2 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::ivec3 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::ivec4 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, GLuint const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::uvec2 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::uvec3 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::uvec4 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, GLboolean const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::mat2 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::mat3 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::mat4 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::mat2x3 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::mat3x2 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::mat2x4 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::mat4x2 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::mat3x4 const* ptr);
+		template<> void ProgramUniformV(GLuint program, GLint loc, size_t c, glm::mat4x3 const* ptr);
+
 		template<typename T>
 		struct UniformSetter {
 			static void set(GLint loc, T& inp) {
 				SetUniformV(loc, 1, &inp);
 			}
+			static void set(GLuint program, GLint loc, T& inp) {
+				ProgramUniformV(program, loc, 1, &inp);
+			}
 		};
 		
 		template<>
@@ -111,6 +152,9 @@ namespace glazy {
 				GLint val = inp;
 				SetUniformV(loc, 1, &val);
 			}
+			static void set(GLuint program, GLint loc, GLboolean& inp) {
+				ProgramUniformV(program, loc, 1, &inp);
+			}
 		};
 		
 
@@ -119,6 +163,156 @@ namespace glazy {
 			static void set(GLint loc, std::vector<T>& inp) {
 				SetUniformV(loc, inp.size(), inp.data());
 			}
+			static void set(GLuint program, GLint loc, std::vector<T>& inp) {
+				ProgramUniformV(program, loc, inp.size(), inp.data());
+			}
+		};
+
+		template<typename T>
+		struct UniformSetter <std::span<T>> {
+			static void set(GLint loc, std::span<T>& inp) {
+				SetUniformV(loc, inp.size(), inp.data());
+			}
+			static void set(GLuint program, GLint loc, std::span<T>& inp) {
+				ProgramUniformV(program, loc, inp.size(), inp.data());
+			}
+		};
+
+
+		// The bytes of a value that a uniform shadow compares and stores. For
+		// arrays, these are the elements rather than the container. Booleans
+		// are widened to GLint, the width GL holds them at, so that a bool
+		// uniform records the same bytes whether it was set as a GLboolean or
+		// as a GLint.
+		template<typename T>
+		struct ShadowBytes {
+			void const* data;
+			size_t size;
+			ShadowBytes(T const& inp) : data(&inp), size(sizeof(T)) {}
+		};
+
+		template<typename T>
+		struct ShadowBytes <std::vector<T>> {
+			void const* data;
+			size_t size;
+			ShadowBytes(std::vector<T> const& inp) : data(inp.data()), size(inp.size() * sizeof(T)) {}
+		};
+
+		template<typename T>
+		struct ShadowBytes <std::span<T>> {
+			void const* data;
+			size_t size;
+			ShadowBytes(std::span<T> const& inp) : data(inp.data()), size(inp.size_bytes()) {}
+		};
+
+		template<>
+		struct ShadowBytes <GLboolean> {
+			GLint widened;
+			void const* data;
+			size_t size;
+			ShadowBytes(GLboolean inp) : widened(inp), data(&widened), size(sizeof(GLint)) {}
+		};
+
+		struct WidenedBools {
+			std::vector<GLint> widened;
+			void const* data;
+			size_t size;
+			WidenedBools(GLboolean const* inp, size_t count)
+				: widened(inp, inp + count)
+				, data(widened.data())
+				, size(widened.size() * sizeof(GLint))
+			{}
+		};
+
+		template<>
+		struct ShadowBytes <std::vector<GLboolean>> : WidenedBools {
+			ShadowBytes(std::vector<GLboolean> const& inp) : WidenedBools(inp.data(), inp.size()) {}
+		};
+
+		template<>
+		struct ShadowBytes <std::span<GLboolean>> : WidenedBools {
+			ShadowBytes(std::span<GLboolean> const& inp) : WidenedBools(inp.data(), inp.size()) {}
+		};
+
+		template<>
+		struct ShadowBytes <std::span<GLboolean const>> : WidenedBools {
+			ShadowBytes(std::span<GLboolean const> const& inp) : WidenedBools(inp.data(), inp.size()) {}
+		};
+
+
+		// The GL type of the uniform that a C++ type is written to. Uniforms are
+		// only ever matched against these when a handle is resolved.
+		template<typename T> struct TypeOf;
+		template<> struct TypeOf<GLfloat>     { static GLenum const value = GL_FLOAT; };
+		template<> struct TypeOf<glm::vec2>   { static GLenum const value = GL_FLOAT_VEC2; };
+		template<> struct TypeOf<glm::vec3>   { static GLenum const value = GL_FLOAT_VEC3; };
+		template<> struct TypeOf<glm::vec4>   { static GLenum const value = GL_FLOAT_VEC4; };
+		template<> struct TypeOf<GLint>       { static GLenum const value = GL_INT; };
+		template<> struct TypeOf<glm::ivec2>  { static GLenum const value = GL_INT_VEC2; };
+		template<> struct TypeOf<glm::ivec3>  { static GLenum const value = GL_INT_VEC3; };
+		template<> struct TypeOf<glm::ivec4>  { static GLenum const value = GL_INT_VEC4; };
+		template<> struct TypeOf<GLuint>      { static GLenum const value = GL_UNSIGNED_INT; };
+		template<> struct TypeOf<glm::uvec2>  { static GLenum const value = GL_UNSIGNED_INT_VEC2; };
+		template<> struct TypeOf<glm::uvec3>  { static GLenum const value = GL_UNSIGNED_INT_VEC3; };
+		template<> struct TypeOf<glm::uvec4>  { static GLenum const value = GL_UNSIGNED_INT_VEC4; };
+		template<> struct TypeOf<GLboolean>   { static GLenum const value = GL_BOOL; };
+		template<> struct TypeOf<glm::mat2>   { static GLenum const value = GL_FLOAT_MAT2; };
+		template<> struct TypeOf<glm::mat3>   { static GLenum const value = GL_FLOAT_MAT3; };
+		template<> struct TypeOf<glm::mat4>   { static GLenum const value = GL_FLOAT_MAT4; };
+		template<> struct TypeOf<glm::mat2x3> { static GLenum const value = GL_FLOAT_MAT2x3; };
+		template<> struct TypeOf<glm::mat3x2> { static GLenum const value = GL_FLOAT_MAT3x2; };
+		template<> struct TypeOf<glm::mat2x4> { static GLenum const value = GL_FLOAT_MAT2x4; };
+		template<> struct TypeOf<glm::mat4x2> { static GLenum const value = GL_FLOAT_MAT4x2; };
+		template<> struct TypeOf<glm::mat3x4> { static GLenum const value = GL_FLOAT_MAT3x4; };
+		template<> struct TypeOf<glm::mat4x3> { static GLenum const value = GL_FLOAT_MAT4x3; };
+
+		bool is_sampler(GLenum type);
+
+		// Whether a value of C++ type T may be written to a uniform of GL type
+		// 'type'. Samplers are set through their texture unit, as an int.
+		// Booleans may also be set as an int, as glUniform1i does.
+		template<typename T>
+		bool accepts(GLenum type) {
+			if constexpr (std::is_same<T, GLint>::value) {
+				if (is_sampler(type) || (type == GL_BOOL)) {
+					return true;
+				}
+			}
+			return type == TypeOf<T>::value;
+		}
+
+
+		// FNV-1a, written to be usable at compile time, so that names given as
+		// literals can be hashed before the program ever runs
+		constexpr uint32_t hash(std::string_view text) {
+			uint32_t result = 2166136261u;
+			for (char c : text) {
+				result ^= static_cast<unsigned char>(c);
+				result *= 16777619u;
+			}
+			return result;
+		}
+
+		// A variable name along with its hash. Declaring a Name constexpr moves
+		// the hashing to compile time.
+		struct Name {
+			std::string_view text;
+			uint32_t hash;
+
+			constexpr Name(char const* text)
+				: text(text)
+				, hash(uniform::hash(text))
+			{}
+
+			constexpr Name(std::string_view text)
+				: text(text)
+				, hash(uniform::hash(text))
+			{}
+
+			Name(std::string const& text)
+				: text(text)
+				, hash(uniform::hash(text))
+			{}
 		};
 	}
 
@@ -127,6 +321,152 @@ namespace glazy {
 		uniform::UniformSetter<T>::set(loc, inp);
 	}
 
+	template<typename T>
+	void SetProgramUniform(GLuint program, GLint loc, T& inp) {
+		uniform::UniformSetter<T>::set(program, loc, inp);
+	}
+
+
+	// A uniform or attribute found by reflecting on a linked program. Arrays
+	// are listed under their name without the trailing "[0]".
+	struct ActiveVariable {
+		std::string name;
+		uint32_t    hash;
+		GLint       location;
+		GLenum      type;
+		GLint       count;
+	};
+
+	// Active variables, looked up by the hash of their name. Slots are open
+	// addressed with linear probing, and are kept at most half full so that
+	// probes stay short.
+	class VariableTable {
+
+		std::vector<ActiveVariable> variables;
+		// Indices into 'variables', or -1 for an empty slot
+		std::vector<int32_t> slots;
+
+		void rehash(size_t capacity);
+
+	public:
+
+		void insert(ActiveVariable variable);
+		void clear();
+		ActiveVariable const* find(uniform::Name name) const;
+		size_t size() const;
+		std::vector<ActiveVariable> const& all() const;
+
+	};
+
+
+	// The last value set on each uniform of a program, so that setting a
+	// uniform to the value it already has makes no GL call. Only values set
+	// through UniformHandles and GPUAccessors are seen, so code that sets a
+	// program's uniforms by other means must call 'forget' afterward.
+	class UniformShadow {
+
+		struct Entry {
+			size_t offset;
+			size_t size;
+			// Leading bytes of the entry that hold a value known to be in GL
+			size_t known;
+		};
+
+		std::vector<unsigned char> values;
+		// In the order of the program's uniform table, followed by any
+		// array elements looked up by name since
+		std::vector<Entry> entries;
+		size_t issued;
+		size_t elided;
+
+	public:
+
+		struct Counters {
+			size_t issued;
+			size_t elided;
+		};
+
+		UniformShadow();
+
+		// Sizes the storage for a program's uniforms, with every value unknown
+		void reset(VariableTable const& uniforms);
+		// Adds an entry for the elements of the array at 'index' from
+		// 'element' on, which shares its bytes with the array's entry, and
+		// returns the new entry's index
+		size_t add_element(size_t index, size_t element, size_t element_size);
+
+		// Records 'size' bytes as the value of the uniform at 'index' of the
+		// uniform table. Returns whether they differ from what GL holds, in
+		// which case the caller must send them.
+		bool update(size_t index, void const* data, size_t size);
+
+		// The bytes recorded for the uniform at 'index', which are empty if
+		// its value is unknown
+		std::span<unsigned char const> known_value(size_t index) const;
+		// How many bytes the uniform at 'index' has room for
+		size_t capacity(size_t index) const;
+
+		// Marks every value as unknown
+		void forget();
+
+		Counters counters() const;
+		void reset_counters();
+
+	};
+
+
+	// A uniform of a particular program, resolved once so that setting it costs
+	// a single glProgramUniform* call, with no lookup and no binding. Values
+	// equal to the last one set are not sent at all.
+	template<typename T>
+	class UniformHandle {
+
+		GLuint program;
+		GLint  location;
+		std::shared_ptr<UniformShadow> shadow;
+		size_t index;
+
+	public:
+
+		UniformHandle()
+			: program(0)
+			, location(-1)
+			, index(0)
+		{}
+
+		// Without a shadow, every value is sent
+		UniformHandle(GLuint program, GLint location, std::shared_ptr<UniformShadow> shadow = {}, size_t index = 0)
+			: program(program)
+			, location(location)
+			, shadow(std::move(shadow))
+			, index(index)
+		{}
+
+		void set(T const& value) {
+			uniform::ShadowBytes<T> bytes(value);
+			if (!shadow || shadow->update(index, bytes.data, bytes.size)) {
+				uniform::ProgramUniformV(program, location, 1, &value);
+			}
+		}
+
+		void set(std::span<T const> values) {
+			uniform::ShadowBytes<std::span<T const>> bytes(values);
+			if (!shadow || shadow->update(index, bytes.data, bytes.size)) {
+				uniform::ProgramUniformV(program, location, values.size(), values.data());
+			}
+		}
+
+		UniformHandle& operator=(T const& value) {
+			set(value);
+			return *this;
+		}
+
+		GLint get_location() const {
+			return location;
+		}
+
+	};
+
 
 	class GPUProgram;
 
@@ -143,51 +483,183 @@ namespace glazy {
 	};
 
 
+	class ProgramFuture;
+
 	class GPUProgram {
 	private:
+		friend class ProgramFuture;
 		GLuint id;
+		VariableTable uniforms;
+		VariableTable attributes;
+		// Uniform blocks, with the block index as the location and the data
+		// size in bytes as the count
+		VariableTable blocks;
+		// Shared with handles, which may outlive the program's tables
+		std::shared_ptr<UniformShadow> shadow;
+		// Array elements named with an index, such as "lights[2]", which are
+		// resolved the first time they are looked up. A deque, so that the
+		// references find_uniform returns stay valid as it grows.
+		struct Element {
+			ActiveVariable variable;
+			size_t         shadow_index;
+		};
+		mutable std::deque<Element> elements;
+		// Throws with the log of the first attached shader that failed to
+		// compile, or else with the link log, if linking failed
 		void check_linking();
+		// Validates the stages, then creates, attaches and links a program
+		// without waiting for the result
+		static GLuint submit(
+			Shader<GL_VERTEX_SHADER>&          vertex,
+			Shader<GL_TESS_CONTROL_SHADER>&    tess_cont,
+			Shader<GL_TESS_EVALUATION_SHADER>& tess_eval,
+			Shader<GL_GEOMETRY_SHADER>&        geometry,
+			Shader<GL_FRAGMENT_SHADER>&        fragment,
+			bool retrievable
+		);
+		// Fills the uniform, attribute and block tables from the linked program
+		void reflect();
+		GPUProgram(GLuint linked_id);
+		static GPUProgram link_separable(GLuint shader_id);
 	public:
 
 		void attach(GLuint shader_id);
+		// With 'retrievable' set, the driver is asked to keep the program's
+		// binary available for glGetProgramBinary
 		GPUProgram(
 			Shader<GL_VERTEX_SHADER>          vertex,
 			Shader<GL_TESS_CONTROL_SHADER>    tess_cont,
 			Shader<GL_TESS_EVALUATION_SHADER> tess_eval,
 			Shader<GL_GEOMETRY_SHADER>        geometry,
-			Shader<GL_FRAGMENT_SHADER>        fragment
+			Shader<GL_FRAGMENT_SHADER>        fragment,
+			bool retrievable = false
 		);
+		// Takes ownership of a program that was linked elsewhere, such as one
+		// loaded through glProgramBinary. Throws if it failed to link.
+		static GPUProgram from_linked(GLuint linked_id);
+
+		// Links a single stage on its own, as a program that a ProgramPipeline
+		// can combine with the programs of other stages
+		template<GLenum KIND>
+		static GPUProgram separable(Shader<KIND> shader) {
+			if (shader.is_empty()) {
+				throw std::runtime_error("Separable programs need a shader.");
+			}
+			return link_separable(shader);
+		}
+
+		// Takes over the id and tables of 'fresh', which is usually a rebuild of
+		// this program from edited sources, and deletes the old program. The
+		// values of uniforms both programs share, and the bindings of their
+		// uniform blocks, carry over. Uniform values are replayed from the
+		// shadow, so only those set through glazy carry over. If the old
+		// program was current, the new one is made current in its place.
+		//
+		// Uniform locations may differ between the programs, so handles taken
+		// from this program before the call must be taken again.
+		void replace(GPUProgram&& fresh);
 		operator GLuint();
 		GPUAccessor operator[](std::string name);
 
+		// Makes a program current for the guard's lifetime. Nested guards restore
+		// the program of the guard enclosing them, while the outermost guard
+		// leaves its program in use.
 		class BindGuard {
 
-			static std::stack<GLuint> bind_stack;
-
-			GPUProgram& program;
+			GLuint previous;
+			bool   nested;
 
 		public:
 			BindGuard(GPUProgram& program);
+			BindGuard(BindGuard&) = delete;
 			~BindGuard();
 		};
 
 
 		GLint attribute_index(std::string name);
 
+		// Throws if the program has no active uniform of that name. A name
+		// ending in "[N]" may also name element N of an array onward.
+		ActiveVariable const& find_uniform(uniform::Name name) const;
+		VariableTable const& active_uniforms() const;
+		VariableTable const& active_attributes() const;
+		VariableTable const& active_blocks() const;
+
+		// Has the named uniform block read from the given binding point. Throws
+		// if the block does not exist, or needs more than 'size' bytes once
+		// 'size' is padded to a multiple of 16.
+		void bind_block(uniform::Name name, GLuint binding, size_t size);
+
+		// The last values set through this program's handles and accessors
+		UniformShadow& uniform_shadow();
+		// The index of one of this program's uniforms in its shadow
+		size_t uniform_index(ActiveVariable const& variable) const;
+
+		template<typename T>
+		UniformHandle<T> uniform_handle(uniform::Name name) {
+			ActiveVariable const& variable = find_uniform(name);
+			if (!uniform::accepts<T>(variable.type)) {
+				throw std::runtime_error(
+					"Uniform '" + variable.name + "' has GL type " + std::to_string(variable.type)
+					+ ", which cannot be set from a value of GL type " + std::to_string(uniform::TypeOf<T>::value) + "."
+				);
+			}
+			return UniformHandle<T>(id, variable.location, shadow, uniform_index(variable));
+		}
+
+	};
+
+
+	// A program whose shaders have been submitted for compiling and linking but
+	// not yet checked. Creating every program a scene needs as a future before
+	// using any of them lets the driver compile them side by side, instead of
+	// stalling on each in turn.
+	//
+	// Renderers can call 'poll' once a frame and draw with a fallback until it
+	// returns a program. Without parallel_shader_compile the driver cannot be
+	// asked whether it has finished, so the first 'poll' waits for it.
+	class ProgramFuture {
+
+		GLuint pending;
+		std::optional<GPUProgram> program;
+
+		// Checks the link result and reflects the program
+		void finish();
+
+	public:
+
+		ProgramFuture(
+			Shader<GL_VERTEX_SHADER>          vertex,
+			Shader<GL_TESS_CONTROL_SHADER>    tess_cont,
+			Shader<GL_TESS_EVALUATION_SHADER> tess_eval,
+			Shader<GL_GEOMETRY_SHADER>        geometry,
+			Shader<GL_FRAGMENT_SHADER>        fragment,
+			bool retrievable = false
+		);
+		ProgramFuture(ProgramFuture&) = delete;
+		ProgramFuture(ProgramFuture&& other);
+		~ProgramFuture();
+
+		// True once compiling and linking have finished, whether or not they
+		// succeeded. Never blocks.
+		bool ready() const;
+
+		// The program, or nullptr if it is not ready yet. Throws if the program
+		// failed to compile or link.
+		GPUProgram* poll();
+
+		// Waits for the program, throwing if it failed to compile or link
+		GPUProgram& get();
+
 	};
 
 	template<typename T>
 	void GPUAccessor::operator=(T other) {
 		safety::entry_guard("GPUProgram::GPUAccessor::operator=");
-		{
-			GPUProgram::BindGuard guard(prog);
-			GLint loc = glGetUniformLocation(prog, reinterpret_cast<GLchar const*>(name.c_str()));
-			if (loc < 0) {
-				throw std::runtime_error("Invalid uniform name '" + name + "'");
-			}
-			else {
-				SetUniform(loc, other);
-			}
+		ActiveVariable const& variable = prog.find_uniform(name);
+		uniform::ShadowBytes<T> bytes(other);
+		if (prog.uniform_shadow().update(prog.uniform_index(variable), bytes.data, bytes.size)) {
+			SetProgramUniform(prog, variable.location, other);
 		}
 		safety::exit_guard("GPUProgram::GPUAccessor::operator=");
 	}
@@ -0,0 +1,103 @@
+
+
+#ifndef GLAZY_RELOAD
+#define GLAZY_RELOAD
+
+#include "glazy_cache.h"
+#include <filesystem>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+
+namespace glazy {
+
+	// The source file of each stage of a program. Only the vertex and fragment
+	// stages are required.
+	struct ProgramFiles {
+		std::string vertex;
+		std::string tess_control;
+		std::string tess_evaluation;
+		std::string geometry;
+		std::string fragment;
+
+		ProgramSources read() const;
+	};
+
+
+	// Rebuilds programs when their source files change on disk. Changes are
+	// picked up through inotify on Linux, and by comparing modification times
+	// elsewhere. Only the programs that use a changed file are rebuilt.
+	//
+	// Programs are rebuilt on the thread that calls 'poll', which must have the
+	// programs' context current. A rebuilt program replaces the old one through
+	// GPUProgram::replace, so uniform values carry over. A rebuild that fails
+	// leaves the old program in place and reports the error.
+	//
+	// The watcher keeps pointers to the programs it watches, so a program must
+	// be unwatched before it is destroyed or moved.
+	class ShaderWatcher {
+
+	public:
+
+		// Called after a program is replaced, to take new uniform handles
+		typedef std::function<void(GPUProgram&)> ReloadCallback;
+		// Builds a new version of a program, replacing 'dependencies' with the
+		// files the new version was built from, as edits can add or remove
+		// includes
+		typedef std::function<GPUProgram(std::vector<std::string>& dependencies)> Rebuild;
+
+		struct Result {
+			size_t reloaded;
+			// One message for each program that failed to rebuild
+			std::vector<std::string> errors;
+		};
+
+	private:
+
+		struct Watched {
+			std::vector<std::string> dependencies;
+			Rebuild rebuild;
+			ReloadCallback on_reload;
+		};
+
+		std::unordered_map<GPUProgram*, Watched> programs;
+		// Each watched file, by canonical path, and the programs that use it
+		std::unordered_map<std::string, std::unordered_set<GPUProgram*>> users;
+		// Modification times, for the polling fallback
+		std::unordered_map<std::string, std::filesystem::file_time_type> times;
+
+		int notify_fd;
+		// Watched directories, by inotify watch descriptor
+		std::unordered_map<int, std::string> directories;
+
+		static std::string canonical(std::string const& path);
+		void add_file(std::string const& path, GPUProgram* program);
+		void remove_files(GPUProgram* program);
+		// The canonical paths of the watched files that changed since last asked
+		std::unordered_set<std::string> changed_files();
+
+	public:
+
+		ShaderWatcher();
+		ShaderWatcher(ShaderWatcher&) = delete;
+		~ShaderWatcher();
+
+		void watch(GPUProgram& program, ProgramFiles files, ReloadCallback on_reload = {});
+		// Watches a program built by other means, such as through the shader
+		// preprocessor, which is rebuilt when any of 'dependencies' changes
+		void watch(GPUProgram& program, std::vector<std::string> dependencies, Rebuild rebuild, ReloadCallback on_reload = {});
+		void unwatch(GPUProgram& program);
+
+		// Rebuilds every program that uses a file changed since the last call.
+		// Meant to be called once a frame, and cheap when nothing changed.
+		Result poll();
+
+		// Whether changes are reported by the OS, rather than found by polling
+		bool notified() const;
+
+	};
+
+}
+
+#endif
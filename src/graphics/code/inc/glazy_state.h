@@ -0,0 +1,214 @@
+
+
+#ifndef GLAZY_STATE
+#define GLAZY_STATE
+
+#include "glazy_common.h"
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+
+namespace glazy {
+
+	namespace detail {
+
+		// One T for each GL context, looked up by the window that owns the
+		// context current on the calling thread. The last lookup is remembered
+		// per thread, so the registry lock is only taken when a thread switches
+		// contexts, or when any entry has been released since.
+		template<typename T>
+		class PerContext {
+
+			inline static std::mutex mutex;
+			inline static std::unordered_map<GLFWwindow*, std::unique_ptr<T>> registry;
+			inline static std::atomic<size_t> generation = 0;
+
+		public:
+
+			static T& current() {
+				static thread_local GLFWwindow* last_window = nullptr;
+				static thread_local T* last_entry = nullptr;
+				static thread_local size_t last_generation = 0;
+
+				GLFWwindow* window = glfwGetCurrentContext();
+				size_t now = generation.load();
+				if ((last_entry == nullptr) || (window != last_window) || (now != last_generation)) {
+					std::lock_guard<std::mutex> lock(mutex);
+					std::unique_ptr<T>& entry = registry[window];
+					if (!entry) {
+						entry.reset(new T);
+					}
+					last_window = window;
+					last_entry = entry.get();
+					last_generation = now;
+				}
+				return *last_entry;
+			}
+
+			static void release(GLFWwindow* window) {
+				std::lock_guard<std::mutex> lock(mutex);
+				registry.erase(window);
+				generation++;
+			}
+
+		};
+
+	}
+
+	// A record of the bindings and fixed-function state of one GL context, used
+	// to skip calls that would set state to the value it already has.
+	//
+	// The record is only accurate if the state it covers is always changed
+	// through the cache. Code that calls GL directly should call 'invalidate'
+	// afterward, after which every piece of state is re-sent the next time it
+	// is set.
+	class StateCache {
+
+		// A cached value, which is unknown until first set through the cache
+		template<typename T>
+		struct Slot {
+			T    value;
+			bool known;
+
+			// Returns true if the value changed and the GL call must be made
+			bool assign(T new_value) {
+				if (known && (value == new_value)) {
+					return false;
+				}
+				value = new_value;
+				known = true;
+				return true;
+			}
+		};
+
+		// A buffer, or a range of one, bound to an indexed target. A size of zero
+		// stands for the whole buffer.
+		struct IndexedBuffer {
+			GLuint id;
+			size_t offset;
+			size_t size;
+			bool operator==(IndexedBuffer const& other) const {
+				return (id == other.id) && (offset == other.offset) && (size == other.size);
+			}
+		};
+
+		struct BlendFunc {
+			GLenum source;
+			GLenum dest;
+			bool operator==(BlendFunc const& other) const {
+				return (source == other.source) && (dest == other.dest);
+			}
+		};
+
+		std::unordered_map<GLenum, Slot<GLuint>> buffers;
+		// Keyed by slot_key
+		std::unordered_map<uint64_t, Slot<IndexedBuffer>> indexed_buffers;
+		Slot<GLuint> program;
+		Slot<GLuint> pipeline;
+		Slot<GLuint> vertex_array;
+		Slot<GLuint> active_unit;
+		// Keyed by slot_key
+		std::unordered_map<uint64_t, Slot<GLuint>> textures;
+		std::unordered_map<GLuint, Slot<GLuint>> samplers;
+		std::unordered_map<GLenum, Slot<bool>> capabilities;
+		std::unordered_map<GLenum, Slot<GLint>> pixel_store_values;
+		Slot<BlendFunc> blend;
+		Slot<GLenum> blend_mode;
+		Slot<GLenum> depth;
+		Slot<bool>   depth_writes;
+
+		size_t issued;
+		size_t elided;
+
+		// Index or unit in the upper half, target in the lower half
+		static uint64_t slot_key(GLuint index, GLenum target);
+
+		// Counts the outcome of an assignment, passing it through
+		bool count(bool changed);
+
+	public:
+
+		struct Counters {
+			size_t issued;
+			size_t elided;
+		};
+
+		// Depth of the bind guards currently alive on this context, used to
+		// decide whether a guard has an enclosing binding to restore
+		struct GuardDepth {
+			size_t array_buffer;
+			size_t vertex_array;
+			size_t program;
+		} guard_depth;
+
+		StateCache();
+		StateCache(StateCache&) = delete;
+
+		// The cache of the context that is current on the calling thread
+		static StateCache& current();
+		// Discards the cache of a context that is about to be destroyed
+		static void release(GLFWwindow* window);
+
+		void bind_buffer(GLenum target, GLuint id);
+		GLuint bound_buffer(GLenum target) const;
+		// Binds to an indexed target, such as GL_UNIFORM_BUFFER. Like the GL
+		// calls they wrap, these also replace the target's generic binding.
+		void bind_buffer_base(GLenum target, GLuint index, GLuint id);
+		void bind_buffer_range(GLenum target, GLuint index, GLuint id, size_t offset, size_t size);
+
+		void use_program(GLuint id);
+		GLuint current_program() const;
+
+		// A pipeline only takes effect while no program is in use, so binding
+		// one also stops using the current program
+		void bind_program_pipeline(GLuint id);
+		GLuint bound_program_pipeline() const;
+
+		void bind_vertex_array(GLuint id);
+		GLuint bound_vertex_array() const;
+
+		// 'unit' is an index, rather than GL_TEXTURE0 + index
+		void active_texture(GLuint unit);
+		// Binds to the active texture unit
+		void bind_texture(GLenum target, GLuint id);
+		void bind_texture(GLuint unit, GLenum target, GLuint id);
+		// The texture bound to 'target' on the active texture unit
+		GLuint bound_texture(GLenum target) const;
+		void bind_sampler(GLuint unit, GLuint id);
+
+		void set_enabled(GLenum cap, bool enabled);
+		void enable(GLenum cap);
+		void disable(GLenum cap);
+
+		// Sets a glPixelStorei parameter, such as GL_UNPACK_ALIGNMENT
+		void pixel_store(GLenum name, GLint value);
+
+		void blend_func(GLenum source, GLenum dest);
+		void blend_equation(GLenum mode);
+		void depth_func(GLenum func);
+		void depth_mask(bool writes);
+
+		// Deleting an object reverts any binding of it to zero, so these keep the
+		// record in step with GL. They make no GL calls themselves.
+		void forget_buffer(GLuint id);
+		void forget_vertex_array(GLuint id);
+		// Unlike the others, a deleted program stays in use until replaced, but
+		// its name may be handed out again, so it is marked unknown
+		void forget_program(GLuint id);
+		void forget_program_pipeline(GLuint id);
+		void forget_texture(GLuint id);
+		void forget_sampler(GLuint id);
+
+		// Marks all state as unknown
+		void invalidate();
+
+		Counters counters() const;
+		void reset_counters();
+
+	};
+
+}
+
+#endif
@@ -0,0 +1,151 @@
+
+
+#ifndef GLAZY_STREAM
+#define GLAZY_STREAM
+
+#include "glazy_buffer.h"
+#include "glazy_texture.h"
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+
+
+namespace glazy {
+
+	// A texture being filled by a TextureStreamer. Its levels arrive smallest
+	// first, so a blurry version of the image can be drawn long before the
+	// full-resolution one is in place.
+	class StreamedTexture {
+
+		friend class TextureStreamer;
+
+		std::string path;
+		std::unique_ptr<Texture2D<format::RGBA8>> texture;
+		// The largest level uploaded so far, or -1 before any has been
+		GLint resident;
+		std::string error;
+
+	public:
+
+		StreamedTexture(std::string path);
+		StreamedTexture(StreamedTexture&) = delete;
+
+		// Null until the smallest level has been uploaded, and whenever loading
+		// failed. Sampling only ever sees the levels uploaded so far.
+		TextureStorage* get();
+		GLint resident_level() const;
+		// Whether every level has been uploaded
+		bool complete() const;
+		bool failed() const;
+		std::string const& failure() const;
+		std::string const& file_path() const;
+
+	};
+
+
+	// Loads image files into textures without stalling the render thread.
+	// Files are decoded, and their mip chains built, on a pool of worker
+	// threads. The render thread then copies a fixed number of bytes per frame
+	// into a ring of pixel unpack buffers, and has GL upload from there, so the
+	// copy into the texture happens without the driver waiting on the CPU.
+	class TextureStreamer {
+
+	public:
+
+		struct Metrics {
+			// Files waiting to be decoded, or being decoded
+			size_t queue_depth;
+			// Textures decoded, with levels still to upload
+			size_t uploading;
+			size_t completed;
+			size_t failed;
+			// Worker time spent decoding files and building mip chains
+			double decode_seconds;
+			size_t bytes_uploaded;
+			// Time from the first upload to the latest one
+			double upload_seconds;
+
+			double mean_decode_seconds() const;
+			double bytes_per_second() const;
+		};
+
+	private:
+
+		struct Request {
+			std::shared_ptr<StreamedTexture> target;
+			std::string path;
+		};
+
+		// A decoded file, with its levels stored smallest first
+		struct Decoded {
+			std::shared_ptr<StreamedTexture> target;
+			std::vector<std::vector<format::RGBA8>> levels;
+			size_t width;
+			size_t height;
+			std::string error;
+		};
+
+		struct Upload {
+			std::shared_ptr<StreamedTexture> target;
+			std::vector<std::vector<format::RGBA8>> levels;
+			// Index into 'levels' of the level being uploaded
+			size_t step;
+			// Rows of that level uploaded so far
+			size_t row;
+		};
+
+		std::vector<std::thread> workers;
+		mutable std::mutex mutex;
+		std::condition_variable wake;
+		std::deque<Request> requests;
+		std::deque<Decoded> decoded;
+		size_t decoding;
+		bool stopping;
+
+		// Only touched on the render thread
+		StreamBuffer<unsigned char> staging;
+		std::deque<Upload> uploads;
+
+		size_t completed;
+		size_t failed;
+		double decode_seconds;
+		size_t bytes_uploaded;
+		std::chrono::steady_clock::time_point first_upload;
+		std::chrono::steady_clock::time_point last_upload;
+
+		void run();
+		static Decoded decode(Request const& request);
+
+		// Creates the texture for a decoded file and queues its levels
+		void begin_upload(Decoded& result);
+
+	public:
+
+		// A 'worker_count' of zero uses one fewer thread than the hardware has.
+		// At most 'bytes_per_frame' are staged each frame, in a ring of
+		// 'frame_count' regions.
+		TextureStreamer(size_t worker_count = 0, size_t bytes_per_frame = 4 << 20, size_t frame_count = 3);
+		TextureStreamer(TextureStreamer&) = delete;
+		// Abandons decodes that have not started, and waits for the rest
+		~TextureStreamer();
+
+		// Queues a file to be loaded. The returned texture fills in over the
+		// following calls to 'update'.
+		std::shared_ptr<StreamedTexture> load(std::string path);
+
+		// Moves uploads along by one frame's budget. Must be called once per
+		// frame, on the render thread.
+		void update();
+
+		// Whether nothing is left to decode or upload
+		bool idle() const;
+		Metrics metrics() const;
+
+	};
+
+}
+
+#endif
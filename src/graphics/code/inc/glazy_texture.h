@@ -1,14 +1,169 @@
 
+
 #ifndef GLAZY_TEXTURE
 #define GLAZY_TEXTURE
 
 #include "glazy_common.h"
+#include "glazy_state.h"
+#include <span>
 
 namespace glazy {
 
-	class Texture {
+	// Texel types, each naming the GL formats that describe it. The layout of
+	// each matches what GL reads for its 'layout' and 'type'.
+	namespace format {
 
-		GLuint id;
+		struct R8 {
+			GLubyte r;
+			static constexpr GLenum internal = GL_R8;
+			static constexpr GLenum layout   = GL_RED;
+			static constexpr GLenum type     = GL_UNSIGNED_BYTE;
+		};
+
+		struct RG8 {
+			GLubyte r;
+			GLubyte g;
+			static constexpr GLenum internal = GL_RG8;
+			static constexpr GLenum layout   = GL_RG;
+			static constexpr GLenum type     = GL_UNSIGNED_BYTE;
+		};
+
+		struct RGBA8 {
+			GLubyte r;
+			GLubyte g;
+			GLubyte b;
+			GLubyte a;
+			static constexpr GLenum internal = GL_RGBA8;
+			static constexpr GLenum layout   = GL_RGBA;
+			static constexpr GLenum type     = GL_UNSIGNED_BYTE;
+		};
+
+		// Colour channels stored sRGB-encoded, and decoded to linear when sampled
+		struct SRGB8_A8 {
+			GLubyte r;
+			GLubyte g;
+			GLubyte b;
+			GLubyte a;
+			static constexpr GLenum internal = GL_SRGB8_ALPHA8;
+			static constexpr GLenum layout   = GL_RGBA;
+			static constexpr GLenum type     = GL_UNSIGNED_BYTE;
+		};
+
+		// Each channel holds the bits of a 16-bit float
+		struct RGBA16F {
+			GLhalf r;
+			GLhalf g;
+			GLhalf b;
+			GLhalf a;
+			static constexpr GLenum internal = GL_RGBA16F;
+			static constexpr GLenum layout   = GL_RGBA;
+			static constexpr GLenum type     = GL_HALF_FLOAT;
+		};
+
+		struct R32F {
+			GLfloat r;
+			static constexpr GLenum internal = GL_R32F;
+			static constexpr GLenum layout   = GL_RED;
+			static constexpr GLenum type     = GL_FLOAT;
+		};
+
+	}
+
+
+	// A 2D texture whose size, format and mip count are fixed when it is
+	// created, which lets the driver skip the completeness checks mutable
+	// textures need. The format-independent half of Texture2D.
+	class TextureStorage {
+
+		GLuint  id;
+		GLenum  internal;
+		GLenum  layout;
+		GLenum  type;
+		size_t  texel_size;
+		size_t  storage_width;
+		size_t  storage_height;
+		GLsizei levels;
+
+		// Checks a rectangle against a mip level's bounds
+		void check_region(GLint level, size_t x, size_t y, size_t width, size_t height) const;
+		// Sends a rectangle from client memory, or from an offset into the bound
+		// pixel unpack buffer
+		void transfer(GLint level, size_t x, size_t y, size_t width, size_t height, void const* data, size_t row_length);
+
+	protected:
+
+		// A 'levels' of zero allocates the full mip chain
+		TextureStorage(GLenum internal, GLenum layout, GLenum type, size_t texel_size, size_t width, size_t height, GLsizei levels);
+
+		// Copies a rectangle of texels into a mip level. 'row_length' is the
+		// distance, in texels, from one row of 'data' to the next, so that part
+		// of a larger image can be sent without copying it out first.
+		void upload(GLint level, size_t x, size_t y, size_t width, size_t height, void const* data, size_t count, size_t row_length);
+
+	public:
+
+		TextureStorage(TextureStorage&) = delete;
+		~TextureStorage();
+
+		// Copies a rectangle of texels into a mip level from the buffer bound to
+		// GL_PIXEL_UNPACK_BUFFER, starting 'offset' bytes in, with tightly
+		// packed rows
+		void unpack(GLint level, size_t x, size_t y, size_t width, size_t height, size_t offset);
+		// Copies already-compressed blocks into a mip level. Only valid for
+		// textures created with a compressed internal format.
+		void upload_compressed(GLint level, size_t x, size_t y, size_t width, size_t height, void const* data, size_t size);
+
+		// Rebuilds every level past zero from level zero
+		void generate_mipmaps();
+		// Limits sampling to the levels from 'level' down, so that a texture
+		// can be used before its larger levels have been filled
+		void set_base_level(GLint level);
+		void set_filter(GLenum min, GLenum mag);
+		void set_wrap(GLenum s, GLenum t);
+
+		size_t width() const;
+		size_t height() const;
+		GLsizei level_count() const;
+		operator GLuint();
+
+		// How many levels a full mip chain for a texture of this size has
+		static GLsizei full_mip_count(size_t width, size_t height);
+
+	};
+
+
+	template<typename FORMAT>
+	class Texture2D : public TextureStorage {
+
+	public:
+
+		// Allocates storage without filling it. A 'levels' of zero allocates
+		// the full mip chain.
+		Texture2D(size_t width, size_t height, GLsizei levels = 1)
+			: TextureStorage(FORMAT::internal, FORMAT::layout, FORMAT::type, sizeof(FORMAT), width, height, levels)
+		{}
+
+		// Allocates storage and fills level zero, building the remaining levels
+		// from it if 'mipmap' is set. The texels are read in place, not copied.
+		Texture2D(std::span<FORMAT const> texels, size_t width, size_t height, bool mipmap)
+			: TextureStorage(FORMAT::internal, FORMAT::layout, FORMAT::type, sizeof(FORMAT), width, height, mipmap ? 0 : 1)
+		{
+			update(texels, 0, 0, width, height);
+			if (mipmap) {
+				generate_mipmaps();
+			}
+		}
+
+		// Replaces a rectangle of a mip level. A 'row_length' of zero means the
+		// rows of 'texels' are 'width' texels apart.
+		void update(std::span<FORMAT const> texels, size_t x, size_t y, size_t width, size_t height, GLint level = 0, size_t row_length = 0) {
+			upload(level, x, y, width, height, texels.data(), texels.size(), (row_length == 0) ? width : row_length);
+		}
+
+	};
+
+
+	class Texture : public TextureStorage {
 
 	public:
 
@@ -18,10 +173,7 @@ namespace glazy {
 			unsigned char b;
 		};
 
-		Texture(std::vector<RGB8> data, size_t width, size_t height, bool mipmap);
-		Texture(Texture&) = delete;
-		~Texture();
-		operator GLuint();
+		Texture(std::span<RGB8 const> data, size_t width, size_t height, bool mipmap);
 
 	};
 
@@ -42,4 +194,3 @@ namespace glazy {
 
 
 #endif
-
@@ -0,0 +1,138 @@
+
+
+#ifndef GLAZY_UPLOAD
+#define GLAZY_UPLOAD
+
+#include "glazy_buffer.h"
+#include "glazy_texture.h"
+#include <memory>
+#include <thread>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+
+
+namespace glazy {
+
+	// A resource created on another context, along with the fence that marks the
+	// end of the commands that filled it. The resource must not be used until
+	// 'acquire' has been called on the thread that will use it.
+	template<typename R>
+	class Published {
+
+		std::shared_ptr<R> resource;
+		GLsync fence;
+
+	public:
+
+		Published(std::shared_ptr<R> resource, GLsync fence)
+			: resource(std::move(resource))
+			, fence(fence)
+		{}
+
+		Published(Published&& other)
+			: resource(std::move(other.resource))
+			, fence(other.fence)
+		{
+			other.fence = nullptr;
+		}
+
+		Published& operator=(Published&& other) {
+			std::swap(resource, other.resource);
+			std::swap(fence, other.fence);
+			return *this;
+		}
+
+		Published(Published&) = delete;
+
+		~Published() {
+			if (fence != nullptr) {
+				glDeleteSync(fence);
+			}
+		}
+
+		// Makes the current context wait for the upload before any command issued
+		// after this call. The wait happens on the GPU, so the calling thread does
+		// not block.
+		std::shared_ptr<R> acquire() {
+			safety::entry_guard("Published::acquire");
+			if (fence != nullptr) {
+				glWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+				glDeleteSync(fence);
+				fence = nullptr;
+			}
+			safety::exit_guard("Published::acquire");
+			return resource;
+		}
+
+	};
+
+
+	// Runs uploads on a worker thread, using a hidden context that shares objects
+	// with the render context. Each upload returns a future that becomes ready
+	// once the upload's commands have been submitted, so the render thread can
+	// keep drawing with the old resource until then.
+	class UploadService {
+
+		GLFWwindow* window;
+		std::thread worker;
+		mutable std::mutex mutex;
+		std::condition_variable wake;
+		std::deque<std::function<void()>> jobs;
+		size_t in_flight;
+		bool stopping;
+
+		void run();
+		void enqueue(std::function<void()> job);
+
+	public:
+
+		// Must be called on the main thread, as GLFW only creates windows there
+		UploadService(GLFWwindow* render_window);
+		UploadService(UploadService&) = delete;
+		// Finishes every queued upload before returning
+		~UploadService();
+
+		// Runs 'make' on the worker, then fences and flushes the worker's context
+		// so that the fence can be waited on from the render context.
+		template<typename R>
+		std::future<Published<R>> submit(std::function<std::shared_ptr<R>()> make) {
+			auto promise = std::make_shared<std::promise<Published<R>>>();
+			std::future<Published<R>> result = promise->get_future();
+			enqueue([promise, make]() {
+				try {
+					std::shared_ptr<R> resource = make();
+					GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+					// Another context may only wait on a fence that has reached the GPU
+					glFlush();
+					promise->set_value(Published<R>(std::move(resource), fence));
+				}
+				catch (...) {
+					promise->set_exception(std::current_exception());
+				}
+			});
+			return result;
+		}
+
+		template<typename T>
+		std::future<Published<Buffer<T>>> upload_buffer(std::vector<T> data, GLenum usage) {
+			auto shared_data = std::make_shared<std::vector<T>>(std::move(data));
+			return submit<Buffer<T>>([shared_data, usage]() {
+				auto buffer = std::make_shared<Buffer<T>>();
+				buffer->set_data(*shared_data, usage);
+				return buffer;
+			});
+		}
+
+		std::future<Published<Texture>> upload_texture(std::vector<Texture::RGB8> data, size_t width, size_t height, bool mipmap);
+
+		// Uploads queued or running
+		size_t pending() const;
+
+	};
+
+}
+
+#endif
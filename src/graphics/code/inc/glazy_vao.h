@@ -4,13 +4,115 @@
 #define GLAZY_VAO
 
 #include "glazy_buffer.h"
+#include "glazy_state.h"
+#include <tuple>
+#include <array>
+#include <cstddef>
 
 namespace glazy {
 
+	namespace layout {
+
+		// How a single attribute location reads from a vertex
+		struct Format {
+			GLuint location;
+			GLint  size;
+			GLenum type;
+			bool   normalized;
+			size_t offset;
+		};
+
+		// One member of an interleaved vertex struct, sourced by the attribute
+		// at 'location'. The member's type and component count are derived
+		// from the pointer-to-member, and its offset is given alongside it, as
+		// GLAZY_VERTEX_FIELD does. Matrix members take up one location per
+		// column, starting at 'location'.
+		template<auto MEMBER, size_t OFFSET, bool NORMALIZED = false>
+		struct Field {
+			using vertex_type = typename type::member_traits<decltype(MEMBER)>::class_type;
+			using value_type = typename type::member_traits<decltype(MEMBER)>::member_type;
+
+			static GLenum const gl_type = type::type_mapping<value_type>::value;
+			static GLint const components = type::vec_length<value_type>::value;
+			static GLint const columns = type::column_count<value_type>::value;
+			static bool const normalized = NORMALIZED;
+			static constexpr size_t offset = OFFSET;
+
+			static_assert(OFFSET + sizeof(value_type) <= sizeof(vertex_type), "Vertex field lies past the end of its struct.");
+
+			GLuint location;
+
+			// Writes the format of each column into 'out', returning the next free slot
+			constexpr Format* write_formats(Format* out) const {
+				size_t column_size = sizeof(value_type) / columns;
+				for (GLint column = 0; column < columns; column++) {
+					*out++ = Format{ location + column, components, gl_type, normalized, offset + column * column_size };
+				}
+				return out;
+			}
+		};
+
+		// The complete set of fields of a vertex struct that a program reads
+		template<typename... FIELDS>
+		struct VertexLayout {
+			using vertex_type = typename std::tuple_element<0, std::tuple<FIELDS...>>::type::vertex_type;
+
+			static_assert(
+				(std::is_same<vertex_type, typename FIELDS::vertex_type>::value && ...),
+				"All fields of a vertex layout must be members of the same struct."
+			);
+
+			std::tuple<FIELDS...> fields;
+
+			static size_t const format_count = (FIELDS::columns + ...);
+
+			constexpr std::array<Format, format_count> formats() const {
+				std::array<Format, format_count> result = {};
+				Format* out = result.data();
+				std::apply([&](FIELDS const&... field) {
+					((out = field.write_formats(out)), ...);
+				}, fields);
+				return result;
+			}
+		};
+
+		template<typename... FIELDS>
+		constexpr VertexLayout<FIELDS...> of(FIELDS... fields) {
+			return VertexLayout<FIELDS...>{ std::tuple<FIELDS...>(fields...) };
+		}
+
+	}
+
+	// The layout field of a member of a vertex struct, with its offset taken by
+	// offsetof, so that the whole layout is known at compile time. A third
+	// argument of true reads the member as normalized. For example:
+	//
+	//     glazy::layout::of(
+	//         GLAZY_VERTEX_FIELD(Vertex, position){ 0 },
+	//         GLAZY_VERTEX_FIELD(Vertex, color, true){ 1 }
+	//     )
+	#define GLAZY_VERTEX_FIELD(STRUCT, MEMBER, ...) \
+		::glazy::layout::Field<&STRUCT::MEMBER, offsetof(STRUCT, MEMBER) __VA_OPT__(,) __VA_ARGS__>
+
 	class SharedVAO;
 
 	class VAO {
 		GLuint id;
+		// A buffer that interleaved layouts read from under direct state
+		// access, along with how many attribute locations read from it
+		struct LayoutSource {
+			GLuint  buffer;
+			GLsizei stride;
+			size_t  uses;
+		};
+		// Source i has the vertex buffer binding 'layout_binding() - i'
+		std::vector<LayoutSource> layout_sources;
+		// The layout source of each attribute location, or -1 for none
+		std::vector<int> attribute_sources;
+		// The highest location sourced as a lone attribute, or -1 for none
+		GLint highest_lone_attribute;
+		// Stops the location from counting as a use of its layout source
+		void release_layout_source(GLuint location);
 	public:
 
 		VAO();
@@ -18,12 +120,16 @@ namespace glazy {
 		~VAO();
 		operator GLuint() const;
 
+		// Binds a VAO for the guard's lifetime. Nested guards restore the binding
+		// of the guard enclosing them, while the outermost guard leaves its VAO
+		// bound for whatever draws next.
 		class BindGuard {
-			static std::stack<GLuint> bind_stack;
-			VAO& vao;
+			GLuint previous;
+			bool   nested;
 		public:
 			BindGuard(VAO& vao);
 			BindGuard(SharedVAO& svao);
+			BindGuard(BindGuard&) = delete;
 			~BindGuard();
 		};
 
@@ -39,25 +145,14 @@ namespace glazy {
 			Attribute& enable();
 			Attribute& disable();
 
+			// Sources this attribute from 'buffer', reading 'size' components of
+			// 'type' from each element, 'stride' bytes apart starting at 'offset'.
+			void set_pointer(GLuint buffer, GLint size, GLenum type, bool normalized, GLsizei stride, size_t offset);
+
 			template<typename T>
 			Attribute& operator=(Buffer<T>& other) {
 				safety::entry_guard("AttributeAccessor::operator=");
-				{
-					BindGuard bind_guard(vao);
-					ArrayBindGuard<T> array_guard(other);
-					GLenum typing = type::type_mapping<T>::value;
-					std::string error_message = "Invalid attribute type ";
-					switch (typing) {
-					case GL_BYTE: case GL_UNSIGNED_BYTE: case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_INT: case GL_UNSIGNED_INT:
-						glVertexAttribIPointer(index, type::vec_length<T>::value, typing, 0, nullptr);
-						break;
-					case GL_HALF_FLOAT: case GL_FLOAT: case GL_DOUBLE:
-						glVertexAttribPointer(index, type::vec_length<T>::value, typing, false, 0, nullptr);
-						break;
-					default:
-						throw std::runtime_error(error_message + std::to_string(typing));
-					}
-				}
+				set_pointer(other, type::vec_length<T>::value, type::type_mapping<T>::value, false, sizeof(T), 0);
 				safety::exit_guard("AttributeAccessor::operator=");
 				return *this;
 			}
@@ -67,6 +162,32 @@ namespace glazy {
 
 		Attribute operator[] (size_t index);
 
+		// Enables and sources the attributes described by 'formats' from a single
+		// buffer of interleaved vertices that are 'stride' bytes apart. With direct
+		// state access, each distinct buffer and stride gets a binding of its own,
+		// counting down from 'layout_binding', so a VAO may read per-vertex and
+		// per-instance layouts from separate buffers.
+		void set_vertices(GLuint buffer, GLsizei stride, layout::Format const* formats, size_t count);
+
+		// The first vertex buffer binding that interleaved layouts use under
+		// direct state access: the last one the context has. Lone attributes use
+		// the binding of their own location, so a VAO throws if a lone attribute
+		// and a layout would ever share a binding.
+		static GLuint layout_binding();
+
+		// Makes 'indices' the source of indices for indexed draws with this VAO
+		void set_indices(GLuint indices);
+
+		template<typename V, typename... FIELDS>
+		void set_vertices(Buffer<V>& buffer, layout::VertexLayout<FIELDS...> const& layout) {
+			static_assert(
+				std::is_same<V, typename layout::VertexLayout<FIELDS...>::vertex_type>::value,
+				"Vertex layout does not describe the buffer's element type."
+			);
+			auto formats = layout.formats();
+			set_vertices(buffer, sizeof(V), formats.data(), formats.size());
+		}
+
 
 	};
 
@@ -82,10 +203,25 @@ namespace glazy {
 		operator GLuint();
 		operator VAO& ();
 		VAO::Attribute operator[] (size_t index);
+		void set_indices(GLuint indices);
 
 	};
 
 
+	namespace draw {
+
+		// Draws 'count' indices starting at index 'first' from the index buffer of
+		// the currently bound VAO, which must be 'indices'. A count of zero means
+		// everything from 'first' onward.
+		void elements(GLenum mode, IndexBuffer const& indices, size_t count = 0, size_t first = 0);
+
+		// As above, but with 'base_vertex' added to every index, so that several
+		// meshes may share one vertex buffer and one index buffer.
+		void elements_base_vertex(GLenum mode, IndexBuffer const& indices, GLint base_vertex, size_t count = 0, size_t first = 0);
+
+	}
+
+
 }
 
 #endif
@@ -4,6 +4,9 @@
 
 #include <glm/glm.hpp>
 #include <vector>
+#include <cstdint>
+#include <map>
+#include <cstring>
 
 namespace glazy {
 
@@ -14,6 +17,48 @@ namespace glazy {
 		std::vector<glm::vec3> box(float w, float h, float d);
 		std::vector<glm::vec3> sphere(size_t wedges, size_t layers, float radius);
 
+
+		// A mesh where each distinct vertex is stored once, and triangles refer
+		// to vertices by index.
+		template<typename T>
+		struct Indexed {
+			std::vector<T> vertices;
+			std::vector<std::uint32_t> indices;
+		};
+
+		// Merges identical vertices of an unindexed triangle list
+		template<typename T>
+		Indexed<T> deduplicate(std::vector<T> const& triangles) {
+			struct Less {
+				bool operator()(T const& a, T const& b) const {
+					return std::memcmp(&a, &b, sizeof(T)) < 0;
+				}
+			};
+			Indexed<T> result;
+			std::map<T, std::uint32_t, Less> seen;
+			result.indices.reserve(triangles.size());
+			for (T const& vertex : triangles) {
+				auto [iter, inserted] = seen.try_emplace(vertex, static_cast<std::uint32_t>(result.vertices.size()));
+				if (inserted) {
+					result.vertices.push_back(vertex);
+				}
+				result.indices.push_back(iter->second);
+			}
+			return result;
+		}
+
+		// Triangle indices for a (w+1) by (h+1) grid of vertices stored in
+		// column-major order, in the same winding as uv_grid and sphere.
+		std::vector<std::uint32_t> grid_indices(size_t w, size_t h);
+
+		// Indexed counterparts to the shapes above. The vertices of indexed_sphere
+		// and indexed_uv_grid are laid out identically, so a sphere and the uv grid
+		// of the same dimensions can share a single index buffer.
+		Indexed<glm::vec2> indexed_uv_grid(size_t w, size_t h);
+		Indexed<glm::vec3> indexed_quad();
+		Indexed<glm::vec3> indexed_box(float w, float h, float d);
+		Indexed<glm::vec3> indexed_sphere(size_t wedges, size_t layers, float radius);
+
 	}
 
 }
@@ -0,0 +1,105 @@
+
+#include "glazy_arena.h"
+#include <iterator>
+
+namespace glazy {
+
+	RangeAllocator::RangeAllocator(size_t capacity)
+		: total(capacity)
+		, used_total(0)
+	{
+		if (capacity != 0) {
+			free_ranges[0] = capacity;
+		}
+	}
+
+	size_t RangeAllocator::allocate(size_t length) {
+		if (length == 0) {
+			return 0;
+		}
+		for (auto iter = free_ranges.begin(); iter != free_ranges.end(); iter++) {
+			if (iter->second < length) {
+				continue;
+			}
+			size_t offset = iter->first;
+			size_t remainder = iter->second - length;
+			free_ranges.erase(iter);
+			if (remainder != 0) {
+				free_ranges[offset + length] = remainder;
+			}
+			used_total += length;
+			return offset;
+		}
+		return npos;
+	}
+
+	void RangeAllocator::release(size_t offset, size_t length) {
+		if (length == 0) {
+			return;
+		}
+		used_total -= length;
+		auto next = free_ranges.lower_bound(offset);
+		// Merge with the free range that follows, if they touch
+		if ((next != free_ranges.end()) && (next->first == (offset + length))) {
+			length += next->second;
+			next = free_ranges.erase(next);
+		}
+		// Merge with the free range that precedes, if they touch
+		if (next != free_ranges.begin()) {
+			auto prev = std::prev(next);
+			if ((prev->first + prev->second) == offset) {
+				prev->second += length;
+				return;
+			}
+		}
+		free_ranges[offset] = length;
+	}
+
+	void RangeAllocator::grow(size_t new_capacity) {
+		if (new_capacity <= total) {
+			return;
+		}
+		size_t added = new_capacity - total;
+		size_t old_total = total;
+		total = new_capacity;
+		used_total += added;
+		release(old_total, added);
+	}
+
+	void RangeAllocator::reset(size_t used) {
+		free_ranges.clear();
+		used_total = used;
+		if (used < total) {
+			free_ranges[used] = total - used;
+		}
+	}
+
+	size_t RangeAllocator::capacity() const {
+		return total;
+	}
+
+	size_t RangeAllocator::used() const {
+		return used_total;
+	}
+
+	size_t RangeAllocator::largest_free() const {
+		size_t result = 0;
+		for (auto const& range : free_ranges) {
+			result = std::max(result, range.second);
+		}
+		return result;
+	}
+
+	size_t RangeAllocator::free_block_count() const {
+		return free_ranges.size();
+	}
+
+	float RangeAllocator::fragmentation() const {
+		size_t free_total = total - used_total;
+		if (free_total == 0) {
+			return 0.0f;
+		}
+		return 1.0f - static_cast<float>(largest_free()) / free_total;
+	}
+
+}
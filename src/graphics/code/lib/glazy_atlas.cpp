@@ -0,0 +1,459 @@
+
+#include "glazy_atlas.h"
+#include "glazy_objects.h"
+#include <algorithm>
+#include <numeric>
+#include <climits>
+
+namespace glazy {
+
+	namespace pack {
+
+		Skyline::Skyline(int width, int height)
+			: bin_width(width)
+			, bin_height(height)
+			, used(0)
+			, segments{ { 0, 0, width } }
+		{}
+
+		int Skyline::fit(size_t index, int width, int height) const {
+			if (segments[index].x + width > bin_width) {
+				return -1;
+			}
+			int y = 0;
+			int remaining = width;
+			for (size_t i = index; remaining > 0; i++) {
+				y = std::max(y, segments[i].y);
+				if (y + height > bin_height) {
+					return -1;
+				}
+				remaining -= segments[i].width;
+			}
+			return y;
+		}
+
+		std::optional<Rect> Skyline::insert(int width, int height) {
+			size_t best_index = segments.size();
+			int best_top = bin_height + 1;
+			int best_width = bin_width + 1;
+			Rect result = { 0, 0, width, height };
+			for (size_t index = 0; index < segments.size(); index++) {
+				int y = fit(index, width, height);
+				if (y < 0) {
+					continue;
+				}
+				// Lowest top edge first, then the narrowest segment, which wastes
+				// the least of the outline
+				if ((y + height < best_top) || ((y + height == best_top) && (segments[index].width < best_width))) {
+					best_index = index;
+					best_top = y + height;
+					best_width = segments[index].width;
+					result.x = segments[index].x;
+					result.y = y;
+				}
+			}
+			if (best_index == segments.size()) {
+				return std::nullopt;
+			}
+
+			segments.insert(segments.begin() + best_index, { result.x, result.y + height, width });
+			// Trim or remove the segments the new one now covers
+			for (size_t i = best_index + 1; i < segments.size(); ) {
+				Segment& previous = segments[i - 1];
+				Segment& current = segments[i];
+				int overlap = previous.x + previous.width - current.x;
+				if (overlap <= 0) {
+					break;
+				}
+				if (overlap >= current.width) {
+					segments.erase(segments.begin() + i);
+					continue;
+				}
+				current.x += overlap;
+				current.width -= overlap;
+				break;
+			}
+			// Merge neighbours at the same height
+			for (size_t i = 1; i < segments.size(); ) {
+				if (segments[i - 1].y == segments[i].y) {
+					segments[i - 1].width += segments[i].width;
+					segments.erase(segments.begin() + i);
+				}
+				else {
+					i++;
+				}
+			}
+			used += size_t(width) * height;
+			return result;
+		}
+
+		int Skyline::width() const {
+			return bin_width;
+		}
+
+		int Skyline::height() const {
+			return bin_height;
+		}
+
+		double Skyline::occupancy() const {
+			return double(used) / (double(bin_width) * bin_height);
+		}
+
+
+		MaxRects::MaxRects(int width, int height)
+			: bin_width(width)
+			, bin_height(height)
+			, used(0)
+			, free{ { 0, 0, width, height } }
+		{}
+
+		std::optional<Rect> MaxRects::insert(int width, int height) {
+			// Best short side fit, with the long side breaking ties
+			int best_short = INT_MAX;
+			int best_long = INT_MAX;
+			std::optional<Rect> result;
+			for (Rect const& space : free) {
+				if ((space.width < width) || (space.height < height)) {
+					continue;
+				}
+				int leftover_x = space.width - width;
+				int leftover_y = space.height - height;
+				int short_side = std::min(leftover_x, leftover_y);
+				int long_side = std::max(leftover_x, leftover_y);
+				if ((short_side < best_short) || ((short_side == best_short) && (long_side < best_long))) {
+					best_short = short_side;
+					best_long = long_side;
+					result = Rect{ space.x, space.y, width, height };
+				}
+			}
+			if (result) {
+				split(*result);
+				used += size_t(width) * height;
+			}
+			return result;
+		}
+
+		void MaxRects::split(Rect const& placed) {
+			std::vector<Rect> pieces;
+			for (size_t i = 0; i < free.size(); ) {
+				Rect space = free[i];
+				bool overlaps = (placed.x < space.x + space.width) && (placed.x + placed.width > space.x)
+					&& (placed.y < space.y + space.height) && (placed.y + placed.height > space.y);
+				if (!overlaps) {
+					i++;
+					continue;
+				}
+				// The parts of the free rectangle on each side of the placed one
+				if (placed.x > space.x) {
+					pieces.push_back({ space.x, space.y, placed.x - space.x, space.height });
+				}
+				if (placed.x + placed.width < space.x + space.width) {
+					int x = placed.x + placed.width;
+					pieces.push_back({ x, space.y, space.x + space.width - x, space.height });
+				}
+				if (placed.y > space.y) {
+					pieces.push_back({ space.x, space.y, space.width, placed.y - space.y });
+				}
+				if (placed.y + placed.height < space.y + space.height) {
+					int y = placed.y + placed.height;
+					pieces.push_back({ space.x, y, space.width, space.y + space.height - y });
+				}
+				free[i] = free.back();
+				free.pop_back();
+			}
+			prune(pieces);
+		}
+
+		void MaxRects::prune(std::vector<Rect>& pieces) {
+			auto contains = [](Rect const& outer, Rect const& inner) {
+				return (inner.x >= outer.x) && (inner.y >= outer.y)
+					&& (inner.x + inner.width <= outer.x + outer.width)
+					&& (inner.y + inner.height <= outer.y + outer.height);
+			};
+			// The untouched free rectangles were already maximal with respect to
+			// one another, so only comparisons involving a new piece are needed
+			for (size_t i = 0; i < pieces.size(); ) {
+				bool redundant = false;
+				for (Rect const& space : free) {
+					if (contains(space, pieces[i])) {
+						redundant = true;
+						break;
+					}
+				}
+				for (size_t j = 0; !redundant && (j < pieces.size()); j++) {
+					// Of two identical pieces, only the later one is kept
+					redundant = (j != i) && contains(pieces[j], pieces[i])
+						&& ((j > i) || !contains(pieces[i], pieces[j]));
+				}
+				if (redundant) {
+					pieces[i] = pieces.back();
+					pieces.pop_back();
+				}
+				else {
+					i++;
+				}
+			}
+			for (size_t i = 0; i < free.size(); ) {
+				bool redundant = false;
+				for (Rect const& piece : pieces) {
+					if (contains(piece, free[i])) {
+						redundant = true;
+						break;
+					}
+				}
+				if (redundant) {
+					free[i] = free.back();
+					free.pop_back();
+				}
+				else {
+					i++;
+				}
+			}
+			free.insert(free.end(), pieces.begin(), pieces.end());
+		}
+
+		int MaxRects::width() const {
+			return bin_width;
+		}
+
+		int MaxRects::height() const {
+			return bin_height;
+		}
+
+		double MaxRects::occupancy() const {
+			return double(used) / (double(bin_width) * bin_height);
+		}
+
+	}
+
+
+	TextureAtlas::TextureAtlas()
+		: dimensions(0, 0)
+	{}
+
+	size_t TextureAtlas::add(Image image) {
+		if (texture) {
+			throw std::runtime_error("Cannot add images to an atlas that has been built.");
+		}
+		if (image.pixels.size() != image.width * image.height) {
+			throw std::runtime_error("Atlas image has " + std::to_string(image.pixels.size()) + " pixels, but is "
+				+ std::to_string(image.width) + "x" + std::to_string(image.height) + ".");
+		}
+		images.push_back(std::move(image));
+		return images.size() - 1;
+	}
+
+	bool TextureAtlas::pack(glm::ivec2 size, AtlasOptions const& options) {
+		// Large images first, as they are the hardest to place
+		std::vector<size_t> order(images.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+			size_t a_side = std::max(images[a].width, images[a].height);
+			size_t b_side = std::max(images[b].width, images[b].height);
+			if (a_side != b_side) {
+				return a_side > b_side;
+			}
+			return images[a].width * images[a].height > images[b].width * images[b].height;
+		});
+
+		pack::Skyline skyline(size.x, size.y);
+		pack::MaxRects max_rects(size.x, size.y);
+		rects.assign(images.size(), { 0, 0, 0, 0 });
+		int border = 2 * options.padding;
+		for (size_t index : order) {
+			int width = int(images[index].width) + border;
+			int height = int(images[index].height) + border;
+			std::optional<pack::Rect> placed = (options.packer == AtlasOptions::skyline)
+				? skyline.insert(width, height)
+				: max_rects.insert(width, height);
+			if (!placed) {
+				return false;
+			}
+			rects[index] = {
+				placed->x + options.padding,
+				placed->y + options.padding,
+				int(images[index].width),
+				int(images[index].height)
+			};
+		}
+		return true;
+	}
+
+	void TextureAtlas::build(AtlasOptions options) {
+		safety::entry_guard("TextureAtlas::build");
+		if (images.empty()) {
+			throw std::runtime_error("Cannot build an atlas with no images.");
+		}
+		// Start from the smallest square that could hold every image
+		size_t area = 0;
+		int widest = 0;
+		int tallest = 0;
+		for (Image const& image : images) {
+			int width = int(image.width) + 2 * options.padding;
+			int height = int(image.height) + 2 * options.padding;
+			area += size_t(width) * height;
+			widest = std::max(widest, width);
+			tallest = std::max(tallest, height);
+		}
+		glm::ivec2 size(1, 1);
+		while ((size.x < widest) || (size_t(size.x) * size.x < area)) {
+			size.x *= 2;
+		}
+		size.y = size.x;
+		while (size.y < tallest) {
+			size.y *= 2;
+		}
+		// Grow one side at a time until everything fits
+		while (!pack(size, options)) {
+			if (size.x <= size.y) {
+				size.x *= 2;
+			}
+			else {
+				size.y *= 2;
+			}
+			if ((size.x > options.max_size) || (size.y > options.max_size)) {
+				throw std::runtime_error("Atlas images do not fit within " + std::to_string(options.max_size)
+					+ "x" + std::to_string(options.max_size) + " texels.");
+			}
+		}
+
+		std::vector<Texture::RGB8> texels(size_t(size.x) * size.y, { 0, 0, 0 });
+		int padding = options.padding;
+		for (size_t index = 0; index < images.size(); index++) {
+			Image const& image = images[index];
+			pack::Rect const& rect = rects[index];
+			int width = int(image.width);
+			int height = int(image.height);
+			// Copies the image along with its gutter, which repeats the image's
+			// edge texels outward
+			for (int y = -padding; y < height + padding; y++) {
+				int source_y = std::clamp(y, 0, height - 1);
+				Texture::RGB8* row = texels.data() + size_t(rect.y + y) * size.x + rect.x;
+				Texture::RGB8 const* source_row = image.pixels.data() + size_t(source_y) * width;
+				for (int x = -padding; x < width + padding; x++) {
+					row[x] = source_row[std::clamp(x, 0, width - 1)];
+				}
+			}
+		}
+
+		dimensions = size;
+		texture = std::make_unique<Texture>(std::move(texels), size.x, size.y, options.mipmap);
+		images.clear();
+		images.shrink_to_fit();
+		safety::exit_guard("TextureAtlas::build");
+	}
+
+	pack::Rect TextureAtlas::rect(size_t index) const {
+		return rects.at(index);
+	}
+
+	TextureAtlas::UVRect TextureAtlas::uv(size_t index) const {
+		pack::Rect const& area = rects.at(index);
+		glm::vec2 size(dimensions);
+		return {
+			glm::vec2(area.x, area.y) / size,
+			glm::vec2(area.width, area.height) / size
+		};
+	}
+
+	glm::ivec2 TextureAtlas::size() const {
+		return dimensions;
+	}
+
+	Texture& TextureAtlas::get_texture() {
+		if (!texture) {
+			throw std::runtime_error("Atlas has not been built.");
+		}
+		return *texture;
+	}
+
+
+	TextureArray::TextureArray(size_t width, size_t height, size_t layers, bool mipmap)
+		: width(width)
+		, height(height)
+		, layers(layers)
+		, mipmap(mipmap)
+	{
+		safety::entry_guard("TextureArray::TextureArray");
+		// Pooled names are created as 2D textures under direct state access, so
+		// arrays get names of their own
+		glGenTextures(1, &id);
+		if (id == 0) {
+			throw std::runtime_error("Failed to allocate texture id.");
+		}
+		StateCache& cache = StateCache::current();
+		GLuint old = cache.bound_texture(GL_TEXTURE_2D_ARRAY);
+		cache.bind_texture(GL_TEXTURE_2D_ARRAY, id);
+		if (context::capabilities().texture_storage) {
+			GLsizei levels = mipmap ? TextureStorage::full_mip_count(width, height) : 1;
+			glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGB8, width, height, layers);
+		}
+		else {
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, width, height, layers, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+		}
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, mipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		cache.bind_texture(GL_TEXTURE_2D_ARRAY, old);
+		safety::exit_guard("TextureArray::TextureArray");
+	}
+
+	TextureArray::TextureArray(std::vector<Image> const& images, bool mipmap)
+		: TextureArray(
+			images.empty() ? 0 : images[0].width,
+			images.empty() ? 0 : images[0].height,
+			images.size(),
+			mipmap
+		)
+	{
+		for (size_t layer = 0; layer < images.size(); layer++) {
+			set_layer(layer, images[layer]);
+		}
+		if (mipmap) {
+			generate_mipmaps();
+		}
+	}
+
+	TextureArray::~TextureArray() {
+		ContextObjects::current().deletions.defer(DeletionQueue::Kind::texture, id);
+	}
+
+	void TextureArray::set_layer(size_t layer, Image const& image) {
+		safety::entry_guard("TextureArray::set_layer");
+		if ((image.width != width) || (image.height != height)) {
+			throw std::runtime_error("Layer image is " + std::to_string(image.width) + "x" + std::to_string(image.height)
+				+ ", but the array's layers are " + std::to_string(width) + "x" + std::to_string(height) + ".");
+		}
+		if (layer >= layers) {
+			throw std::runtime_error("Layer " + std::to_string(layer) + " is past the end of the texture array.");
+		}
+		StateCache& cache = StateCache::current();
+		GLuint old = cache.bound_texture(GL_TEXTURE_2D_ARRAY);
+		cache.bind_texture(GL_TEXTURE_2D_ARRAY, id);
+		cache.pixel_store(GL_UNPACK_ALIGNMENT, 1);
+		cache.pixel_store(GL_UNPACK_ROW_LENGTH, 0);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1, GL_RGB, GL_UNSIGNED_BYTE, image.pixels.data());
+		cache.bind_texture(GL_TEXTURE_2D_ARRAY, old);
+		safety::exit_guard("TextureArray::set_layer");
+	}
+
+	void TextureArray::generate_mipmaps() {
+		safety::entry_guard("TextureArray::generate_mipmaps");
+		StateCache& cache = StateCache::current();
+		GLuint old = cache.bound_texture(GL_TEXTURE_2D_ARRAY);
+		cache.bind_texture(GL_TEXTURE_2D_ARRAY, id);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		cache.bind_texture(GL_TEXTURE_2D_ARRAY, old);
+		safety::exit_guard("TextureArray::generate_mipmaps");
+	}
+
+	size_t TextureArray::layer_count() const {
+		return layers;
+	}
+
+	TextureArray::operator GLuint() {
+		return id;
+	}
+
+}
@@ -0,0 +1,452 @@
+
+#include "glazy_bake.h"
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace glazy {
+
+	namespace bake {
+
+		static char const magic[4] = { 'G', 'L', 'Z', 'T' };
+		static uint32_t const version = 1;
+		static size_t const payload_alignment = 16;
+
+		GLenum internal_format(Format format) {
+			switch (format) {
+				case Format::rgba8:    return GL_RGBA8;
+				case Format::srgb8_a8: return GL_SRGB8_ALPHA8;
+				case Format::bc1:      return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+				case Format::bc1_srgb: return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+				case Format::bc3:      return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+				case Format::bc3_srgb: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+			}
+			throw std::runtime_error("Unknown baked texture format " + std::to_string(uint32_t(format)) + ".");
+		}
+
+		size_t block_size(Format format) {
+			switch (format) {
+				case Format::bc1:
+				case Format::bc1_srgb:
+					return 8;
+				case Format::bc3:
+				case Format::bc3_srgb:
+					return 16;
+				default:
+					return 0;
+			}
+		}
+
+		bool is_srgb(Format format) {
+			return (format == Format::srgb8_a8) || (format == Format::bc1_srgb) || (format == Format::bc3_srgb);
+		}
+
+		Format parse_format(std::string const& name) {
+			std::pair<char const*, Format> const names[] = {
+				{ "rgba8",    Format::rgba8 },
+				{ "srgb8_a8", Format::srgb8_a8 },
+				{ "bc1",      Format::bc1 },
+				{ "bc1_srgb", Format::bc1_srgb },
+				{ "bc3",      Format::bc3 },
+				{ "bc3_srgb", Format::bc3_srgb },
+			};
+			for (auto const& entry : names) {
+				if (name == entry.first) {
+					return entry.second;
+				}
+			}
+			throw std::runtime_error("Unknown baked texture format '" + name + "'.");
+		}
+
+		// The size in bytes of one level of a baked file
+		static size_t level_size(Format kind, size_t width, size_t height) {
+			size_t block = block_size(kind);
+			if (block == 0) {
+				return width * height * sizeof(format::RGBA8);
+			}
+			return ((width + 3) / 4) * ((height + 3) / 4) * block;
+		}
+
+
+		std::vector<std::vector<format::RGBA8>> mip_chain(std::vector<format::RGBA8> level, size_t width, size_t height, mip::Options const& options) {
+			return mip::chain(std::move(level), width, height, options);
+		}
+
+
+		// Gathers the 4x4 block whose top-left texel is (x, y)
+		static void read_block(std::span<format::RGBA8 const> texels, size_t width, size_t height, size_t x, size_t y, format::RGBA8 block[16]) {
+			for (size_t row = 0; row < 4; row++) {
+				size_t source_y = std::min(y + row, height - 1);
+				for (size_t column = 0; column < 4; column++) {
+					size_t source_x = std::min(x + column, width - 1);
+					block[row * 4 + column] = texels[source_y * width + source_x];
+				}
+			}
+		}
+
+		static uint16_t pack_565(int r, int g, int b) {
+			return uint16_t((((r * 31 + 127) / 255) << 11) | (((g * 63 + 127) / 255) << 5) | ((b * 31 + 127) / 255));
+		}
+
+		static void unpack_565(uint16_t color, int rgb[3]) {
+			int r = (color >> 11) & 31;
+			int g = (color >> 5) & 63;
+			int b = color & 31;
+			rgb[0] = (r << 3) | (r >> 2);
+			rgb[1] = (g << 2) | (g >> 4);
+			rgb[2] = (b << 3) | (b >> 2);
+		}
+
+		// Writes the 8-byte colour half of a block. Endpoints are the corners of
+		// the block's colour bounding box, pulled inward by a sixteenth of its
+		// size, which keeps outliers from stretching the palette.
+		static void encode_color_block(format::RGBA8 const block[16], unsigned char* out) {
+			int low[3] = { 255, 255, 255 };
+			int high[3] = { 0, 0, 0 };
+			for (size_t i = 0; i < 16; i++) {
+				int channels[3] = { block[i].r, block[i].g, block[i].b };
+				for (size_t c = 0; c < 3; c++) {
+					low[c] = std::min(low[c], channels[c]);
+					high[c] = std::max(high[c], channels[c]);
+				}
+			}
+			for (size_t c = 0; c < 3; c++) {
+				int inset = (high[c] - low[c]) / 16;
+				low[c] += inset;
+				high[c] -= inset;
+			}
+			uint16_t color0 = pack_565(high[0], high[1], high[2]);
+			uint16_t color1 = pack_565(low[0], low[1], low[2]);
+			// color0 > color1 selects the four-colour palette
+			if (color0 < color1) {
+				std::swap(color0, color1);
+			}
+			uint32_t indices = 0;
+			if (color0 != color1) {
+				int palette[4][3];
+				unpack_565(color0, palette[0]);
+				unpack_565(color1, palette[1]);
+				for (size_t c = 0; c < 3; c++) {
+					palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+					palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+				}
+				for (size_t i = 0; i < 16; i++) {
+					int channels[3] = { block[i].r, block[i].g, block[i].b };
+					uint32_t best = 0;
+					int best_distance = INT32_MAX;
+					for (uint32_t p = 0; p < 4; p++) {
+						int distance = 0;
+						for (size_t c = 0; c < 3; c++) {
+							int delta = channels[c] - palette[p][c];
+							distance += delta * delta;
+						}
+						if (distance < best_distance) {
+							best_distance = distance;
+							best = p;
+						}
+					}
+					indices |= best << (2 * i);
+				}
+			}
+			out[0] = color0 & 0xFF;
+			out[1] = color0 >> 8;
+			out[2] = color1 & 0xFF;
+			out[3] = color1 >> 8;
+			for (size_t i = 0; i < 4; i++) {
+				out[4 + i] = (indices >> (8 * i)) & 0xFF;
+			}
+		}
+
+		// Writes the 8-byte alpha half of a BC3 block, using the eight-value
+		// palette between the block's extremes
+		static void encode_alpha_block(format::RGBA8 const block[16], unsigned char* out) {
+			int alpha0 = 0;
+			int alpha1 = 255;
+			for (size_t i = 0; i < 16; i++) {
+				alpha0 = std::max(alpha0, int(block[i].a));
+				alpha1 = std::min(alpha1, int(block[i].a));
+			}
+			uint64_t indices = 0;
+			if (alpha0 != alpha1) {
+				int palette[8] = { alpha0, alpha1 };
+				for (int p = 2; p < 8; p++) {
+					palette[p] = ((8 - p) * alpha0 + (p - 1) * alpha1 + 3) / 7;
+				}
+				for (size_t i = 0; i < 16; i++) {
+					uint64_t best = 0;
+					int best_distance = 256;
+					for (uint64_t p = 0; p < 8; p++) {
+						int distance = std::abs(int(block[i].a) - palette[p]);
+						if (distance < best_distance) {
+							best_distance = distance;
+							best = p;
+						}
+					}
+					indices |= best << (3 * i);
+				}
+			}
+			out[0] = alpha0;
+			out[1] = alpha1;
+			for (size_t i = 0; i < 6; i++) {
+				out[2 + i] = (indices >> (8 * i)) & 0xFF;
+			}
+		}
+
+		std::vector<unsigned char> encode_bc1(std::span<format::RGBA8 const> texels, size_t width, size_t height) {
+			std::vector<unsigned char> result(level_size(Format::bc1, width, height));
+			unsigned char* out = result.data();
+			format::RGBA8 block[16];
+			for (size_t y = 0; y < height; y += 4) {
+				for (size_t x = 0; x < width; x += 4) {
+					read_block(texels, width, height, x, y, block);
+					encode_color_block(block, out);
+					out += 8;
+				}
+			}
+			return result;
+		}
+
+		std::vector<unsigned char> encode_bc3(std::span<format::RGBA8 const> texels, size_t width, size_t height) {
+			std::vector<unsigned char> result(level_size(Format::bc3, width, height));
+			unsigned char* out = result.data();
+			format::RGBA8 block[16];
+			for (size_t y = 0; y < height; y += 4) {
+				for (size_t x = 0; x < width; x += 4) {
+					read_block(texels, width, height, x, y, block);
+					encode_alpha_block(block, out);
+					encode_color_block(block, out + 8);
+					out += 16;
+				}
+			}
+			return result;
+		}
+
+
+		void write(std::filesystem::path const& path, Format kind, std::vector<std::vector<format::RGBA8>> const& levels, size_t width, size_t height) {
+			if (levels.empty()) {
+				throw std::runtime_error("Cannot bake a texture with no levels.");
+			}
+			Header header;
+			std::memcpy(header.magic, magic, sizeof(magic));
+			header.version = version;
+			header.format = uint32_t(kind);
+			header.width = width;
+			header.height = height;
+			header.level_count = levels.size();
+
+			std::vector<LevelEntry> entries;
+			std::vector<std::vector<unsigned char>> payloads;
+			size_t offset = sizeof(Header) + sizeof(LevelEntry) * levels.size();
+			size_t level_width = width;
+			size_t level_height = height;
+			for (std::vector<format::RGBA8> const& level : levels) {
+				if (level.size() != level_width * level_height) {
+					throw std::runtime_error("Baked level of " + std::to_string(level_width) + "x" + std::to_string(level_height)
+						+ " has " + std::to_string(level.size()) + " texels.");
+				}
+				std::vector<unsigned char> payload;
+				if (block_size(kind) == 0) {
+					unsigned char const* bytes = reinterpret_cast<unsigned char const*>(level.data());
+					payload.assign(bytes, bytes + level.size() * sizeof(format::RGBA8));
+				}
+				else if ((kind == Format::bc1) || (kind == Format::bc1_srgb)) {
+					payload = encode_bc1(level, level_width, level_height);
+				}
+				else {
+					payload = encode_bc3(level, level_width, level_height);
+				}
+				offset = (offset + payload_alignment - 1) / payload_alignment * payload_alignment;
+				entries.push_back({ offset, payload.size(), uint32_t(level_width), uint32_t(level_height) });
+				offset += payload.size();
+				payloads.push_back(std::move(payload));
+				level_width = std::max<size_t>(level_width / 2, 1);
+				level_height = std::max<size_t>(level_height / 2, 1);
+			}
+
+			// Written beside the destination and renamed into place, so that a
+			// reader never maps a half-written file
+			std::filesystem::path temporary = path;
+			temporary += ".tmp";
+			{
+				std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+				if (!file) {
+					throw std::runtime_error("Failed to open '" + temporary.string() + "' for writing.");
+				}
+				file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+				file.write(reinterpret_cast<char const*>(entries.data()), sizeof(LevelEntry) * entries.size());
+				size_t position = sizeof(Header) + sizeof(LevelEntry) * entries.size();
+				char const zeros[payload_alignment] = {};
+				for (size_t i = 0; i < payloads.size(); i++) {
+					file.write(zeros, entries[i].offset - position);
+					file.write(reinterpret_cast<char const*>(payloads[i].data()), payloads[i].size());
+					position = entries[i].offset + entries[i].size;
+				}
+				if (!file) {
+					throw std::runtime_error("Failed to write '" + temporary.string() + "'.");
+				}
+			}
+			std::filesystem::rename(temporary, path);
+		}
+
+	}
+
+
+	MappedFile::MappedFile(std::filesystem::path const& path)
+		: start(nullptr)
+		, length(0)
+	{
+		#if defined(__unix__) || defined(__APPLE__)
+		int descriptor = open(path.c_str(), O_RDONLY);
+		if (descriptor < 0) {
+			throw std::runtime_error("Failed to open '" + path.string() + "'.");
+		}
+		struct stat status;
+		if (fstat(descriptor, &status) != 0) {
+			close(descriptor);
+			throw std::runtime_error("Failed to read the size of '" + path.string() + "'.");
+		}
+		length = status.st_size;
+		if (length != 0) {
+			void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+			if (mapping == MAP_FAILED) {
+				close(descriptor);
+				throw std::runtime_error("Failed to map '" + path.string() + "'.");
+			}
+			start = static_cast<unsigned char const*>(mapping);
+			// Levels are read front to back, once. Advice values are not flags,
+			// so each needs a call of its own.
+			madvise(mapping, length, MADV_SEQUENTIAL);
+			madvise(mapping, length, MADV_WILLNEED);
+		}
+		// The mapping outlives the descriptor
+		close(descriptor);
+		#else
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file) {
+			throw std::runtime_error("Failed to open '" + path.string() + "'.");
+		}
+		contents.resize(size_t(file.tellg()));
+		file.seekg(0);
+		if (!file.read(reinterpret_cast<char*>(contents.data()), contents.size())) {
+			throw std::runtime_error("Failed to read '" + path.string() + "'.");
+		}
+		length = contents.size();
+		start = length ? contents.data() : nullptr;
+		#endif
+	}
+
+	MappedFile::MappedFile(MappedFile&& other)
+		: start(other.start)
+		, length(other.length)
+		, contents(std::move(other.contents))
+	{
+		other.start = nullptr;
+		other.length = 0;
+	}
+
+	MappedFile::~MappedFile() {
+		#if defined(__unix__) || defined(__APPLE__)
+		if (start != nullptr) {
+			munmap(const_cast<unsigned char*>(start), length);
+		}
+		#endif
+	}
+
+	unsigned char const* MappedFile::data() const {
+		return start;
+	}
+
+	size_t MappedFile::size() const {
+		return length;
+	}
+
+
+	bake::Header const& BakedTexture::validate(MappedFile const& file) {
+		if (file.size() < sizeof(bake::Header)) {
+			throw std::runtime_error("Baked texture is too short to hold a header.");
+		}
+		bake::Header const& header = *reinterpret_cast<bake::Header const*>(file.data());
+		if (std::memcmp(header.magic, bake::magic, sizeof(bake::magic)) != 0) {
+			throw std::runtime_error("File is not a baked texture.");
+		}
+		if (header.version != bake::version) {
+			throw std::runtime_error("Baked texture is version " + std::to_string(header.version)
+				+ ", but only version " + std::to_string(bake::version) + " is supported.");
+		}
+		bake::Format format = bake::Format(header.format);
+		bake::internal_format(format);
+		if ((header.width == 0) || (header.height == 0) || (header.level_count == 0)
+			|| (GLsizei(header.level_count) > TextureStorage::full_mip_count(header.width, header.height))) {
+			throw std::runtime_error("Baked texture has an invalid size or level count.");
+		}
+		if (file.size() < sizeof(bake::Header) + sizeof(bake::LevelEntry) * header.level_count) {
+			throw std::runtime_error("Baked texture is too short to hold its level table.");
+		}
+		bake::LevelEntry const* entries = reinterpret_cast<bake::LevelEntry const*>(file.data() + sizeof(bake::Header));
+		size_t width = header.width;
+		size_t height = header.height;
+		for (size_t level = 0; level < header.level_count; level++) {
+			bake::LevelEntry const& entry = entries[level];
+			if ((entry.width != width) || (entry.height != height)
+				|| (entry.size != bake::level_size(format, width, height))
+				|| (entry.offset > file.size()) || (entry.size > file.size() - entry.offset)) {
+				throw std::runtime_error("Baked texture level " + std::to_string(level) + " is malformed.");
+			}
+			width = std::max<size_t>(width / 2, 1);
+			height = std::max<size_t>(height / 2, 1);
+		}
+		context::Capabilities const& caps = context::capabilities();
+		if ((bake::block_size(format) != 0) && !(bake::is_srgb(format) ? caps.s3tc_srgb : caps.s3tc)) {
+			throw std::runtime_error("Baked texture is block-compressed in a format this context does not support.");
+		}
+		return header;
+	}
+
+	// The mapping lives until the outermost constructor returns, so every
+	// level is uploaded straight from it
+	BakedTexture::BakedTexture(std::filesystem::path const& path)
+		: BakedTexture(MappedFile(path))
+	{}
+
+	BakedTexture::BakedTexture(MappedFile const& file)
+		: BakedTexture(file, validate(file))
+	{}
+
+	BakedTexture::BakedTexture(MappedFile const& file, bake::Header const& header)
+		: TextureStorage(
+			bake::internal_format(bake::Format(header.format)),
+			GL_RGBA,
+			GL_UNSIGNED_BYTE,
+			sizeof(glazy::format::RGBA8),
+			header.width,
+			header.height,
+			header.level_count
+		)
+		, stored_format(bake::Format(header.format))
+	{
+		safety::entry_guard("BakedTexture::BakedTexture");
+		bake::LevelEntry const* entries = reinterpret_cast<bake::LevelEntry const*>(file.data() + sizeof(bake::Header));
+		for (size_t level = 0; level < header.level_count; level++) {
+			bake::LevelEntry const& entry = entries[level];
+			unsigned char const* payload = file.data() + entry.offset;
+			if (bake::block_size(stored_format) == 0) {
+				upload(level, 0, 0, entry.width, entry.height, payload, entry.width * entry.height, entry.width);
+			}
+			else {
+				upload_compressed(level, 0, 0, entry.width, entry.height, payload, entry.size);
+			}
+		}
+		safety::exit_guard("BakedTexture::BakedTexture");
+	}
+
+	bake::Format BakedTexture::format() const {
+		return stored_format;
+	}
+
+}
@@ -1,49 +1,214 @@
+
 #include "glazy_buffer.h"
+#include "glazy_objects.h"
 
 namespace glazy {
 	namespace compat {
 
-		// macOS does not support OpenGL 4.5, and so does not have compat::named_buffer_data.
-		// To fix this, we have the janky solution of rapidly swapping the original
-		// GL_ARRAY_BUFFER out, binding our buffer briefly to perform the operation,
-		// and then swapping the original back in. This is less inefficient, but it
-		// is the price that must be paid for ergonomic data movement without
-		// introducing nasty, hard-to-debug side effects.
+		// When direct state access is available, these are thin wrappers around
+		// the glNamedBuffer* family. Otherwise, macOS being the usual culprit, we
+		// have the janky solution of rapidly swapping the original GL_ARRAY_BUFFER
+		// out, binding our buffer briefly to perform the operation, and then
+		// swapping the original back in.
+		//
+		// Rather than asking GL what the original binding was (a round-trip that
+		// stalls the driver), we take it from the context's state cache.
+
+		GLuint bound_array_buffer() {
+			return StateCache::current().bound_buffer(GL_ARRAY_BUFFER);
+		}
+
+		void bind_array_buffer(GLuint id) {
+			StateCache::current().bind_buffer(GL_ARRAY_BUFFER, id);
+		}
+
+		// Binds 'id' to GL_ARRAY_BUFFER for the lifetime of the swap, then
+		// restores whatever was recorded as bound before.
+		class ArraySwap {
+			GLuint old;
+		public:
+			ArraySwap(GLuint id) : old(bound_array_buffer()) {
+				bind_array_buffer(id);
+			}
+			~ArraySwap() {
+				bind_array_buffer(old);
+			}
+		};
+
+		GLuint create_buffer() {
+			return ContextObjects::current().buffers.acquire();
+		}
+
+		void delete_buffer(GLuint id) {
+			ContextObjects::current().deletions.defer(DeletionQueue::Kind::buffer, id);
+		}
 
 		void named_buffer_data(GLuint id, size_t size, void* data, GLenum usage) {
 			safety::entry_guard("compat::named_buffer_data()");
-			GLuint old;
-			// Why would OpenGL base all object identifiers around unsigned integers,
-			// but not provide a get routine for unsigned integers?
-			glGetIntegerv(GL_ARRAY_BUFFER_BINDING, reinterpret_cast<GLint*>(&old));
-			glBindBuffer(GL_ARRAY_BUFFER, id);
-			glBufferData(GL_ARRAY_BUFFER, size, data, usage);
-			glBindBuffer(GL_ARRAY_BUFFER, old);
+			if (context::capabilities().direct_state_access) {
+				glNamedBufferData(id, size, data, usage);
+			}
+			else {
+				ArraySwap swap(id);
+				glBufferData(GL_ARRAY_BUFFER, size, data, usage);
+			}
 			safety::exit_guard("compat::named_buffer_data()");
 		}
 
+		void named_buffer_sub_data(GLuint id, size_t offset, size_t size, void const* data) {
+			safety::entry_guard("compat::named_buffer_sub_data()");
+			if (context::capabilities().direct_state_access) {
+				glNamedBufferSubData(id, offset, size, data);
+			}
+			else {
+				ArraySwap swap(id);
+				glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+			}
+			safety::exit_guard("compat::named_buffer_sub_data()");
+		}
+
 		void* map_named_buffer(GLuint id, GLenum access) {
 			safety::entry_guard("compat::map_named_buffer()");
 			void* result;
-			GLuint old;
-			glGetIntegerv(GL_ARRAY_BUFFER_BINDING, reinterpret_cast<GLint*>(&old));
-			glBindBuffer(GL_ARRAY_BUFFER, id);
-			result = glMapBuffer(GL_ARRAY_BUFFER, access);
-			glBindBuffer(GL_ARRAY_BUFFER, old);
+			if (context::capabilities().direct_state_access) {
+				result = glMapNamedBuffer(id, access);
+			}
+			else {
+				ArraySwap swap(id);
+				result = glMapBuffer(GL_ARRAY_BUFFER, access);
+			}
 			safety::exit_guard("compat::map_named_buffer()");
 			return result;
 		}
 
 		void unmap_named_buffer(GLuint id) {
 			safety::entry_guard("compat::unmap_named_buffer()");
-			GLuint old;
-			glGetIntegerv(GL_ARRAY_BUFFER_BINDING, reinterpret_cast<GLint*>(&old));
-			glBindBuffer(GL_ARRAY_BUFFER, id);
-			glUnmapBuffer(GL_ARRAY_BUFFER);
-			glBindBuffer(GL_ARRAY_BUFFER, old);
+			if (context::capabilities().direct_state_access) {
+				glUnmapNamedBuffer(id);
+			}
+			else {
+				ArraySwap swap(id);
+				glUnmapBuffer(GL_ARRAY_BUFFER);
+			}
 			safety::exit_guard("compat::unmap_named_buffer()");
 		}
 
+		bool has_buffer_storage() {
+			return context::capabilities().buffer_storage;
+		}
+
+		void named_buffer_storage(GLuint id, size_t size, void* data, GLbitfield flags) {
+			safety::entry_guard("compat::named_buffer_storage()");
+			if (context::capabilities().direct_state_access) {
+				glNamedBufferStorage(id, size, data, flags);
+			}
+			else {
+				ArraySwap swap(id);
+				glBufferStorage(GL_ARRAY_BUFFER, size, data, flags);
+			}
+			safety::exit_guard("compat::named_buffer_storage()");
+		}
+
+		void* map_named_buffer_range(GLuint id, size_t offset, size_t length, GLbitfield access) {
+			safety::entry_guard("compat::map_named_buffer_range()");
+			void* result;
+			if (context::capabilities().direct_state_access) {
+				result = glMapNamedBufferRange(id, offset, length, access);
+			}
+			else {
+				ArraySwap swap(id);
+				result = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, access);
+			}
+			safety::exit_guard("compat::map_named_buffer_range()");
+			return result;
+		}
+
+		void flush_named_buffer_range(GLuint id, size_t offset, size_t length) {
+			safety::entry_guard("compat::flush_named_buffer_range()");
+			if (context::capabilities().direct_state_access) {
+				glFlushMappedNamedBufferRange(id, offset, length);
+			}
+			else {
+				ArraySwap swap(id);
+				glFlushMappedBufferRange(GL_ARRAY_BUFFER, offset, length);
+			}
+			safety::exit_guard("compat::flush_named_buffer_range()");
+		}
+
+		void copy_named_buffer_sub_data(GLuint source, GLuint dest, size_t source_offset, size_t dest_offset, size_t size) {
+			safety::entry_guard("compat::copy_named_buffer_sub_data()");
+			if (context::capabilities().direct_state_access) {
+				glCopyNamedBufferSubData(source, dest, source_offset, dest_offset, size);
+			}
+			else {
+				// The copy targets exist so that copies need not disturb other bindings
+				StateCache& cache = StateCache::current();
+				cache.bind_buffer(GL_COPY_READ_BUFFER, source);
+				cache.bind_buffer(GL_COPY_WRITE_BUFFER, dest);
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, source_offset, dest_offset, size);
+			}
+			safety::exit_guard("compat::copy_named_buffer_sub_data()");
+		}
+
+	}
+
+
+	IndexBuffer::IndexBuffer()
+		: id(compat::create_buffer())
+		, index_type(GL_UNSIGNED_INT)
+		, length(0)
+	{
+		if (id == 0) {
+			throw std::runtime_error("Failed to allocate id for index buffer.");
+		}
+	}
+
+	IndexBuffer::IndexBuffer(IndexBuffer&& other)
+		: id(other.id)
+		, index_type(other.index_type)
+		, length(other.length)
+	{
+		other.id = 0;
+		other.length = 0;
+	}
+
+	IndexBuffer::~IndexBuffer() {
+		compat::delete_buffer(id);
+	}
+
+	IndexBuffer::operator GLuint() const {
+		return id;
 	}
-}
 
+	void IndexBuffer::set_data(std::vector<GLuint> const& indices, GLenum usage) {
+		safety::entry_guard("IndexBuffer::set_data");
+		GLuint max = 0;
+		for (GLuint index : indices) {
+			max = std::max(max, index);
+		}
+		if (max <= 0xFFFF) {
+			std::vector<GLushort> narrow(indices.begin(), indices.end());
+			compat::named_buffer_data(id, sizeof(GLushort) * narrow.size(), narrow.data(), usage);
+			index_type = GL_UNSIGNED_SHORT;
+		}
+		else {
+			compat::named_buffer_data(id, sizeof(GLuint) * indices.size(), const_cast<GLuint*>(indices.data()), usage);
+			index_type = GL_UNSIGNED_INT;
+		}
+		length = indices.size();
+		safety::exit_guard("IndexBuffer::set_data");
+	}
+
+	size_t IndexBuffer::size() const {
+		return length;
+	}
+
+	GLenum IndexBuffer::type() const {
+		return index_type;
+	}
+
+	size_t IndexBuffer::index_size() const {
+		return (index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+	}
+
+}
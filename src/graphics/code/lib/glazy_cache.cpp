@@ -0,0 +1,182 @@
+
+#include "glazy_cache.h"
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+
+namespace glazy {
+
+	ProgramSources ProgramSources::from_files(std::string vertex_path, std::string fragment_path) {
+		ProgramSources result;
+		result.vertex = file::read_file_to_string(vertex_path);
+		result.fragment = file::read_file_to_string(fragment_path);
+		return result;
+	}
+
+	GPUProgram ProgramSources::build(bool retrievable) const {
+		return GPUProgram(
+			Shader<GL_VERTEX_SHADER>(vertex),
+			tess_control.empty() ? Shader<GL_TESS_CONTROL_SHADER>() : Shader<GL_TESS_CONTROL_SHADER>(tess_control),
+			tess_evaluation.empty() ? Shader<GL_TESS_EVALUATION_SHADER>() : Shader<GL_TESS_EVALUATION_SHADER>(tess_evaluation),
+			geometry.empty() ? Shader<GL_GEOMETRY_SHADER>() : Shader<GL_GEOMETRY_SHADER>(geometry),
+			Shader<GL_FRAGMENT_SHADER>(fragment),
+			retrievable
+		);
+	}
+
+
+	// Cache entries start with this header, followed by the binary itself
+	struct EntryHeader {
+		char     magic[4];
+		GLenum   format;
+		uint64_t length;
+		double   compile_seconds;
+	};
+
+	static char const entry_magic[4] = { 'G', 'L', 'Z', 'B' };
+
+	// 64-bit FNV-1a, extended over each piece in turn
+	static uint64_t hash_text(uint64_t hash, std::string const& text) {
+		for (char c : text) {
+			hash ^= static_cast<unsigned char>(c);
+			hash *= 1099511628211ull;
+		}
+		// Separates pieces, so that moving text between stages changes the key
+		hash ^= 0xFF;
+		hash *= 1099511628211ull;
+		return hash;
+	}
+
+	static double seconds_since(std::chrono::steady_clock::time_point start) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count();
+	}
+
+
+	ProgramCache::ProgramCache(std::filesystem::path directory)
+		: directory(directory)
+		, supported(false)
+		, totals{ 0, 0, 0, 0.0, 0.0, 0.0 }
+	{
+		safety::entry_guard("ProgramCache::ProgramCache");
+		for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+			GLubyte const* text = glGetString(name);
+			driver += (text != nullptr) ? reinterpret_cast<char const*>(text) : "";
+			driver += '\n';
+		}
+		GLint format_count = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+		supported = (format_count > 0);
+		if (supported) {
+			std::vector<GLint> listed(format_count);
+			glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, listed.data());
+			formats.assign(listed.begin(), listed.end());
+		}
+		if (supported) {
+			std::filesystem::create_directories(directory);
+		}
+		safety::exit_guard("ProgramCache::ProgramCache");
+	}
+
+	std::filesystem::path ProgramCache::entry_path(ProgramSources const& sources) const {
+		uint64_t hash = 14695981039346656037ull;
+		hash = hash_text(hash, driver);
+		hash = hash_text(hash, sources.vertex);
+		hash = hash_text(hash, sources.tess_control);
+		hash = hash_text(hash, sources.tess_evaluation);
+		hash = hash_text(hash, sources.geometry);
+		hash = hash_text(hash, sources.fragment);
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hash));
+		return directory / name;
+	}
+
+	void ProgramCache::store(std::filesystem::path const& path, GLuint program, double compile_seconds) {
+		safety::entry_guard("ProgramCache::store");
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) {
+			safety::exit_guard("ProgramCache::store");
+			return;
+		}
+		std::vector<char> binary(length);
+		EntryHeader header;
+		std::copy(entry_magic, entry_magic + 4, header.magic);
+		header.compile_seconds = compile_seconds;
+		GLsizei written = 0;
+		glGetProgramBinary(program, length, &written, &header.format, binary.data());
+		header.length = written;
+		// Written to the side and renamed into place, so that a crash mid-write
+		// never leaves a truncated entry behind
+		std::filesystem::path temporary = path;
+		temporary += ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+			file.write(binary.data(), written);
+		}
+		// Failing to store only costs the next launch a compile
+		std::error_code error;
+		std::filesystem::rename(temporary, path, error);
+		safety::exit_guard("ProgramCache::store");
+	}
+
+	GPUProgram ProgramCache::load(ProgramSources const& sources) {
+		safety::entry_guard("ProgramCache::load");
+		auto start = std::chrono::steady_clock::now();
+		std::filesystem::path path = entry_path(sources);
+
+		std::ifstream file(path, std::ios::binary);
+		EntryHeader header;
+		// The length comes from disk, so it is checked against the file before
+		// anything is allocated for it. A corrupt entry is just a miss.
+		std::error_code size_error;
+		uintmax_t file_size = std::filesystem::file_size(path, size_error);
+		if (supported && file.read(reinterpret_cast<char*>(&header), sizeof(header))
+			&& std::equal(entry_magic, entry_magic + 4, header.magic)
+			&& !size_error && (file_size >= sizeof(header)) && (header.length == file_size - sizeof(header))) {
+			// glProgramBinary raises an error, rather than failing to link, on
+			// a format the driver does not list
+			bool listed = (std::find(formats.begin(), formats.end(), header.format) != formats.end());
+			std::vector<char> binary(listed ? header.length : 0);
+			if (!listed) {
+				totals.rejected++;
+			}
+			else if (file.read(binary.data(), binary.size())) {
+				GLuint id = glCreateProgram();
+				glProgramBinary(id, header.format, binary.data(), binary.size());
+				// Drivers reject binaries after updates, among other reasons, and
+				// report it through the link status
+				GLint status = GL_FALSE;
+				glGetProgramiv(id, GL_LINK_STATUS, &status);
+				if (status == GL_TRUE) {
+					GPUProgram result = GPUProgram::from_linked(id);
+					double seconds = seconds_since(start);
+					totals.hits++;
+					totals.seconds_loading += seconds;
+					totals.seconds_saved += header.compile_seconds - seconds;
+					safety::exit_guard("ProgramCache::load");
+					return result;
+				}
+				glDeleteProgram(id);
+				totals.rejected++;
+			}
+		}
+		file.close();
+
+		GPUProgram result = sources.build(supported);
+		double seconds = seconds_since(start);
+		totals.misses++;
+		totals.seconds_compiling += seconds;
+		if (supported) {
+			store(path, result, seconds);
+		}
+		safety::exit_guard("ProgramCache::load");
+		return result;
+	}
+
+	ProgramCache::Stats const& ProgramCache::stats() const {
+		return totals;
+	}
+
+}
@@ -29,36 +29,123 @@ namespace glazy {
 	}
 
 
+	namespace type {
+		bool is_integral(GLenum type) {
+			switch (type) {
+			case GL_BYTE: case GL_UNSIGNED_BYTE: case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_INT: case GL_UNSIGNED_INT:
+				return true;
+			case GL_HALF_FLOAT: case GL_FLOAT: case GL_DOUBLE:
+				return false;
+			default:
+				throw std::runtime_error("Invalid attribute type " + std::to_string(type));
+			}
+		}
+	}
+
+
 	namespace safety {
-		void auto_throw(std::string context) {
+
+		// Drains glGetError, returning the codes as a list, or an empty string
+		static std::string poll_errors() {
+			std::string result;
 			GLenum err = glGetError();
-			if (err != GL_NO_ERROR) {
-				std::string message = context + " - OpenGL Error Codes: ";
-				bool first = true;
-				while (err != GL_NO_ERROR) {
-					if (!first) {
-						message += ", ";
-					}
-					message += std::to_string(err);
-					err = glGetError();
+			while (err != GL_NO_ERROR) {
+				if (!result.empty()) {
+					result += ", ";
 				}
-				throw std::runtime_error(message);
+				result += std::to_string(err);
+				err = glGetError();
 			}
+			return result;
 		}
 
-		void entry_guard(std::string fn_name) {
-			if (true) { //flags::debug) {
-				std::string context = "Encountered OpenGL error from before '";
-				context += fn_name + "' was called.";
-				auto_throw(context);
+		void auto_throw(std::string context) {
+			std::string errors = poll_errors();
+			if (!errors.empty()) {
+				throw std::runtime_error(context + " - OpenGL Error Codes: " + errors);
 			}
 		}
 
-		void exit_guard(std::string fn_name) {
-			if (flags::debug) {
-				std::string context = "Encountered OpenGL error during evaluation of '";
-				context += fn_name + "'.";
-				auto_throw(context);
+
+		// Synchronous debug output runs the callback on the thread that made the
+		// offending call, before that call returns, so the message can wait for
+		// the next guard in a per-thread record.
+		static thread_local bool debug_output = false;
+		static thread_local std::string pending_error;
+
+		static void APIENTRY debug_callback(
+			GLenum /* source */, GLenum type, GLuint /* id */, GLenum /* severity */,
+			GLsizei length, GLchar const* message, void const* /* user */
+		) {
+			if ((type == GL_DEBUG_TYPE_ERROR) && pending_error.empty()) {
+				pending_error.assign(message, length);
+			}
+		}
+
+		// As with direct state access, glad does not load the KHR_debug entry
+		// points on contexts older than the version that made them core
+		static bool load_debug_output() {
+			glad_glDebugMessageCallback = reinterpret_cast<PFNGLDEBUGMESSAGECALLBACKPROC>(glfwGetProcAddress("glDebugMessageCallback"));
+			glad_glDebugMessageControl = reinterpret_cast<PFNGLDEBUGMESSAGECONTROLPROC>(glfwGetProcAddress("glDebugMessageControl"));
+			return (glad_glDebugMessageCallback != nullptr) && (glad_glDebugMessageControl != nullptr);
+		}
+
+		bool use_debug_output(bool enabled) {
+			if (!enabled) {
+				if (debug_output) {
+					glDebugMessageCallback(nullptr, nullptr);
+					glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+					glDisable(GL_DEBUG_OUTPUT);
+				}
+				debug_output = false;
+				return true;
+			}
+			bool supported = GLAD_GL_VERSION_4_3;
+			if (!supported && glfwExtensionSupported("GL_KHR_debug")) {
+				supported = load_debug_output();
+			}
+			if (!supported) {
+				return false;
+			}
+			// Errors from before the switch would otherwise go unreported
+			auto_throw("Encountered OpenGL error before enabling debug output");
+			glEnable(GL_DEBUG_OUTPUT);
+			glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+			glDebugMessageCallback(debug_callback, nullptr);
+			// Only errors are recorded, so there is no point in hearing the rest
+			glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_FALSE);
+			glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_ERROR, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+			debug_output = true;
+			return true;
+		}
+
+		bool using_debug_output() {
+			return debug_output;
+		}
+
+		namespace detail {
+			void check(bool entry, char const* fn_name, std::source_location where) {
+				std::string errors;
+				if (debug_output) {
+					errors.swap(pending_error);
+				}
+				else {
+					errors = poll_errors();
+				}
+				if (errors.empty()) {
+					return;
+				}
+				std::string message = entry
+					? "Encountered OpenGL error from before '"
+					: "Encountered OpenGL error during evaluation of '";
+				message += fn_name;
+				message += entry ? "' was called" : "'";
+				message += " (";
+				message += where.file_name();
+				message += ":" + std::to_string(where.line()) + ") - ";
+				message += debug_output ? "" : "OpenGL Error Codes: ";
+				message += errors;
+				throw std::runtime_error(message);
 			}
 		}
 	}
@@ -67,17 +154,108 @@ namespace glazy {
 
 	namespace context {
 
-		void error_callback(int error_code, char const* desc) {
-			throw std::runtime_error(desc);
+		Capabilities& capabilities() {
+			static Capabilities result = {};
+			return result;
 		}
 
-		GLFWwindow* setup(glm::ivec2 position, glm::ivec2 dimensions, const char* title, std::vector<WindowHint> hints) {
-			if (glfwInit() == GLFW_FALSE) {
-				throw std::runtime_error("Failed to initialize GLFW.");
+		// glad is only generated for core profiles, so the ARB_direct_state_access
+		// entry points are not loaded on pre-4.5 contexts that expose the extension.
+		// They share their names with the 4.5 functions, so we load them by hand.
+		static bool load_direct_state_access() {
+			struct Entry {
+				char const* name;
+				void** pointer;
+			};
+			Entry const entries[] = {
+				{ "glCreateBuffers",               reinterpret_cast<void**>(&glad_glCreateBuffers) },
+				{ "glNamedBufferData",             reinterpret_cast<void**>(&glad_glNamedBufferData) },
+				{ "glNamedBufferSubData",          reinterpret_cast<void**>(&glad_glNamedBufferSubData) },
+				{ "glNamedBufferStorage",          reinterpret_cast<void**>(&glad_glNamedBufferStorage) },
+				{ "glMapNamedBuffer",              reinterpret_cast<void**>(&glad_glMapNamedBuffer) },
+				{ "glMapNamedBufferRange",         reinterpret_cast<void**>(&glad_glMapNamedBufferRange) },
+				{ "glFlushMappedNamedBufferRange", reinterpret_cast<void**>(&glad_glFlushMappedNamedBufferRange) },
+				{ "glUnmapNamedBuffer",            reinterpret_cast<void**>(&glad_glUnmapNamedBuffer) },
+				{ "glCopyNamedBufferSubData",      reinterpret_cast<void**>(&glad_glCopyNamedBufferSubData) },
+				{ "glCreateVertexArrays",          reinterpret_cast<void**>(&glad_glCreateVertexArrays) },
+				{ "glEnableVertexArrayAttrib",     reinterpret_cast<void**>(&glad_glEnableVertexArrayAttrib) },
+				{ "glDisableVertexArrayAttrib",    reinterpret_cast<void**>(&glad_glDisableVertexArrayAttrib) },
+				{ "glVertexArrayVertexBuffer",     reinterpret_cast<void**>(&glad_glVertexArrayVertexBuffer) },
+				{ "glVertexArrayAttribFormat",     reinterpret_cast<void**>(&glad_glVertexArrayAttribFormat) },
+				{ "glVertexArrayAttribIFormat",    reinterpret_cast<void**>(&glad_glVertexArrayAttribIFormat) },
+				{ "glVertexArrayAttribBinding",    reinterpret_cast<void**>(&glad_glVertexArrayAttribBinding) },
+				{ "glVertexArrayElementBuffer",    reinterpret_cast<void**>(&glad_glVertexArrayElementBuffer) },
+				{ "glCreateTextures",              reinterpret_cast<void**>(&glad_glCreateTextures) },
+				{ "glTextureStorage2D",            reinterpret_cast<void**>(&glad_glTextureStorage2D) },
+				{ "glTextureSubImage2D",           reinterpret_cast<void**>(&glad_glTextureSubImage2D) },
+				{ "glCompressedTextureSubImage2D", reinterpret_cast<void**>(&glad_glCompressedTextureSubImage2D) },
+				{ "glTextureParameteri",           reinterpret_cast<void**>(&glad_glTextureParameteri) },
+				{ "glGenerateTextureMipmap",       reinterpret_cast<void**>(&glad_glGenerateTextureMipmap) },
+			};
+			for (Entry const& entry : entries) {
+				*entry.pointer = reinterpret_cast<void*>(glfwGetProcAddress(entry.name));
+				if (*entry.pointer == nullptr) {
+					return false;
+				}
 			}
+			return true;
+		}
 
-			glfwSetErrorCallback(error_callback);
+		// Like ARB_direct_state_access, ARB_texture_storage must be loaded by hand
+		// on contexts older than the version that made it core
+		static bool load_texture_storage() {
+			glad_glTexStorage2D = reinterpret_cast<PFNGLTEXSTORAGE2DPROC>(glfwGetProcAddress("glTexStorage2D"));
+			glad_glTexStorage3D = reinterpret_cast<PFNGLTEXSTORAGE3DPROC>(glfwGetProcAddress("glTexStorage3D"));
+			return (glad_glTexStorage2D != nullptr) && (glad_glTexStorage3D != nullptr);
+		}
 
+		typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+		static PFNGLMAXSHADERCOMPILERTHREADSKHRPROC max_shader_compiler_threads = nullptr;
+
+		static bool load_parallel_shader_compile() {
+			if (glfwExtensionSupported("GL_KHR_parallel_shader_compile")) {
+				max_shader_compiler_threads = reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+			}
+			else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile")) {
+				max_shader_compiler_threads = reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+			}
+			else {
+				max_shader_compiler_threads = nullptr;
+			}
+			return max_shader_compiler_threads != nullptr;
+		}
+
+		void detect_capabilities() {
+			Capabilities& caps = capabilities();
+			caps.buffer_storage = GLAD_GL_VERSION_4_4;
+			caps.direct_state_access = GLAD_GL_VERSION_4_5;
+			if (!caps.direct_state_access && glfwExtensionSupported("GL_ARB_direct_state_access")) {
+				caps.direct_state_access = load_direct_state_access();
+			}
+			caps.texture_storage = GLAD_GL_VERSION_4_2;
+			if (!caps.texture_storage && glfwExtensionSupported("GL_ARB_texture_storage")) {
+				caps.texture_storage = load_texture_storage();
+			}
+			caps.s3tc = glfwExtensionSupported("GL_EXT_texture_compression_s3tc");
+			caps.s3tc_srgb = caps.s3tc && glfwExtensionSupported("GL_EXT_texture_sRGB");
+			caps.parallel_shader_compile = load_parallel_shader_compile();
+			// Some drivers only compile in the background once asked to
+			set_compiler_threads(0xFFFFFFFF);
+		}
+
+		void set_compiler_threads(GLuint count) {
+			if (capabilities().parallel_shader_compile && (max_shader_compiler_threads != nullptr)) {
+				max_shader_compiler_threads(count);
+			}
+		}
+
+		void error_callback(int error_code, char const* desc) {
+			throw std::runtime_error(desc);
+		}
+
+		// Applies the hints every glazy context needs on this platform, followed
+		// by the caller's own hints.
+		static void apply_hints(std::vector<WindowHint> const& hints) {
 			std::vector<WindowHint> platform_hints;
 
 			#ifdef __APPLE__
@@ -97,6 +275,8 @@ namespace glazy {
 			};
 			#endif
 
+			glfwDefaultWindowHints();
+
 			for (auto&& hint : platform_hints) {
 				glfwWindowHint(hint.hint, hint.value);
 			}
@@ -104,6 +284,16 @@ namespace glazy {
 			for (auto&& hint : hints) {
 				glfwWindowHint(hint.hint, hint.value);
 			}
+		}
+
+		GLFWwindow* setup(glm::ivec2 position, glm::ivec2 dimensions, const char* title, std::vector<WindowHint> hints) {
+			if (glfwInit() == GLFW_FALSE) {
+				throw std::runtime_error("Failed to initialize GLFW.");
+			}
+
+			glfwSetErrorCallback(error_callback);
+
+			apply_hints(hints);
 
 			GLFWwindow* result = glfwCreateWindow(dimensions.x, dimensions.y, title, nullptr, nullptr);
 
@@ -119,6 +309,19 @@ namespace glazy {
 			if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
 				throw std::runtime_error("Failed to initialize OpenGL context.");
 			}
+			detect_capabilities();
+			return result;
+		}
+
+		GLFWwindow* setup_shared(GLFWwindow* share) {
+			// The window only exists to own a context, so it is never shown
+			apply_hints({ {GLFW_VISIBLE, GLFW_FALSE} });
+			// Unlike 'setup', this does not make the new context current, so the
+			// calling thread keeps whichever context it had.
+			GLFWwindow* result = glfwCreateWindow(1, 1, "glazy shared context", nullptr, share);
+			if (result == nullptr) {
+				throw std::runtime_error("Failed to create shared context.");
+			}
 			return result;
 		}
 	}
@@ -0,0 +1,671 @@
+
+#include "glazy_mip.h"
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GLAZY_MIP_X86
+#include <immintrin.h>
+#endif
+
+namespace glazy {
+
+	namespace mip {
+
+		// The taps that make up one output texel. Output texel i is centred
+		// between source texels 2i and 2i+1, and is the weighted sum of source
+		// texels 2i+first onward, one per weight.
+		struct Kernel {
+			int first;
+			std::vector<float> weights;
+		};
+
+		static double const pi = 3.14159265358979323846;
+
+		static double sinc(double x) {
+			if (x == 0.0) {
+				return 1.0;
+			}
+			return std::sin(pi * x) / (pi * x);
+		}
+
+		// Zeroth-order modified Bessel function of the first kind, summed from
+		// its power series
+		static double bessel_i0(double x) {
+			double sum = 1.0;
+			double term = 1.0;
+			for (int k = 1; k < 32; k++) {
+				double factor = x / (2.0 * k);
+				term *= factor * factor;
+				sum += term;
+			}
+			return sum;
+		}
+
+		// Samples a filter at each tap's distance from the output texel's centre,
+		// measured in output texels, and normalizes the result
+		static Kernel make_kernel(Filter filter) {
+			if (filter == Filter::box) {
+				return { 0, { 0.5f, 0.5f } };
+			}
+			int radius = (filter == Filter::kaiser) ? 4 : 6;
+			Kernel kernel = { 1 - radius, {} };
+			double total = 0.0;
+			std::vector<double> weights;
+			for (int tap = kernel.first; tap <= radius; tap++) {
+				double x = (tap - 0.5) / 2.0;
+				double weight;
+				if (filter == Filter::kaiser) {
+					double alpha = 4.0;
+					double u = x / 2.0;
+					weight = sinc(x) * bessel_i0(alpha * std::sqrt(1.0 - u * u)) / bessel_i0(alpha);
+				}
+				else {
+					weight = sinc(x) * sinc(x / 3.0);
+				}
+				weights.push_back(weight);
+				total += weight;
+			}
+			for (double weight : weights) {
+				kernel.weights.push_back(float(weight / total));
+			}
+			return kernel;
+		}
+
+		static Kernel const& kernel_for(Filter filter) {
+			static Kernel const box = make_kernel(Filter::box);
+			static Kernel const kaiser = make_kernel(Filter::kaiser);
+			static Kernel const lanczos = make_kernel(Filter::lanczos);
+			switch (filter) {
+				case Filter::kaiser:  return kaiser;
+				case Filter::lanczos: return lanczos;
+				default:              return box;
+			}
+		}
+
+
+		// Lookup tables between stored bytes and linear floats
+		struct Tables {
+			static size_t const srgb_steps = 16384;
+			float linear[256];
+			float srgb_to_linear[256];
+			unsigned char linear_to_srgb[srgb_steps];
+
+			Tables() {
+				for (size_t i = 0; i < 256; i++) {
+					double value = i / 255.0;
+					linear[i] = float(value);
+					srgb_to_linear[i] = float((value <= 0.04045) ? (value / 12.92) : std::pow((value + 0.055) / 1.055, 2.4));
+				}
+				for (size_t i = 0; i < srgb_steps; i++) {
+					double value = double(i) / (srgb_steps - 1);
+					double encoded = (value <= 0.0031308) ? (value * 12.92) : (1.055 * std::pow(value, 1.0 / 2.4) - 0.055);
+					linear_to_srgb[i] = (unsigned char)(std::clamp(encoded, 0.0, 1.0) * 255.0 + 0.5);
+				}
+			}
+		};
+
+		static Tables const& tables() {
+			static Tables const result;
+			return result;
+		}
+
+		static void decode_row(format::RGBA8 const* source, size_t width, float* dest, bool srgb) {
+			Tables const& table = tables();
+			float const* color = srgb ? table.srgb_to_linear : table.linear;
+			for (size_t x = 0; x < width; x++) {
+				dest[x * 4 + 0] = color[source[x].r];
+				dest[x * 4 + 1] = color[source[x].g];
+				dest[x * 4 + 2] = color[source[x].b];
+				dest[x * 4 + 3] = table.linear[source[x].a];
+			}
+		}
+
+		static GLubyte encode_linear(float value) {
+			return GLubyte(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+		}
+
+		static GLubyte encode_srgb(float value) {
+			size_t index = size_t(std::clamp(value, 0.0f, 1.0f) * float(Tables::srgb_steps - 1) + 0.5f);
+			return tables().linear_to_srgb[index];
+		}
+
+		template<bool SRGB>
+		static void encode_row(float const* source, size_t width, format::RGBA8* dest) {
+			for (size_t x = 0; x < width; x++) {
+				if constexpr (SRGB) {
+					dest[x].r = encode_srgb(source[x * 4 + 0]);
+					dest[x].g = encode_srgb(source[x * 4 + 1]);
+					dest[x].b = encode_srgb(source[x * 4 + 2]);
+				}
+				else {
+					dest[x].r = encode_linear(source[x * 4 + 0]);
+					dest[x].g = encode_linear(source[x * 4 + 1]);
+					dest[x].b = encode_linear(source[x * 4 + 2]);
+				}
+				dest[x].a = encode_linear(source[x * 4 + 3]);
+			}
+		}
+
+		static void encode_row(float const* source, size_t width, format::RGBA8* dest, bool srgb) {
+			if (srgb) {
+				encode_row<true>(source, width, dest);
+			}
+			else {
+				encode_row<false>(source, width, dest);
+			}
+		}
+
+
+		// The scalar filter loops, which are also the reference the vector loops
+		// must match. Every path sums the taps in the same order, with separate
+		// multiplies and adds, so that results agree exactly.
+
+		// Filters texels [begin, end) of one row, clamping taps to the row
+		static void horizontal_scalar(float const* source, size_t width, float* dest, size_t begin, size_t end, Kernel const& kernel) {
+			size_t taps = kernel.weights.size();
+			for (size_t i = begin; i < end; i++) {
+				float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				for (size_t tap = 0; tap < taps; tap++) {
+					long x = std::clamp<long>(long(2 * i) + kernel.first + long(tap), 0, long(width) - 1);
+					float weight = kernel.weights[tap];
+					for (size_t c = 0; c < 4; c++) {
+						sum[c] = sum[c] + weight * source[x * 4 + c];
+					}
+				}
+				for (size_t c = 0; c < 4; c++) {
+					dest[i * 4 + c] = sum[c];
+				}
+			}
+		}
+
+		// The output texels whose taps all land inside a row of 'width' texels
+		static void interior(size_t width, size_t out_width, Kernel const& kernel, size_t& begin, size_t& end) {
+			long taps = long(kernel.weights.size());
+			long first = (kernel.first < 0) ? ((1 - kernel.first) / 2) : 0;
+			// The last texel whose final tap, 2i + first + taps - 1, is in the row
+			long span = long(width) - kernel.first - taps;
+			long last = (span < 0) ? 0 : (span / 2 + 1);
+			begin = std::min<size_t>(size_t(first), out_width);
+			end = std::clamp<long>(last, long(begin), long(out_width));
+		}
+
+		static void horizontal_row_scalar(float const* source, size_t width, float* dest, size_t out_width, Kernel const& kernel) {
+			horizontal_scalar(source, width, dest, 0, out_width, kernel);
+		}
+
+		static void vertical_scalar(float const* const* rows, Kernel const& kernel, float* dest, size_t count) {
+			size_t taps = kernel.weights.size();
+			for (size_t f = 0; f < count; f++) {
+				float sum = 0.0f;
+				for (size_t tap = 0; tap < taps; tap++) {
+					sum = sum + kernel.weights[tap] * rows[tap][f];
+				}
+				dest[f] = sum;
+			}
+		}
+
+		// Rounds the average of each 2x2 block, using integer sums
+		static void box_scalar(format::RGBA8 const* row0, format::RGBA8 const* row1, size_t width, format::RGBA8* dest, size_t begin, size_t out_width) {
+			for (size_t i = begin; i < out_width; i++) {
+				size_t x0 = std::min(2 * i, width - 1);
+				size_t x1 = std::min(2 * i + 1, width - 1);
+				format::RGBA8 const& a = row0[x0];
+				format::RGBA8 const& b = row0[x1];
+				format::RGBA8 const& c = row1[x0];
+				format::RGBA8 const& d = row1[x1];
+				dest[i] = {
+					GLubyte((a.r + b.r + c.r + d.r + 2) / 4),
+					GLubyte((a.g + b.g + c.g + d.g + 2) / 4),
+					GLubyte((a.b + b.b + c.b + d.b + 2) / 4),
+					GLubyte((a.a + b.a + c.a + d.a + 2) / 4)
+				};
+			}
+		}
+
+		static void box_row_scalar(format::RGBA8 const* row0, format::RGBA8 const* row1, size_t width, format::RGBA8* dest, size_t out_width) {
+			box_scalar(row0, row1, width, dest, 0, out_width);
+		}
+
+
+#ifdef GLAZY_MIP_X86
+
+		static void horizontal_row_sse2(float const* source, size_t width, float* dest, size_t out_width, Kernel const& kernel) {
+			size_t begin, end;
+			interior(width, out_width, kernel, begin, end);
+			size_t taps = kernel.weights.size();
+			for (size_t i = begin; i < end; i++) {
+				float const* texel = source + (long(2 * i) + kernel.first) * 4;
+				__m128 sum = _mm_setzero_ps();
+				for (size_t tap = 0; tap < taps; tap++) {
+					__m128 weight = _mm_set1_ps(kernel.weights[tap]);
+					sum = _mm_add_ps(sum, _mm_mul_ps(weight, _mm_loadu_ps(texel + tap * 4)));
+				}
+				_mm_storeu_ps(dest + i * 4, sum);
+			}
+			horizontal_scalar(source, width, dest, 0, begin, kernel);
+			horizontal_scalar(source, width, dest, end, out_width, kernel);
+		}
+
+		static void vertical_sse2(float const* const* rows, Kernel const& kernel, float* dest, size_t count) {
+			size_t taps = kernel.weights.size();
+			size_t f = 0;
+			for (; f + 4 <= count; f += 4) {
+				__m128 sum = _mm_setzero_ps();
+				for (size_t tap = 0; tap < taps; tap++) {
+					__m128 weight = _mm_set1_ps(kernel.weights[tap]);
+					sum = _mm_add_ps(sum, _mm_mul_ps(weight, _mm_loadu_ps(rows[tap] + f)));
+				}
+				_mm_storeu_ps(dest + f, sum);
+			}
+			float const* rest[16];
+			for (size_t tap = 0; tap < taps; tap++) {
+				rest[tap] = rows[tap] + f;
+			}
+			vertical_scalar(rest, kernel, dest + f, count - f);
+		}
+
+		// Sums two texels from each of two rows, giving the two 2x2 averages
+		// of four adjacent texels
+		static __m128i box_sse2_half(__m128i top, __m128i bottom) {
+			__m128i zero = _mm_setzero_si128();
+			__m128i low = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+			__m128i high = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+			__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(low, high), _mm_unpackhi_epi64(low, high));
+			return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+		}
+
+		static void box_row_sse2(format::RGBA8 const* row0, format::RGBA8 const* row1, size_t width, format::RGBA8* dest, size_t out_width) {
+			size_t i = 0;
+			for (; i + 4 <= width / 2; i += 4) {
+				__m128i const* top = reinterpret_cast<__m128i const*>(row0 + 2 * i);
+				__m128i const* bottom = reinterpret_cast<__m128i const*>(row1 + 2 * i);
+				__m128i first = box_sse2_half(_mm_loadu_si128(top), _mm_loadu_si128(bottom));
+				__m128i second = box_sse2_half(_mm_loadu_si128(top + 1), _mm_loadu_si128(bottom + 1));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_packus_epi16(first, second));
+			}
+			box_scalar(row0, row1, width, dest, i, out_width);
+		}
+
+
+		__attribute__((target("avx2")))
+		static void horizontal_row_avx2(float const* source, size_t width, float* dest, size_t out_width, Kernel const& kernel) {
+			size_t begin, end;
+			interior(width, out_width, kernel, begin, end);
+			size_t taps = kernel.weights.size();
+			size_t i = begin;
+			// Two output texels at a time, one in each half of the register
+			for (; i + 2 <= end; i += 2) {
+				float const* texel = source + (long(2 * i) + kernel.first) * 4;
+				__m256 sum = _mm256_setzero_ps();
+				for (size_t tap = 0; tap < taps; tap++) {
+					__m256 weight = _mm256_set1_ps(kernel.weights[tap]);
+					__m256 pair = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(texel + tap * 4)), _mm_loadu_ps(texel + 8 + tap * 4), 1);
+					sum = _mm256_add_ps(sum, _mm256_mul_ps(weight, pair));
+				}
+				_mm256_storeu_ps(dest + i * 4, sum);
+			}
+			for (; i < end; i++) {
+				float const* texel = source + (long(2 * i) + kernel.first) * 4;
+				__m128 sum = _mm_setzero_ps();
+				for (size_t tap = 0; tap < taps; tap++) {
+					__m128 weight = _mm_set1_ps(kernel.weights[tap]);
+					sum = _mm_add_ps(sum, _mm_mul_ps(weight, _mm_loadu_ps(texel + tap * 4)));
+				}
+				_mm_storeu_ps(dest + i * 4, sum);
+			}
+			horizontal_scalar(source, width, dest, 0, begin, kernel);
+			horizontal_scalar(source, width, dest, end, out_width, kernel);
+		}
+
+		__attribute__((target("avx2")))
+		static void vertical_avx2(float const* const* rows, Kernel const& kernel, float* dest, size_t count) {
+			size_t taps = kernel.weights.size();
+			size_t f = 0;
+			for (; f + 8 <= count; f += 8) {
+				__m256 sum = _mm256_setzero_ps();
+				for (size_t tap = 0; tap < taps; tap++) {
+					__m256 weight = _mm256_set1_ps(kernel.weights[tap]);
+					sum = _mm256_add_ps(sum, _mm256_mul_ps(weight, _mm256_loadu_ps(rows[tap] + f)));
+				}
+				_mm256_storeu_ps(dest + f, sum);
+			}
+			float const* rest[16];
+			for (size_t tap = 0; tap < taps; tap++) {
+				rest[tap] = rows[tap] + f;
+			}
+			vertical_sse2(rest, kernel, dest + f, count - f);
+		}
+
+		__attribute__((target("avx2")))
+		static __m256i box_avx2_half(__m256i top, __m256i bottom) {
+			__m256i zero = _mm256_setzero_si256();
+			__m256i low = _mm256_add_epi16(_mm256_unpacklo_epi8(top, zero), _mm256_unpacklo_epi8(bottom, zero));
+			__m256i high = _mm256_add_epi16(_mm256_unpackhi_epi8(top, zero), _mm256_unpackhi_epi8(bottom, zero));
+			__m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(low, high), _mm256_unpackhi_epi64(low, high));
+			return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(2)), 2);
+		}
+
+		__attribute__((target("avx2")))
+		static void box_row_avx2(format::RGBA8 const* row0, format::RGBA8 const* row1, size_t width, format::RGBA8* dest, size_t out_width) {
+			size_t i = 0;
+			for (; i + 8 <= width / 2; i += 8) {
+				__m256i const* top = reinterpret_cast<__m256i const*>(row0 + 2 * i);
+				__m256i const* bottom = reinterpret_cast<__m256i const*>(row1 + 2 * i);
+				__m256i first = box_avx2_half(_mm256_loadu_si256(top), _mm256_loadu_si256(bottom));
+				__m256i second = box_avx2_half(_mm256_loadu_si256(top + 1), _mm256_loadu_si256(bottom + 1));
+				// Packing works within each 128-bit half, which leaves the four
+				// pairs of outputs out of order
+				__m256i packed = _mm256_packus_epi16(first, second);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+			}
+			box_row_sse2(row0 + 2 * i, row1 + 2 * i, width - 2 * i, dest + i, out_width - i);
+		}
+
+#endif
+
+
+		// The loops of one path
+		struct Loops {
+			void (*horizontal)(float const*, size_t, float*, size_t, Kernel const&);
+			void (*vertical)(float const* const*, Kernel const&, float*, size_t);
+			void (*box)(format::RGBA8 const*, format::RGBA8 const*, size_t, format::RGBA8*, size_t);
+		};
+
+		Path best_path() {
+#ifdef GLAZY_MIP_X86
+			if (__builtin_cpu_supports("avx2")) {
+				return Path::avx2;
+			}
+			return Path::sse2;
+#else
+			return Path::scalar;
+#endif
+		}
+
+		static Loops loops_for(Path path) {
+			if (path == Path::best) {
+				path = best_path();
+			}
+#ifdef GLAZY_MIP_X86
+			if ((path == Path::avx2) && __builtin_cpu_supports("avx2")) {
+				return { horizontal_row_avx2, vertical_avx2, box_row_avx2 };
+			}
+			if (path != Path::scalar) {
+				return { horizontal_row_sse2, vertical_sse2, box_row_sse2 };
+			}
+#endif
+			return { horizontal_row_scalar, vertical_scalar, box_row_scalar };
+		}
+
+
+		// Threads that run numbered tasks, kept alive across every level of a
+		// chain. The calling thread takes tasks too.
+		class Workers {
+
+			std::vector<std::thread> threads;
+			std::mutex mutex;
+			std::condition_variable wake;
+			std::condition_variable done;
+			std::function<void(size_t)> const* task;
+			size_t task_count;
+			std::atomic<size_t> next;
+			size_t busy;
+			size_t generation;
+			bool stopping;
+
+			void take_tasks() {
+				for (size_t index = next++; index < task_count; index = next++) {
+					(*task)(index);
+				}
+			}
+
+			void work() {
+				size_t seen = 0;
+				while (true) {
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						wake.wait(lock, [&]() { return stopping || (generation != seen); });
+						if (stopping) {
+							return;
+						}
+						seen = generation;
+					}
+					take_tasks();
+					std::lock_guard<std::mutex> lock(mutex);
+					if (--busy == 0) {
+						done.notify_one();
+					}
+				}
+			}
+
+		public:
+
+			Workers(size_t count)
+				: task(nullptr)
+				, task_count(0)
+				, next(0)
+				, busy(0)
+				, generation(0)
+				, stopping(false)
+			{
+				for (size_t i = 1; i < count; i++) {
+					threads.emplace_back(&Workers::work, this);
+				}
+			}
+
+			~Workers() {
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					stopping = true;
+				}
+				wake.notify_all();
+				for (std::thread& thread : threads) {
+					thread.join();
+				}
+			}
+
+			void run(size_t count, std::function<void(size_t)> const& body) {
+				if (threads.empty() || (count < 2)) {
+					for (size_t index = 0; index < count; index++) {
+						body(index);
+					}
+					return;
+				}
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					task = &body;
+					task_count = count;
+					next = 0;
+					busy = threads.size();
+					generation++;
+				}
+				wake.notify_all();
+				take_tasks();
+				std::unique_lock<std::mutex> lock(mutex);
+				done.wait(lock, [&]() { return busy == 0; });
+			}
+
+		};
+
+
+		// Output rows per task. Neighbouring float bands filter some of the
+		// same source rows, so bands are as tall as they can be while their
+		// intermediate rows still mostly fit in cache.
+		static size_t const float_band = 16;
+		static size_t const box_band = 32;
+
+		// Filters output rows [first_row, end_row) of the level below 'source'
+		static void filter_band(
+			std::span<format::RGBA8 const> source, size_t width, size_t height,
+			format::RGBA8* dest, size_t out_width,
+			size_t first_row, size_t end_row,
+			Kernel const& kernel, Loops const& loops, bool srgb
+		) {
+			static thread_local std::vector<float> decoded;
+			static thread_local std::vector<float> filtered;
+			static thread_local std::vector<float> result;
+
+			size_t taps = kernel.weights.size();
+			size_t stride = out_width * 4;
+			long low = long(2 * first_row) + kernel.first;
+			long high = long(2 * (end_row - 1)) + kernel.first + long(taps) - 1;
+			decoded.resize(width * 4);
+			filtered.resize(size_t(high - low + 1) * stride);
+			result.resize(stride);
+
+			// Horizontal pass over every source row the band's taps reach
+			for (long row = low; row <= high; row++) {
+				long y = std::clamp<long>(row, 0, long(height) - 1);
+				decode_row(source.data() + size_t(y) * width, width, decoded.data(), srgb);
+				loops.horizontal(decoded.data(), width, filtered.data() + size_t(row - low) * stride, out_width, kernel);
+			}
+			// Vertical pass
+			float const* rows[16];
+			for (size_t j = first_row; j < end_row; j++) {
+				for (size_t tap = 0; tap < taps; tap++) {
+					rows[tap] = filtered.data() + size_t(long(2 * j) + kernel.first + long(tap) - low) * stride;
+				}
+				loops.vertical(rows, kernel, result.data(), stride);
+				encode_row(result.data(), out_width, dest + j * out_width, srgb);
+			}
+		}
+
+		static std::vector<format::RGBA8> downsample_with(std::span<format::RGBA8 const> texels, size_t width, size_t height, Options const& options, Workers& workers) {
+			size_t out_width = std::max<size_t>(width / 2, 1);
+			size_t out_height = std::max<size_t>(height / 2, 1);
+			std::vector<format::RGBA8> result(out_width * out_height);
+			Loops loops = loops_for(options.path);
+
+			// A box filter over linear values needs no conversion to float
+			if ((options.filter == Filter::box) && !options.srgb) {
+				size_t bands = (out_height + box_band - 1) / box_band;
+				workers.run(bands, [&](size_t band) {
+					size_t end_row = std::min((band + 1) * box_band, out_height);
+					for (size_t j = band * box_band; j < end_row; j++) {
+						format::RGBA8 const* row0 = texels.data() + std::min(2 * j, height - 1) * width;
+						format::RGBA8 const* row1 = texels.data() + std::min(2 * j + 1, height - 1) * width;
+						loops.box(row0, row1, width, result.data() + j * out_width, out_width);
+					}
+				});
+				return result;
+			}
+
+			Kernel const& kernel = kernel_for(options.filter);
+			size_t bands = (out_height + float_band - 1) / float_band;
+			workers.run(bands, [&](size_t band) {
+				size_t end_row = std::min((band + 1) * float_band, out_height);
+				filter_band(texels, width, height, result.data(), out_width, band * float_band, end_row, kernel, loops, options.srgb);
+			});
+			return result;
+		}
+
+
+		// Fraction of texels whose alpha, scaled, lands above the threshold,
+		// counted from a histogram of the level's alpha values
+		static float coverage(size_t const histogram[256], size_t count, float threshold, float scale) {
+			size_t covered = 0;
+			for (size_t alpha = 0; alpha < 256; alpha++) {
+				float scaled = std::min(255.0f, float(alpha) * scale + 0.5f);
+				if (std::floor(scaled) > threshold * 255.0f) {
+					covered += histogram[alpha];
+				}
+			}
+			return float(covered) / float(count);
+		}
+
+		static void alpha_histogram(std::vector<format::RGBA8> const& level, size_t histogram[256]) {
+			std::fill(histogram, histogram + 256, 0);
+			for (format::RGBA8 const& texel : level) {
+				histogram[texel.a]++;
+			}
+		}
+
+		// Scales a level's alpha so its coverage comes as close to 'target' as
+		// a scale can bring it
+		static void preserve_coverage(std::vector<format::RGBA8>& level, float threshold, float target) {
+			size_t histogram[256];
+			alpha_histogram(level, histogram);
+			// Coverage only grows with the scale, so the scale is found by
+			// bisection
+			float low = 0.0f;
+			float high = 4.0f;
+			for (size_t step = 0; step < 20; step++) {
+				float middle = (low + high) / 2.0f;
+				if (coverage(histogram, level.size(), threshold, middle) < target) {
+					low = middle;
+				}
+				else {
+					high = middle;
+				}
+			}
+			// Coverage moves in steps, so the bounds can land either side of it
+			float below = coverage(histogram, level.size(), threshold, low);
+			float above = coverage(histogram, level.size(), threshold, high);
+			float scale = ((target - below) < (above - target)) ? low : high;
+			GLubyte scaled[256];
+			for (size_t alpha = 0; alpha < 256; alpha++) {
+				scaled[alpha] = GLubyte(std::min(255.0f, float(alpha) * scale + 0.5f));
+			}
+			for (format::RGBA8& texel : level) {
+				texel.a = scaled[texel.a];
+			}
+		}
+
+		// Threads for filtering an image of the given height. Later levels are
+		// smaller, so threads beyond the bands of the first level never have
+		// work, and an image with a single band is filtered on the calling
+		// thread alone.
+		static size_t thread_count(Options const& options, size_t height) {
+			size_t count = options.threads;
+			if (count == 0) {
+				count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+			}
+			size_t out_height = std::max<size_t>(height / 2, 1);
+			size_t bands = (out_height + float_band - 1) / float_band;
+			return (bands < 2) ? 1 : std::min(count, bands);
+		}
+
+		std::vector<format::RGBA8> downsample(std::span<format::RGBA8 const> texels, size_t width, size_t height, Options const& options) {
+			if ((width == 0) || (height == 0) || (texels.size() != width * height)) {
+				throw std::runtime_error("Cannot downsample " + std::to_string(texels.size()) + " texels as a "
+					+ std::to_string(width) + "x" + std::to_string(height) + " image.");
+			}
+			Workers workers(thread_count(options, height));
+			return downsample_with(texels, width, height, options, workers);
+		}
+
+		std::vector<std::vector<format::RGBA8>> chain(std::vector<format::RGBA8> level, size_t width, size_t height, Options const& options) {
+			if ((width == 0) || (height == 0) || (level.size() != width * height)) {
+				throw std::runtime_error("Cannot build a mip chain from " + std::to_string(level.size()) + " texels as a "
+					+ std::to_string(width) + "x" + std::to_string(height) + " image.");
+			}
+			Workers workers(thread_count(options, height));
+			std::vector<std::vector<format::RGBA8>> levels;
+			levels.push_back(std::move(level));
+			while ((width > 1) || (height > 1)) {
+				levels.push_back(downsample_with(levels.back(), width, height, options, workers));
+				width = std::max<size_t>(width / 2, 1);
+				height = std::max<size_t>(height / 2, 1);
+			}
+			// Each level is filtered from the unscaled level above it, so scaling
+			// waits until the whole chain is built
+			if (options.alpha_coverage >= 0.0f) {
+				size_t histogram[256];
+				alpha_histogram(levels[0], histogram);
+				float target = coverage(histogram, levels[0].size(), options.alpha_coverage, 1.0f);
+				for (size_t index = 1; index < levels.size(); index++) {
+					preserve_coverage(levels[index], options.alpha_coverage, target);
+				}
+			}
+			return levels;
+		}
+
+	}
+
+}
@@ -0,0 +1,208 @@
+
+#include "glazy_objects.h"
+
+namespace glazy {
+
+	NamePool::NamePool(Kind kind, size_t batch)
+		: kind(kind)
+		, batch(batch)
+	{}
+
+	void NamePool::refill() {
+		safety::entry_guard("NamePool::refill");
+		size_t first = spare.size();
+		spare.resize(first + batch, 0);
+		GLuint* names = spare.data() + first;
+		bool dsa = context::capabilities().direct_state_access;
+		switch (kind) {
+		case Kind::buffer:
+			dsa ? glCreateBuffers(batch, names) : glGenBuffers(batch, names);
+			break;
+		case Kind::vertex_array:
+			dsa ? glCreateVertexArrays(batch, names) : glGenVertexArrays(batch, names);
+			break;
+		case Kind::texture_2d:
+			dsa ? glCreateTextures(GL_TEXTURE_2D, batch, names) : glGenTextures(batch, names);
+			break;
+		case Kind::sampler:
+			glGenSamplers(batch, names);
+			break;
+		}
+		safety::exit_guard("NamePool::refill");
+	}
+
+	GLuint NamePool::acquire() {
+		if (spare.empty()) {
+			refill();
+		}
+		GLuint result = spare.back();
+		spare.pop_back();
+		if (result == 0) {
+			throw std::runtime_error("Failed to allocate GL object names.");
+		}
+		return result;
+	}
+
+	void NamePool::release() {
+		if (spare.empty()) {
+			return;
+		}
+		switch (kind) {
+		case Kind::buffer:       glDeleteBuffers(spare.size(), spare.data());      break;
+		case Kind::vertex_array: glDeleteVertexArrays(spare.size(), spare.data()); break;
+		case Kind::texture_2d:   glDeleteTextures(spare.size(), spare.data());     break;
+		case Kind::sampler:      glDeleteSamplers(spare.size(), spare.data());     break;
+		}
+		spare.clear();
+	}
+
+
+	DeletionQueue::DeletionQueue()
+		: deferring(false)
+		, pending{ nullptr, {} }
+		, totals{ 0, 0, 0 }
+	{}
+
+	void DeletionQueue::defer(Kind kind, GLuint id) {
+		if (id == 0) {
+			return;
+		}
+		totals.deferred++;
+		pending.names[static_cast<size_t>(kind)].push_back(id);
+		if (!deferring) {
+			destroy(pending);
+		}
+	}
+
+	void DeletionQueue::destroy(Batch& batch) {
+		safety::entry_guard("DeletionQueue::destroy");
+		// GL reverts bindings of deleted objects to zero, so the state cache is
+		// told at the moment of deletion rather than when the owner died
+		StateCache& cache = StateCache::current();
+		bool any = false;
+		for (size_t kind = 0; kind < kind_count; kind++) {
+			std::vector<GLuint>& names = batch.names[kind];
+			if (names.empty()) {
+				continue;
+			}
+			switch (static_cast<Kind>(kind)) {
+			case Kind::buffer:
+				glDeleteBuffers(names.size(), names.data());
+				for (GLuint id : names) {
+					cache.forget_buffer(id);
+				}
+				break;
+			case Kind::vertex_array:
+				glDeleteVertexArrays(names.size(), names.data());
+				for (GLuint id : names) {
+					cache.forget_vertex_array(id);
+				}
+				break;
+			case Kind::texture:
+				glDeleteTextures(names.size(), names.data());
+				for (GLuint id : names) {
+					cache.forget_texture(id);
+				}
+				break;
+			case Kind::sampler:
+				glDeleteSamplers(names.size(), names.data());
+				for (GLuint id : names) {
+					cache.forget_sampler(id);
+				}
+				break;
+			case Kind::program:
+				// Programs have no batched delete
+				for (GLuint id : names) {
+					glDeleteProgram(id);
+					cache.forget_program(id);
+				}
+				break;
+			case Kind::pipeline:
+				glDeleteProgramPipelines(names.size(), names.data());
+				for (GLuint id : names) {
+					cache.forget_program_pipeline(id);
+				}
+				break;
+			}
+			totals.deleted += names.size();
+			names.clear();
+			any = true;
+		}
+		if (batch.fence != nullptr) {
+			glDeleteSync(batch.fence);
+			batch.fence = nullptr;
+		}
+		if (any) {
+			totals.batches++;
+		}
+		safety::exit_guard("DeletionQueue::destroy");
+	}
+
+	void DeletionQueue::end_frame() {
+		deferring = true;
+		bool any = false;
+		for (std::vector<GLuint> const& names : pending.names) {
+			any = any || !names.empty();
+		}
+		if (any) {
+			pending.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			fenced.push_back(std::move(pending));
+			pending = Batch{ nullptr, {} };
+		}
+		// Fences signal in order, so the first unsignalled one ends the search
+		while (!fenced.empty()) {
+			GLenum status = glClientWaitSync(fenced.front().fence, 0, 0);
+			if ((status != GL_ALREADY_SIGNALED) && (status != GL_CONDITION_SATISFIED)) {
+				break;
+			}
+			destroy(fenced.front());
+			fenced.pop_front();
+		}
+	}
+
+	void DeletionQueue::flush() {
+		while (!fenced.empty()) {
+			glClientWaitSync(fenced.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			destroy(fenced.front());
+			fenced.pop_front();
+		}
+		destroy(pending);
+	}
+
+	size_t DeletionQueue::backlog() const {
+		size_t result = fenced.size();
+		for (std::vector<GLuint> const& names : pending.names) {
+			if (!names.empty()) {
+				return result + 1;
+			}
+		}
+		return result;
+	}
+
+	DeletionQueue::Counters DeletionQueue::counters() const {
+		return totals;
+	}
+
+
+	ContextObjects::ContextObjects()
+		: buffers(NamePool::Kind::buffer)
+		, vertex_arrays(NamePool::Kind::vertex_array)
+		, textures(NamePool::Kind::texture_2d)
+		, samplers(NamePool::Kind::sampler)
+	{}
+
+	ContextObjects& ContextObjects::current() {
+		return detail::PerContext<ContextObjects>::current();
+	}
+
+	void ContextObjects::release(GLFWwindow* window) {
+		ContextObjects& objects = current();
+		objects.deletions.flush();
+		objects.buffers.release();
+		objects.vertex_arrays.release();
+		objects.textures.release();
+		objects.samplers.release();
+		detail::PerContext<ContextObjects>::release(window);
+	}
+
+}
@@ -0,0 +1,158 @@
+
+#include "glazy_pipeline.h"
+#include "glazy_objects.h"
+
+namespace glazy {
+
+	static GLbitfield const stage_bits[5] = {
+		GL_VERTEX_SHADER_BIT,
+		GL_TESS_CONTROL_SHADER_BIT,
+		GL_TESS_EVALUATION_SHADER_BIT,
+		GL_GEOMETRY_SHADER_BIT,
+		GL_FRAGMENT_SHADER_BIT,
+	};
+
+	size_t ProgramPipeline::stage_index(GLenum kind) {
+		switch (kind) {
+		case GL_VERTEX_SHADER:          return 0;
+		case GL_TESS_CONTROL_SHADER:    return 1;
+		case GL_TESS_EVALUATION_SHADER: return 2;
+		case GL_GEOMETRY_SHADER:        return 3;
+		case GL_FRAGMENT_SHADER:        return 4;
+		default:
+			throw std::runtime_error("Invalid shader stage " + std::to_string(kind) + " for program pipeline.");
+		}
+	}
+
+	ProgramPipeline::ProgramPipeline()
+		: stages{ nullptr, nullptr, nullptr, nullptr, nullptr }
+	{
+		safety::entry_guard("ProgramPipeline::ProgramPipeline");
+		glGenProgramPipelines(1, &id);
+		if (id == 0) {
+			throw std::runtime_error("Failed to allocate id for program pipeline.");
+		}
+		safety::exit_guard("ProgramPipeline::ProgramPipeline");
+	}
+
+	ProgramPipeline::ProgramPipeline(ProgramPipeline&& other)
+		: id(other.id)
+	{
+		std::copy(other.stages, other.stages + 5, stages);
+		other.id = 0;
+	}
+
+	ProgramPipeline::~ProgramPipeline() {
+		ContextObjects::current().deletions.defer(DeletionQueue::Kind::pipeline, id);
+	}
+
+	void ProgramPipeline::use_stage(GLenum kind, GPUProgram& program) {
+		safety::entry_guard("ProgramPipeline::use_stage");
+		size_t index = stage_index(kind);
+		glUseProgramStages(id, stage_bits[index], program);
+		stages[index] = &program;
+		safety::exit_guard("ProgramPipeline::use_stage");
+	}
+
+	GPUProgram* ProgramPipeline::stage(GLenum kind) const {
+		return stages[stage_index(kind)];
+	}
+
+	void ProgramPipeline::validate() {
+		safety::entry_guard("ProgramPipeline::validate");
+		glValidateProgramPipeline(id);
+		GLint status;
+		glGetProgramPipelineiv(id, GL_VALIDATE_STATUS, &status);
+		if (!status) {
+			GLint log_length;
+			glGetProgramPipelineiv(id, GL_INFO_LOG_LENGTH, &log_length);
+			std::string log_text((size_t)log_length, '\0');
+			GLsizei written;
+			glGetProgramPipelineInfoLog(id, log_length, &written, reinterpret_cast<GLchar*>((char*)log_text.data()));
+			std::string message = "Program pipeline validation failed. Error log:\n\n\"\"\"\n";
+			message += log_text.c_str();
+			message += "\n\"\"\"\n";
+			throw std::runtime_error(message);
+		}
+		safety::exit_guard("ProgramPipeline::validate");
+	}
+
+	void ProgramPipeline::bind() {
+		StateCache::current().bind_program_pipeline(id);
+	}
+
+	ProgramPipeline::operator GLuint() const {
+		return id;
+	}
+
+
+	PipelineCache::PipelineCache(ShaderPreprocessor const* preprocessor)
+		: preprocessor(preprocessor)
+	{}
+
+	GPUProgram& PipelineCache::stage(GLenum kind, std::string const& path) {
+		std::string key = std::to_string(kind) + "\n" + path;
+		auto iter = stages.find(key);
+		if (iter != stages.end()) {
+			return iter->second;
+		}
+		std::string text = (preprocessor != nullptr) ? preprocessor->process(path).text : file::read_file_to_string(path);
+		auto link = [&]() {
+			switch (kind) {
+			case GL_VERTEX_SHADER:          return GPUProgram::separable(Shader<GL_VERTEX_SHADER>(text));
+			case GL_TESS_CONTROL_SHADER:    return GPUProgram::separable(Shader<GL_TESS_CONTROL_SHADER>(text));
+			case GL_TESS_EVALUATION_SHADER: return GPUProgram::separable(Shader<GL_TESS_EVALUATION_SHADER>(text));
+			case GL_GEOMETRY_SHADER:        return GPUProgram::separable(Shader<GL_GEOMETRY_SHADER>(text));
+			case GL_FRAGMENT_SHADER:        return GPUProgram::separable(Shader<GL_FRAGMENT_SHADER>(text));
+			default:
+				throw std::runtime_error("Invalid shader stage " + std::to_string(kind) + " for separable program.");
+			}
+		};
+		return stages.emplace(key, link()).first->second;
+	}
+
+	ProgramPipeline& PipelineCache::pipeline(ProgramFiles const& files) {
+		if (files.vertex.empty() || files.fragment.empty()) {
+			throw std::runtime_error("Render pipeline must have a vertex shader and a fragment shader.");
+		}
+		if (files.tess_control.empty() != files.tess_evaluation.empty()) {
+			throw std::runtime_error("Render pipeline must have both tesselation shader stages or neither.");
+		}
+		std::string key = files.vertex + "\n" + files.tess_control + "\n" + files.tess_evaluation
+			+ "\n" + files.geometry + "\n" + files.fragment;
+		auto iter = pipelines.find(key);
+		if (iter != pipelines.end()) {
+			return iter->second;
+		}
+		ProgramPipeline result;
+		std::pair<GLenum, std::string const*> const parts[] = {
+			{ GL_VERTEX_SHADER,          &files.vertex },
+			{ GL_TESS_CONTROL_SHADER,    &files.tess_control },
+			{ GL_TESS_EVALUATION_SHADER, &files.tess_evaluation },
+			{ GL_GEOMETRY_SHADER,        &files.geometry },
+			{ GL_FRAGMENT_SHADER,        &files.fragment },
+		};
+		for (auto const& part : parts) {
+			if (!part.second->empty()) {
+				result.use_stage(part.first, stage(part.first, *part.second));
+			}
+		}
+		return pipelines.emplace(key, std::move(result)).first->second;
+	}
+
+	ProgramPipeline& PipelineCache::pipeline(std::string const& vertex_path, std::string const& fragment_path) {
+		ProgramFiles files;
+		files.vertex = vertex_path;
+		files.fragment = fragment_path;
+		return pipeline(files);
+	}
+
+	size_t PipelineCache::stage_count() const {
+		return stages.size();
+	}
+
+	size_t PipelineCache::pipeline_count() const {
+		return pipelines.size();
+	}
+
+}
@@ -0,0 +1,242 @@
+
+#include "glazy_preprocess.h"
+#include <sstream>
+#include <unordered_set>
+#include <algorithm>
+
+namespace glazy {
+
+	struct ShaderPreprocessor::State {
+		std::vector<std::string> const* defines;
+		std::ostringstream text;
+		std::vector<std::string> files;
+		// Files containing '#pragma once' that have been expanded
+		std::unordered_set<std::string> once;
+		// Files currently being expanded, to catch include cycles
+		std::vector<std::string> open;
+	};
+
+	// The directive on a line, such as "include" for '  # include "x.glsl"',
+	// with 'rest' set to what follows it. Empty if the line is no directive.
+	static std::string directive(std::string const& line, std::string& rest) {
+		size_t start = line.find_first_not_of(" \t");
+		if ((start == std::string::npos) || (line[start] != '#')) {
+			return "";
+		}
+		start = line.find_first_not_of(" \t", start + 1);
+		if (start == std::string::npos) {
+			return "";
+		}
+		size_t end = line.find_first_of(" \t", start);
+		rest = (end == std::string::npos) ? "" : line.substr(end);
+		return line.substr(start, end - start);
+	}
+
+	static std::string trim(std::string const& text) {
+		size_t start = text.find_first_not_of(" \t");
+		if (start == std::string::npos) {
+			return "";
+		}
+		size_t end = text.find_last_not_of(" \t");
+		return text.substr(start, end - start + 1);
+	}
+
+
+	ShaderPreprocessor::ShaderPreprocessor(std::vector<std::string> include_paths) {
+		for (std::string const& path : include_paths) {
+			this->include_paths.push_back(path);
+		}
+	}
+
+	std::filesystem::path ShaderPreprocessor::resolve(std::string const& name, std::filesystem::path const& from) const {
+		std::filesystem::path local = from.parent_path() / name;
+		if (std::filesystem::exists(local)) {
+			return std::filesystem::weakly_canonical(local);
+		}
+		for (std::filesystem::path const& directory : include_paths) {
+			std::filesystem::path candidate = directory / name;
+			if (std::filesystem::exists(candidate)) {
+				return std::filesystem::weakly_canonical(candidate);
+			}
+		}
+		throw std::runtime_error("Could not find shader include '" + name + "', included from '" + from.string() + "'.");
+	}
+
+	void ShaderPreprocessor::expand(std::filesystem::path const& path, State& state, bool root) const {
+		std::string name = path.string();
+		if (state.once.count(name) != 0) {
+			return;
+		}
+		for (std::string const& open : state.open) {
+			if (open == name) {
+				throw std::runtime_error("Shader include cycle through '" + name + "'. Add '#pragma once' or an include guard.");
+			}
+		}
+		if (!std::filesystem::exists(path)) {
+			throw std::runtime_error("Could not find shader source '" + name + "'.");
+		}
+
+		size_t index = state.files.size();
+		state.files.push_back(name);
+		state.open.push_back(name);
+		if (!root) {
+			state.text << "#line 1 " << index << "\n";
+		}
+
+		std::string text = file::read_file_to_string(name);
+		// Without a #version line, the defines go first
+		if (root && (text.find("#version") == std::string::npos)) {
+			for (std::string const& define : *state.defines) {
+				state.text << "#define " << define << "\n";
+			}
+			state.text << "#line 1 " << index << "\n";
+		}
+
+		std::istringstream source(text);
+		std::string line;
+		size_t number = 0;
+		while (std::getline(source, line)) {
+			number++;
+			if (!line.empty() && (line.back() == '\r')) {
+				line.pop_back();
+			}
+			std::string rest;
+			std::string kind = directive(line, rest);
+			if (kind == "version") {
+				// Only the root file may choose the version, and the defines must
+				// come after it
+				if (root) {
+					state.text << line << "\n";
+					for (std::string const& define : *state.defines) {
+						state.text << "#define " << define << "\n";
+					}
+					state.text << "#line " << (number + 1) << " " << index << "\n";
+				}
+				else {
+					state.text << "\n";
+				}
+			}
+			else if ((kind == "pragma") && (trim(rest) == "once")) {
+				state.once.insert(name);
+				state.text << "\n";
+			}
+			else if (kind == "include") {
+				std::string target = trim(rest);
+				if ((target.size() < 2)
+					|| !(((target.front() == '"') && (target.back() == '"')) || ((target.front() == '<') && (target.back() == '>')))) {
+					throw std::runtime_error("Malformed #include in '" + name + "' at line " + std::to_string(number) + ".");
+				}
+				expand(resolve(target.substr(1, target.size() - 2), path), state, false);
+				state.text << "#line " << (number + 1) << " " << index << "\n";
+			}
+			else {
+				state.text << line << "\n";
+			}
+		}
+		state.open.pop_back();
+	}
+
+	ShaderPreprocessor::Output ShaderPreprocessor::process(std::string const& path, std::vector<std::string> const& defines) const {
+		State state;
+		state.defines = &defines;
+		expand(std::filesystem::weakly_canonical(path), state, true);
+		return { state.text.str(), std::move(state.files) };
+	}
+
+
+	ProgramVariants::ProgramVariants(
+		ShaderPreprocessor const& preprocessor,
+		ProgramFiles files,
+		std::vector<std::string> features,
+		Setup setup,
+		ProgramCache* cache,
+		ShaderWatcher* watcher
+	)
+		: preprocessor(preprocessor)
+		, files(std::move(files))
+		, features(std::move(features))
+		, setup(std::move(setup))
+		, cache(cache)
+		, watcher(watcher)
+	{
+		if (this->features.size() > 32) {
+			throw std::runtime_error("Programs may have at most 32 features.");
+		}
+	}
+
+	ProgramVariants::~ProgramVariants() {
+		if (watcher != nullptr) {
+			for (auto& entry : variants) {
+				watcher->unwatch(entry.second);
+			}
+		}
+	}
+
+	ProgramVariants::Key ProgramVariants::key(std::vector<std::string> const& names) const {
+		Key result = 0;
+		for (std::string const& name : names) {
+			auto iter = std::find(features.begin(), features.end(), name);
+			if (iter == features.end()) {
+				throw std::runtime_error("Program has no feature '" + name + "'.");
+			}
+			result |= Key(1) << (iter - features.begin());
+		}
+		return result;
+	}
+
+	ProgramSources ProgramVariants::sources(Key key, std::vector<std::string>* dependencies) const {
+		std::vector<std::string> defines;
+		for (size_t index = 0; index < features.size(); index++) {
+			if ((key >> index) & 1) {
+				defines.push_back(features[index]);
+			}
+		}
+		auto process = [&](std::string const& path) {
+			if (path.empty()) {
+				return std::string();
+			}
+			ShaderPreprocessor::Output output = preprocessor.process(path, defines);
+			if (dependencies != nullptr) {
+				dependencies->insert(dependencies->end(), output.files.begin(), output.files.end());
+			}
+			return std::move(output.text);
+		};
+		ProgramSources result;
+		result.vertex = process(files.vertex);
+		result.tess_control = process(files.tess_control);
+		result.tess_evaluation = process(files.tess_evaluation);
+		result.geometry = process(files.geometry);
+		result.fragment = process(files.fragment);
+		return result;
+	}
+
+	GPUProgram ProgramVariants::build(Key key, std::vector<std::string>& dependencies) const {
+		dependencies.clear();
+		ProgramSources variant = sources(key, &dependencies);
+		GPUProgram result = (cache != nullptr) ? cache->load(variant) : variant.build();
+		if (setup) {
+			setup(result);
+		}
+		return result;
+	}
+
+	GPUProgram& ProgramVariants::get(Key key) {
+		auto iter = variants.find(key);
+		if (iter != variants.end()) {
+			return iter->second;
+		}
+		std::vector<std::string> dependencies;
+		GPUProgram& result = variants.emplace(key, build(key, dependencies)).first->second;
+		if (watcher != nullptr) {
+			watcher->watch(result, std::move(dependencies), [this, key](std::vector<std::string>& dependencies) {
+				return build(key, dependencies);
+			});
+		}
+		return result;
+	}
+
+	size_t ProgramVariants::size() const {
+		return variants.size();
+	}
+
+}
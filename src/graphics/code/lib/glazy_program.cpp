@@ -1,6 +1,9 @@
 
 
 #include "glazy_program.h"
+#include "glazy_objects.h"
+#include <cstring>
+#include <algorithm>
 
 
 namespace glazy {
@@ -28,6 +31,219 @@ namespace glazy {
 		template<> void SetUniformV(GLint loc, size_t c, glm::mat4x2* ptr) { glUniformMatrix4x2fv(loc, c, false, reinterpret_cast<GLfloat*>(ptr)); }
 		template<> void SetUniformV(GLint loc, size_t c, glm::mat3x4* ptr) { glUniformMatrix3x4fv(loc, c, false, reinterpret_cast<GLfloat*>(ptr)); }
 		template<> void SetUniformV(GLint loc, size_t c, glm::mat4x3* ptr) { glUniformMatrix4x3fv(loc, c, false, reinterpret_cast<GLfloat*>(ptr)); }
+
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, GLfloat const* ptr) { glProgramUniform1fv(p, loc, c, ptr); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::vec2 const* ptr) { glProgramUniform2fv(p, loc, c, reinterpret_cast<GLfloat const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::vec3 const* ptr) { glProgramUniform3fv(p, loc, c, reinterpret_cast<GLfloat const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::vec4 const* ptr) { glProgramUniform4fv(p, loc, c, reinterpret_cast<GLfloat const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, GLint const* ptr) { glProgramUniform1iv(p, loc, c, ptr); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::ivec2 const* ptr) { glProgramUniform2iv(p, loc, c, reinterpret_cast<GLint const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::ivec3 const* ptr) { glProgramUniform3iv(p, loc, c, reinterpret_cast<GLint const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::ivec4 const* ptr) { glProgramUniform4iv(p, loc, c, reinterpret_cast<GLint const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, GLuint const* ptr) { glProgramUniform1uiv(p, loc, c, ptr); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::uvec2 const* ptr) { glProgramUniform2uiv(p, loc, c, reinterpret_cast<GLuint const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::uvec3 const* ptr) { glProgramUniform3uiv(p, loc, c, reinterpret_cast<GLuint const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::uvec4 const* ptr) { glProgramUniform4uiv(p, loc, c, reinterpret_cast<GLuint const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::mat2 const* ptr) { glProgramUniformMatrix2fv(p, loc, c, false, reinterpret_cast<GLfloat const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::mat3 const* ptr) { glProgramUniformMatrix3fv(p, loc, c, false, reinterpret_cast<GLfloat const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::mat4 const* ptr) { glProgramUniformMatrix4fv(p, loc, c, false, reinterpret_cast<GLfloat const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::mat2x3 const* ptr) { glProgramUniformMatrix2x3fv(p, loc, c, false, reinterpret_cast<GLfloat const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::mat3x2 const* ptr) { glProgramUniformMatrix3x2fv(p, loc, c, false, reinterpret_cast<GLfloat const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::mat2x4 const* ptr) { glProgramUniformMatrix2x4fv(p, loc, c, false, reinterpret_cast<GLfloat const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::mat4x2 const* ptr) { glProgramUniformMatrix4x2fv(p, loc, c, false, reinterpret_cast<GLfloat const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::mat3x4 const* ptr) { glProgramUniformMatrix3x4fv(p, loc, c, false, reinterpret_cast<GLfloat const*>(ptr)); }
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, glm::mat4x3 const* ptr) { glProgramUniformMatrix4x3fv(p, loc, c, false, reinterpret_cast<GLfloat const*>(ptr)); }
+
+		// GL has no boolean setters, so booleans go through as ints
+		template<> void ProgramUniformV(GLuint p, GLint loc, size_t c, GLboolean const* ptr) {
+			if (c == 1) {
+				glProgramUniform1i(p, loc, *ptr);
+				return;
+			}
+			std::vector<GLint> values(ptr, ptr + c);
+			glProgramUniform1iv(p, loc, c, values.data());
+		}
+
+		bool is_sampler(GLenum type) {
+			switch (type) {
+			case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+			case GL_SAMPLER_1D_SHADOW: case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_CUBE_SHADOW:
+			case GL_SAMPLER_1D_ARRAY: case GL_SAMPLER_2D_ARRAY:
+			case GL_SAMPLER_1D_ARRAY_SHADOW: case GL_SAMPLER_2D_ARRAY_SHADOW:
+			case GL_SAMPLER_2D_MULTISAMPLE: case GL_SAMPLER_2D_MULTISAMPLE_ARRAY:
+			case GL_SAMPLER_BUFFER: case GL_SAMPLER_2D_RECT: case GL_SAMPLER_2D_RECT_SHADOW:
+			case GL_INT_SAMPLER_1D: case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_3D: case GL_INT_SAMPLER_CUBE:
+			case GL_INT_SAMPLER_1D_ARRAY: case GL_INT_SAMPLER_2D_ARRAY:
+			case GL_INT_SAMPLER_2D_MULTISAMPLE: case GL_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+			case GL_INT_SAMPLER_BUFFER: case GL_INT_SAMPLER_2D_RECT:
+			case GL_UNSIGNED_INT_SAMPLER_1D: case GL_UNSIGNED_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_3D: case GL_UNSIGNED_INT_SAMPLER_CUBE:
+			case GL_UNSIGNED_INT_SAMPLER_1D_ARRAY: case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+			case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE: case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+			case GL_UNSIGNED_INT_SAMPLER_BUFFER: case GL_UNSIGNED_INT_SAMPLER_2D_RECT:
+				return true;
+			default:
+				return false;
+			}
+		}
+	}
+
+
+	void VariableTable::rehash(size_t capacity) {
+		slots.assign(capacity, -1);
+		size_t mask = capacity - 1;
+		for (size_t index = 0; index < variables.size(); index++) {
+			size_t slot = variables[index].hash & mask;
+			while (slots[slot] != -1) {
+				slot = (slot + 1) & mask;
+			}
+			slots[slot] = static_cast<int32_t>(index);
+		}
+	}
+
+	void VariableTable::insert(ActiveVariable variable) {
+		variables.push_back(std::move(variable));
+		size_t capacity = slots.empty() ? 16 : slots.size();
+		while (capacity < (variables.size() * 2)) {
+			capacity *= 2;
+		}
+		rehash(capacity);
+	}
+
+	void VariableTable::clear() {
+		variables.clear();
+		slots.clear();
+	}
+
+	ActiveVariable const* VariableTable::find(uniform::Name name) const {
+		if (slots.empty()) {
+			return nullptr;
+		}
+		size_t mask = slots.size() - 1;
+		size_t slot = name.hash & mask;
+		while (slots[slot] != -1) {
+			ActiveVariable const& variable = variables[slots[slot]];
+			if ((variable.hash == name.hash) && (variable.name == name.text)) {
+				return &variable;
+			}
+			slot = (slot + 1) & mask;
+		}
+		return nullptr;
+	}
+
+	size_t VariableTable::size() const {
+		return variables.size();
+	}
+
+	std::vector<ActiveVariable> const& VariableTable::all() const {
+		return variables;
+	}
+
+
+	// Bytes taken by one element of a uniform of the given type, as passed to
+	// glProgramUniform*
+	static size_t uniform_value_size(GLenum type) {
+		if (uniform::is_sampler(type)) {
+			return sizeof(GLint);
+		}
+		switch (type) {
+		case GL_FLOAT: case GL_INT: case GL_UNSIGNED_INT: case GL_BOOL:
+			return 4;
+		case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: case GL_BOOL_VEC2: case GL_DOUBLE:
+			return 8;
+		case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: case GL_BOOL_VEC3:
+			return 12;
+		case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: case GL_BOOL_VEC4: case GL_FLOAT_MAT2: case GL_DOUBLE_VEC2:
+			return 16;
+		case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT3x2: case GL_DOUBLE_VEC3:
+			return 24;
+		case GL_FLOAT_MAT2x4: case GL_FLOAT_MAT4x2: case GL_DOUBLE_VEC4: case GL_DOUBLE_MAT2:
+			return 32;
+		case GL_FLOAT_MAT3:
+			return 36;
+		case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x3: case GL_DOUBLE_MAT2x3: case GL_DOUBLE_MAT3x2:
+			return 48;
+		case GL_FLOAT_MAT4: case GL_DOUBLE_MAT2x4: case GL_DOUBLE_MAT4x2:
+			return 64;
+		case GL_DOUBLE_MAT3:
+			return 72;
+		case GL_DOUBLE_MAT3x4: case GL_DOUBLE_MAT4x3:
+			return 96;
+		case GL_DOUBLE_MAT4:
+			return 128;
+		default:
+			return 0;
+		}
+	}
+
+	UniformShadow::UniformShadow()
+		: issued(0)
+		, elided(0)
+	{}
+
+	void UniformShadow::reset(VariableTable const& uniforms) {
+		entries.clear();
+		size_t total = 0;
+		for (ActiveVariable const& variable : uniforms.all()) {
+			size_t size = uniform_value_size(variable.type) * std::max(variable.count, 1);
+			entries.push_back({ total, size, 0 });
+			total += size;
+		}
+		values.assign(total, 0);
+	}
+
+	size_t UniformShadow::add_element(size_t index, size_t element, size_t element_size) {
+		Entry const& array = entries[index];
+		size_t offset = std::min(element * element_size, array.size);
+		// Bytes the array's entry knows are known for the element as well
+		size_t known = (array.known > offset) ? (array.known - offset) : 0;
+		entries.push_back({ array.offset + offset, array.size - offset, known });
+		return entries.size() - 1;
+	}
+
+	bool UniformShadow::update(size_t index, void const* data, size_t size) {
+		if ((index >= entries.size()) || (size > entries[index].size)) {
+			// Not something the shadow has room for, so it is always sent
+			issued++;
+			return true;
+		}
+		Entry& entry = entries[index];
+		unsigned char* stored = values.data() + entry.offset;
+		if ((size <= entry.known) && (std::memcmp(stored, data, size) == 0)) {
+			elided++;
+			return false;
+		}
+		std::memcpy(stored, data, size);
+		// Setting fewer elements of an array than before leaves the rest as
+		// they were
+		entry.known = std::max(entry.known, size);
+		issued++;
+		return true;
+	}
+
+	std::span<unsigned char const> UniformShadow::known_value(size_t index) const {
+		if (index >= entries.size()) {
+			return {};
+		}
+		return { values.data() + entries[index].offset, entries[index].known };
+	}
+
+	size_t UniformShadow::capacity(size_t index) const {
+		return (index < entries.size()) ? entries[index].size : 0;
+	}
+
+	void UniformShadow::forget() {
+		for (Entry& entry : entries) {
+			entry.known = 0;
+		}
+	}
+
+	UniformShadow::Counters UniformShadow::counters() const {
+		return { issued, elided };
+	}
+
+	void UniformShadow::reset_counters() {
+		issued = 0;
+		elided = 0;
 	}
 
 
@@ -42,6 +258,27 @@ namespace glazy {
 		GLint status;
 		glGetProgramiv(id, GL_LINK_STATUS, &status);
 		if (!status) {
+			// Shaders no longer check their own compilation, so their errors
+			// surface here. They are more useful than the link log they cause.
+			GLint shader_count = 0;
+			glGetProgramiv(id, GL_ATTACHED_SHADERS, &shader_count);
+			std::vector<GLuint> shaders(shader_count);
+			glGetAttachedShaders(id, shader_count, nullptr, shaders.data());
+			for (GLuint shader : shaders) {
+				GLint compiled;
+				glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+				if (!compiled) {
+					GLint log_length;
+					glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &log_length);
+					std::string log_text((size_t)log_length, '\0');
+					GLsizei written;
+					glGetShaderInfoLog(shader, log_length, &written, reinterpret_cast<GLchar*>((char*)log_text.data()));
+					std::string message = "Shader compilation failed. Error log:\n\n\"\"\"\n";
+					message += log_text.c_str();
+					message += "\n\"\"\"\n";
+					throw std::runtime_error(message);
+				}
+			}
 			GLint log_length;
 			glGetProgramiv(id, GL_INFO_LOG_LENGTH, &log_length);
 			std::string log_text((size_t)log_length, '\0');
@@ -56,6 +293,81 @@ namespace glazy {
 	}
 
 
+	void GPUProgram::reflect() {
+		safety::entry_guard("GPUProgram::reflect");
+		uniforms.clear();
+		attributes.clear();
+		blocks.clear();
+		elements.clear();
+
+		// Reflection results name arrays after their first element
+		auto strip_array = [](std::string name) {
+			size_t length = name.size();
+			if ((length > 3) && (name.compare(length - 3, 3, "[0]") == 0)) {
+				name.resize(length - 3);
+			}
+			return name;
+		};
+
+		GLint count = 0;
+		GLint max_length = 0;
+		glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+		std::vector<GLchar> buffer(std::max(max_length, 1));
+		for (GLint index = 0; index < count; index++) {
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(id, index, buffer.size(), &length, &size, &type, buffer.data());
+			GLint location = glGetUniformLocation(id, buffer.data());
+			// Members of uniform blocks have no location, and are set through
+			// the block's buffer instead
+			if (location < 0) {
+				continue;
+			}
+			std::string name = strip_array(std::string(buffer.data(), length));
+			uint32_t hash = uniform::hash(name);
+			uniforms.insert({ std::move(name), hash, location, type, size });
+		}
+
+		glGetProgramiv(id, GL_ACTIVE_ATTRIBUTES, &count);
+		glGetProgramiv(id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+		buffer.resize(std::max(max_length, 1));
+		for (GLint index = 0; index < count; index++) {
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveAttrib(id, index, buffer.size(), &length, &size, &type, buffer.data());
+			GLint location = glGetAttribLocation(id, buffer.data());
+			// Built-in inputs, such as gl_VertexID, have no location
+			if (location < 0) {
+				continue;
+			}
+			std::string name = strip_array(std::string(buffer.data(), length));
+			uint32_t hash = uniform::hash(name);
+			attributes.insert({ std::move(name), hash, location, type, size });
+		}
+
+		glGetProgramiv(id, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+		glGetProgramiv(id, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_length);
+		buffer.resize(std::max(max_length, 1));
+		for (GLint index = 0; index < count; index++) {
+			GLsizei length = 0;
+			GLint data_size = 0;
+			glGetActiveUniformBlockName(id, index, buffer.size(), &length, buffer.data());
+			glGetActiveUniformBlockiv(id, index, GL_UNIFORM_BLOCK_DATA_SIZE, &data_size);
+			std::string name(buffer.data(), length);
+			uint32_t hash = uniform::hash(name);
+			blocks.insert({ std::move(name), hash, index, GL_UNIFORM_BUFFER, data_size });
+		}
+		// A new shadow, rather than a reset one, so that handles to an earlier
+		// version of the program cannot vouch for values in this one
+		shadow = std::make_shared<UniformShadow>();
+		shadow->reset(uniforms);
+		safety::exit_guard("GPUProgram::reflect");
+	}
+
+
 
 	void GPUProgram::attach(GLuint shader_id) {
 		safety::entry_guard("GPUProgram::attach");
@@ -63,14 +375,15 @@ namespace glazy {
 		safety::exit_guard("GPUProgram::attach");
 	}
 
-	GPUProgram::GPUProgram(
-		Shader<GL_VERTEX_SHADER>          vertex,
-		Shader<GL_TESS_CONTROL_SHADER>    tess_cont,
-		Shader<GL_TESS_EVALUATION_SHADER> tess_eval,
-		Shader<GL_GEOMETRY_SHADER>        geometry,
-		Shader<GL_FRAGMENT_SHADER>        fragment
+	GLuint GPUProgram::submit(
+		Shader<GL_VERTEX_SHADER>&          vertex,
+		Shader<GL_TESS_CONTROL_SHADER>&    tess_cont,
+		Shader<GL_TESS_EVALUATION_SHADER>& tess_eval,
+		Shader<GL_GEOMETRY_SHADER>&        geometry,
+		Shader<GL_FRAGMENT_SHADER>&        fragment,
+		bool retrievable
 	) {
-		safety::entry_guard("GPUProgram::GPUProgram(vertex,tess_cont,tess_eval,geometry,fragment)");
+		safety::entry_guard("GPUProgram::submit");
 		if (vertex.is_empty()) {
 			throw std::runtime_error("Render pipeline must have a vertex shader.");
 		}
@@ -80,24 +393,272 @@ namespace glazy {
 		else if (tess_cont.is_empty() != tess_eval.is_empty()) {
 			throw std::runtime_error("Render pipeline must have both tesselation shader stages or neither.");
 		}
-		id = glCreateProgram();
-		if (!id) {
+		GLuint result = glCreateProgram();
+		if (!result) {
 			throw std::runtime_error("Failed to allocate id for GPU program");
 		}
-		attach(vertex);
+		glAttachShader(result, vertex);
 		if (!tess_cont.is_empty()) {
-			attach(tess_cont);
-			attach(tess_eval);
+			glAttachShader(result, tess_cont);
+			glAttachShader(result, tess_eval);
 		}
 		if (!geometry.is_empty()) {
-			attach(geometry);
+			glAttachShader(result, geometry);
+		}
+		glAttachShader(result, fragment);
+		if (retrievable) {
+			glProgramParameteri(result, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+		// The shaders are deleted when their wrappers go out of scope, but GL
+		// keeps them alive while they are attached, so their logs stay readable
+		glLinkProgram(result);
+		safety::exit_guard("GPUProgram::submit");
+		return result;
+	}
+
+	GPUProgram::GPUProgram(
+		Shader<GL_VERTEX_SHADER>          vertex,
+		Shader<GL_TESS_CONTROL_SHADER>    tess_cont,
+		Shader<GL_TESS_EVALUATION_SHADER> tess_eval,
+		Shader<GL_GEOMETRY_SHADER>        geometry,
+		Shader<GL_FRAGMENT_SHADER>        fragment,
+		bool retrievable
+	) {
+		safety::entry_guard("GPUProgram::GPUProgram(vertex,tess_cont,tess_eval,geometry,fragment)");
+		id = submit(vertex, tess_cont, tess_eval, geometry, fragment, retrievable);
+		try {
+			check_linking();
 		}
-		attach(fragment);
-		glLinkProgram(id);
-		check_linking();
+		catch (...) {
+			// Nothing else owns the program yet, and rebuilds that fail
+			// repeatedly, such as during hot reload, would otherwise pile up
+			glDeleteProgram(id);
+			throw;
+		}
+		reflect();
 		safety::exit_guard("GPUProgram::GPUProgram(vertex,tess_cont,tess_eval,geometry,fragment)");
 	}
 
+	GPUProgram::GPUProgram(GLuint linked_id)
+		: id(linked_id)
+	{}
+
+	GPUProgram GPUProgram::from_linked(GLuint linked_id) {
+		safety::entry_guard("GPUProgram::from_linked");
+		GPUProgram result(linked_id);
+		result.check_linking();
+		result.reflect();
+		safety::exit_guard("GPUProgram::from_linked");
+		return result;
+	}
+
+	ProgramFuture::ProgramFuture(
+		Shader<GL_VERTEX_SHADER>          vertex,
+		Shader<GL_TESS_CONTROL_SHADER>    tess_cont,
+		Shader<GL_TESS_EVALUATION_SHADER> tess_eval,
+		Shader<GL_GEOMETRY_SHADER>        geometry,
+		Shader<GL_FRAGMENT_SHADER>        fragment,
+		bool retrievable
+	)
+		: pending(GPUProgram::submit(vertex, tess_cont, tess_eval, geometry, fragment, retrievable))
+	{}
+
+	ProgramFuture::ProgramFuture(ProgramFuture&& other)
+		: pending(other.pending)
+		, program(std::move(other.program))
+	{
+		other.pending = 0;
+	}
+
+	ProgramFuture::~ProgramFuture() {
+		// A program that was never collected, or that failed
+		ContextObjects::current().deletions.defer(DeletionQueue::Kind::program, pending);
+	}
+
+	bool ProgramFuture::ready() const {
+		if (program || (pending == 0)) {
+			return true;
+		}
+		if (!context::capabilities().parallel_shader_compile) {
+			return true;
+		}
+		GLint complete = GL_FALSE;
+		glGetProgramiv(pending, GL_COMPLETION_STATUS_KHR, &complete);
+		return complete == GL_TRUE;
+	}
+
+	void ProgramFuture::finish() {
+		safety::entry_guard("ProgramFuture::finish");
+		if (!program) {
+			if (pending == 0) {
+				throw std::runtime_error("ProgramFuture has no program to wait for.");
+			}
+			// On failure, 'pending' is kept so the destructor deletes it, and so
+			// every later call reports the same error
+			program.emplace(GPUProgram::from_linked(pending));
+			pending = 0;
+		}
+		safety::exit_guard("ProgramFuture::finish");
+	}
+
+	GPUProgram* ProgramFuture::poll() {
+		if (!ready()) {
+			return nullptr;
+		}
+		finish();
+		return &*program;
+	}
+
+	GPUProgram& ProgramFuture::get() {
+		finish();
+		return *program;
+	}
+
+	namespace {
+
+		template<typename T>
+		size_t replay_uniform_as(GLuint to, GLint location, std::span<unsigned char const> value) {
+			size_t count = value.size() / sizeof(T);
+			if (count != 0) {
+				uniform::ProgramUniformV(to, location, count, reinterpret_cast<T const*>(value.data()));
+			}
+			return count * sizeof(T);
+		}
+
+		// Sets a uniform of another program from the bytes a shadow recorded
+		// for it, returning how many of them were sent. Booleans are recorded
+		// as GLint and samplers as their unit. Double-precision and
+		// boolean vector uniforms cannot be set through glazy, so are never
+		// recorded.
+		size_t replay_uniform(GLuint to, GLint location, GLenum type, std::span<unsigned char const> value) {
+			if (uniform::is_sampler(type)) {
+				type = GL_INT;
+			}
+			switch (type) {
+			case GL_FLOAT:             return replay_uniform_as<GLfloat>    (to, location, value);
+			case GL_FLOAT_VEC2:        return replay_uniform_as<glm::vec2>  (to, location, value);
+			case GL_FLOAT_VEC3:        return replay_uniform_as<glm::vec3>  (to, location, value);
+			case GL_FLOAT_VEC4:        return replay_uniform_as<glm::vec4>  (to, location, value);
+			case GL_BOOL:
+			case GL_INT:               return replay_uniform_as<GLint>      (to, location, value);
+			case GL_INT_VEC2:          return replay_uniform_as<glm::ivec2> (to, location, value);
+			case GL_INT_VEC3:          return replay_uniform_as<glm::ivec3> (to, location, value);
+			case GL_INT_VEC4:          return replay_uniform_as<glm::ivec4> (to, location, value);
+			case GL_UNSIGNED_INT:      return replay_uniform_as<GLuint>     (to, location, value);
+			case GL_UNSIGNED_INT_VEC2: return replay_uniform_as<glm::uvec2> (to, location, value);
+			case GL_UNSIGNED_INT_VEC3: return replay_uniform_as<glm::uvec3> (to, location, value);
+			case GL_UNSIGNED_INT_VEC4: return replay_uniform_as<glm::uvec4> (to, location, value);
+			case GL_FLOAT_MAT2:        return replay_uniform_as<glm::mat2>  (to, location, value);
+			case GL_FLOAT_MAT3:        return replay_uniform_as<glm::mat3>  (to, location, value);
+			case GL_FLOAT_MAT4:        return replay_uniform_as<glm::mat4>  (to, location, value);
+			case GL_FLOAT_MAT2x3:      return replay_uniform_as<glm::mat2x3>(to, location, value);
+			case GL_FLOAT_MAT3x2:      return replay_uniform_as<glm::mat3x2>(to, location, value);
+			case GL_FLOAT_MAT2x4:      return replay_uniform_as<glm::mat2x4>(to, location, value);
+			case GL_FLOAT_MAT4x2:      return replay_uniform_as<glm::mat4x2>(to, location, value);
+			case GL_FLOAT_MAT3x4:      return replay_uniform_as<glm::mat3x4>(to, location, value);
+			case GL_FLOAT_MAT4x3:      return replay_uniform_as<glm::mat4x3>(to, location, value);
+			default:                   return 0;
+			}
+		}
+
+	}
+
+	void GPUProgram::replace(GPUProgram&& fresh) {
+		safety::entry_guard("GPUProgram::replace");
+		// Values set through the shadow are re-sent from it, rather than read
+		// back from GL. Uniforms set by calling GL directly start over.
+		std::vector<ActiveVariable> const& old_uniforms = uniforms.all();
+		for (size_t index = 0; index < old_uniforms.size(); index++) {
+			std::span<unsigned char const> value = shadow->known_value(index);
+			ActiveVariable const* new_uniform = fresh.uniforms.find(old_uniforms[index].name);
+			if (value.empty() || (new_uniform == nullptr) || (new_uniform->type != old_uniforms[index].type)) {
+				continue;
+			}
+			// An array that shrank keeps its leading elements
+			size_t room = fresh.shadow->capacity(fresh.uniform_index(*new_uniform));
+			value = value.first(std::min(value.size(), room));
+			size_t sent = replay_uniform(fresh.id, new_uniform->location, new_uniform->type, value);
+			if (sent != 0) {
+				fresh.shadow->update(fresh.uniform_index(*new_uniform), value.data(), sent);
+			}
+		}
+		// Elements set on their own may hold values their array's entry
+		// does not know of
+		for (Element const& old : elements) {
+			ActiveVariable const& old_element = old.variable;
+			std::span<unsigned char const> value = shadow->known_value(old.shadow_index);
+			if (value.empty()) {
+				continue;
+			}
+			ActiveVariable const* new_element = nullptr;
+			try {
+				new_element = &fresh.find_uniform(old_element.name);
+			} catch (std::runtime_error const&) {
+				continue;
+			}
+			if (new_element->type != old_element.type) {
+				continue;
+			}
+			size_t room = fresh.shadow->capacity(fresh.uniform_index(*new_element));
+			value = value.first(std::min(value.size(), room));
+			size_t sent = replay_uniform(fresh.id, new_element->location, new_element->type, value);
+			if (sent != 0) {
+				fresh.shadow->update(fresh.uniform_index(*new_element), value.data(), sent);
+			}
+		}
+		for (ActiveVariable const& old_block : blocks.all()) {
+			ActiveVariable const* new_block = fresh.blocks.find(old_block.name);
+			if (new_block == nullptr) {
+				continue;
+			}
+			GLint binding = 0;
+			glGetActiveUniformBlockiv(id, old_block.location, GL_UNIFORM_BLOCK_BINDING, &binding);
+			glUniformBlockBinding(fresh.id, new_block->location, binding);
+		}
+
+		StateCache& state = StateCache::current();
+		if (state.current_program() == id) {
+			state.use_program(fresh.id);
+		}
+		ContextObjects::current().deletions.defer(DeletionQueue::Kind::program, id);
+		id = fresh.id;
+		uniforms = std::move(fresh.uniforms);
+		attributes = std::move(fresh.attributes);
+		blocks = std::move(fresh.blocks);
+		elements = std::move(fresh.elements);
+		// The new shadow already holds every value replayed above. Handles
+		// to the old program keep the old shadow, so they cannot vouch for
+		// values in this one.
+		shadow = std::move(fresh.shadow);
+		fresh.id = 0;
+		safety::exit_guard("GPUProgram::replace");
+	}
+
+	GPUProgram GPUProgram::link_separable(GLuint shader_id) {
+		safety::entry_guard("GPUProgram::link_separable");
+		GLuint program = glCreateProgram();
+		if (!program) {
+			throw std::runtime_error("Failed to allocate id for GPU program");
+		}
+		glProgramParameteri(program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+		glAttachShader(program, shader_id);
+		glLinkProgram(program);
+		GPUProgram result(program);
+		try {
+			result.check_linking();
+		}
+		catch (...) {
+			glDeleteProgram(program);
+			throw;
+		}
+		// The linked program no longer needs the shader, and detaching it lets
+		// the driver free it once its wrapper is destroyed
+		glDetachShader(program, shader_id);
+		result.reflect();
+		safety::exit_guard("GPUProgram::link_separable");
+		return result;
+	}
+
 	GPUProgram::operator GLuint() {
 		return id;
 	}
@@ -106,42 +667,118 @@ namespace glazy {
 		return GPUAccessor(*this, name);
 	}
 
-	GPUProgram::BindGuard::BindGuard(GPUProgram& program) : program(program) {
+	GPUProgram::BindGuard::BindGuard(GPUProgram& program) {
 		safety::entry_guard("GPUProgram::BindGuard::bind");
-		if (bind_stack.empty() || (bind_stack.top() != program.id)) {
-			glUseProgram(program.id);
-		}
-		bind_stack.push(program.id);
+		StateCache& cache = StateCache::current();
+		previous = cache.current_program();
+		nested = (cache.guard_depth.program++ > 0);
+		cache.use_program(program.id);
 		safety::exit_guard("GPUProgram::BindGuard::bind");
 	}
 
 	GPUProgram::BindGuard::~BindGuard() {
-		if (bind_stack.empty()) {
+		StateCache& cache = StateCache::current();
+		if (cache.guard_depth.program == 0) {
 			std::cerr << "ERROR: BindGuard has run more destructors than constructors! "
 						 "Do not manually invoke the destructor of a BindGuard!\n";
 			return;
 		}
-		bind_stack.pop();
-		if ((!bind_stack.empty()) && (bind_stack.top() != program.id)) {
-			glUseProgram(bind_stack.top());
+		cache.guard_depth.program--;
+		if (nested) {
+			cache.use_program(previous);
 		}
 	}
 
 
 	GLint GPUProgram::attribute_index (std::string name) {
-		safety::entry_guard("GPUProgram::attribute_index");
-		GLint index = glGetAttribLocation(id, name.c_str());
-		if (index < 0) {
+		ActiveVariable const* variable = attributes.find(name);
+		if (variable == nullptr) {
 			std::string message = "Attribute '";
 			message += name + "' does not exist.";
 			throw std::runtime_error(message);
 		}
-		safety::exit_guard("GPUProgram::attribute_index");
-		return index;
+		return variable->location;
+	}
+
+	ActiveVariable const& GPUProgram::find_uniform(uniform::Name name) const {
+		ActiveVariable const* variable = uniforms.find(name);
+		if (variable != nullptr) {
+			return *variable;
+		}
+		for (Element const& element : elements) {
+			if ((element.variable.hash == name.hash) && (element.variable.name == name.text)) {
+				return element.variable;
+			}
+		}
+		// Reflection lists each array once, so an element is found through
+		// its array. GL does not promise that the locations of an array's
+		// elements are consecutive, so the element's is asked for.
+		std::string_view text = name.text;
+		size_t open = text.rfind('[');
+		if ((open != std::string_view::npos) && (open > 0) && (text.size() > open + 2) && (text.back() == ']')) {
+			std::string_view digits = text.substr(open + 1, text.size() - open - 2);
+			ActiveVariable const* array = uniforms.find(text.substr(0, open));
+			bool numeric = std::all_of(digits.begin(), digits.end(), [](char c) { return (c >= '0') && (c <= '9'); });
+			if ((array != nullptr) && numeric && (digits.size() < 10)) {
+				GLint element = std::stoi(std::string(digits));
+				std::string element_name(text);
+				GLint location = (element < array->count) ? glGetUniformLocation(id, element_name.c_str()) : -1;
+				if (location >= 0) {
+					size_t shadow_index = shadow->add_element(uniform_index(*array), element, uniform_value_size(array->type));
+					elements.push_back({ { std::move(element_name), name.hash, location, array->type, array->count - element }, shadow_index });
+					return elements.back().variable;
+				}
+			}
+		}
+		throw std::runtime_error("Invalid uniform name '" + std::string(name.text) + "'");
+	}
+
+	VariableTable const& GPUProgram::active_uniforms() const {
+		return uniforms;
+	}
+
+	VariableTable const& GPUProgram::active_attributes() const {
+		return attributes;
+	}
+
+	VariableTable const& GPUProgram::active_blocks() const {
+		return blocks;
 	}
 
+	UniformShadow& GPUProgram::uniform_shadow() {
+		return *shadow;
+	}
 
-	std::stack<GLuint> GPUProgram::BindGuard::bind_stack;
+	size_t GPUProgram::uniform_index(ActiveVariable const& variable) const {
+		std::vector<ActiveVariable> const& table = uniforms.all();
+		if ((&variable >= table.data()) && (&variable < table.data() + table.size())) {
+			return &variable - table.data();
+		}
+		for (Element const& element : elements) {
+			if (&element.variable == &variable) {
+				return element.shadow_index;
+			}
+		}
+		// Not one of this program's, so the shadow has no entry for it
+		return static_cast<size_t>(-1);
+	}
+
+	void GPUProgram::bind_block(uniform::Name name, GLuint binding, size_t size) {
+		safety::entry_guard("GPUProgram::bind_block");
+		ActiveVariable const* block = blocks.find(name);
+		if (block == nullptr) {
+			throw std::runtime_error("Invalid uniform block name '" + std::string(name.text) + "'");
+		}
+		size_t padded = ((size + 15) / 16) * 16;
+		if (static_cast<size_t>(block->count) > padded) {
+			throw std::runtime_error(
+				"Uniform block '" + block->name + "' needs " + std::to_string(block->count)
+				+ " bytes, but its struct has only " + std::to_string(size) + "."
+			);
+		}
+		glUniformBlockBinding(id, block->location, binding);
+		safety::exit_guard("GPUProgram::bind_block");
+	}
 
 }
 
@@ -0,0 +1,207 @@
+
+#include "glazy_reload.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <climits>
+#endif
+
+namespace glazy {
+
+	ProgramSources ProgramFiles::read() const {
+		auto read_if_given = [](std::string const& path) {
+			return path.empty() ? std::string() : file::read_file_to_string(path);
+		};
+		ProgramSources result;
+		result.vertex = read_if_given(vertex);
+		result.tess_control = read_if_given(tess_control);
+		result.tess_evaluation = read_if_given(tess_evaluation);
+		result.geometry = read_if_given(geometry);
+		result.fragment = read_if_given(fragment);
+		return result;
+	}
+
+
+	ShaderWatcher::ShaderWatcher()
+		: notify_fd(-1)
+	{
+		#ifdef __linux__
+		notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		#endif
+	}
+
+	ShaderWatcher::~ShaderWatcher() {
+		#ifdef __linux__
+		if (notify_fd >= 0) {
+			close(notify_fd);
+		}
+		#endif
+	}
+
+	bool ShaderWatcher::notified() const {
+		return notify_fd >= 0;
+	}
+
+	std::string ShaderWatcher::canonical(std::string const& path) {
+		std::error_code error;
+		std::filesystem::path result = std::filesystem::weakly_canonical(path, error);
+		return error ? path : result.string();
+	}
+
+	void ShaderWatcher::add_file(std::string const& path, GPUProgram* program) {
+		if (path.empty()) {
+			return;
+		}
+		std::string name = canonical(path);
+		users[name].insert(program);
+
+		std::error_code error;
+		times[name] = std::filesystem::last_write_time(name, error);
+
+		#ifdef __linux__
+		if (notify_fd >= 0) {
+			// Editors often save by writing a new file and renaming it over the
+			// old one, which a watch on the file itself would not survive, so the
+			// directory is watched instead
+			std::string directory = std::filesystem::path(name).parent_path().string();
+			int descriptor = inotify_add_watch(notify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+			if (descriptor >= 0) {
+				directories[descriptor] = directory;
+			}
+		}
+		#endif
+	}
+
+	void ShaderWatcher::watch(GPUProgram& program, ProgramFiles files, ReloadCallback on_reload) {
+		std::vector<std::string> dependencies;
+		for (std::string const* path : { &files.vertex, &files.tess_control, &files.tess_evaluation, &files.geometry, &files.fragment }) {
+			if (!path->empty()) {
+				dependencies.push_back(*path);
+			}
+		}
+		Rebuild rebuild = [files](std::vector<std::string>&) {
+			return files.read().build();
+		};
+		watch(program, std::move(dependencies), std::move(rebuild), std::move(on_reload));
+	}
+
+	void ShaderWatcher::watch(GPUProgram& program, std::vector<std::string> dependencies, Rebuild rebuild, ReloadCallback on_reload) {
+		unwatch(program);
+		for (std::string const& path : dependencies) {
+			add_file(path, &program);
+		}
+		programs[&program] = { std::move(dependencies), std::move(rebuild), std::move(on_reload) };
+	}
+
+	void ShaderWatcher::unwatch(GPUProgram& program) {
+		if (programs.erase(&program) != 0) {
+			remove_files(&program);
+		}
+	}
+
+	void ShaderWatcher::remove_files(GPUProgram* program) {
+		// Directory watches are left in place, as they are cheap and other files
+		// in the directory may still be watched
+		for (auto iter = users.begin(); iter != users.end(); ) {
+			iter->second.erase(program);
+			if (iter->second.empty()) {
+				times.erase(iter->first);
+				iter = users.erase(iter);
+			}
+			else {
+				++iter;
+			}
+		}
+	}
+
+	std::unordered_set<std::string> ShaderWatcher::changed_files() {
+		std::unordered_set<std::string> result;
+
+		#ifdef __linux__
+		if (notify_fd >= 0) {
+			alignas(inotify_event) char buffer[64 * (sizeof(inotify_event) + NAME_MAX + 1)];
+			while (true) {
+				ssize_t length = ::read(notify_fd, buffer, sizeof(buffer));
+				if (length <= 0) {
+					break;
+				}
+				for (char* cursor = buffer; cursor < buffer + length; ) {
+					inotify_event* event = reinterpret_cast<inotify_event*>(cursor);
+					cursor += sizeof(inotify_event) + event->len;
+					auto directory = directories.find(event->wd);
+					if ((directory == directories.end()) || (event->len == 0)) {
+						continue;
+					}
+					std::string name = (std::filesystem::path(directory->second) / event->name).string();
+					if (users.count(name) != 0) {
+						result.insert(name);
+					}
+				}
+			}
+			return result;
+		}
+		#endif
+
+		for (auto& entry : times) {
+			std::error_code error;
+			std::filesystem::file_time_type time = std::filesystem::last_write_time(entry.first, error);
+			// A file being replaced may briefly not exist; it is checked again
+			// on the next poll
+			if (!error && (time != entry.second)) {
+				entry.second = time;
+				result.insert(entry.first);
+			}
+		}
+		return result;
+	}
+
+	ShaderWatcher::Result ShaderWatcher::poll() {
+		Result result = { 0, {} };
+		std::unordered_set<std::string> changed = changed_files();
+		if (changed.empty()) {
+			return result;
+		}
+
+		// A program that uses several changed files is still rebuilt only once
+		std::unordered_set<GPUProgram*> affected;
+		for (std::string const& name : changed) {
+			auto entry = users.find(name);
+			if (entry != users.end()) {
+				affected.insert(entry->second.begin(), entry->second.end());
+			}
+		}
+
+		for (GPUProgram* program : affected) {
+			Watched& watched = programs[program];
+			std::vector<std::string> dependencies = watched.dependencies;
+			try {
+				GPUProgram fresh = watched.rebuild(dependencies);
+				program->replace(std::move(fresh));
+			}
+			catch (std::exception const& error) {
+				std::string files;
+				for (std::string const& path : watched.dependencies) {
+					files += "\n\t" + path;
+				}
+				result.errors.push_back(
+					"Reloading the program built from:" + files + "\nfailed, so the old program is kept.\n" + error.what()
+				);
+				continue;
+			}
+			if (dependencies != watched.dependencies) {
+				remove_files(program);
+				for (std::string const& path : dependencies) {
+					add_file(path, program);
+				}
+				watched.dependencies = std::move(dependencies);
+			}
+			result.reloaded++;
+			if (watched.on_reload) {
+				watched.on_reload(*program);
+			}
+		}
+		return result;
+	}
+
+}
@@ -0,0 +1,255 @@
+
+#include "glazy_state.h"
+
+namespace glazy {
+
+	StateCache& StateCache::current() {
+		return detail::PerContext<StateCache>::current();
+	}
+
+	void StateCache::release(GLFWwindow* window) {
+		detail::PerContext<StateCache>::release(window);
+	}
+
+
+	StateCache::StateCache()
+		: program{ 0, false }
+		, pipeline{ 0, false }
+		, vertex_array{ 0, false }
+		, active_unit{ 0, false }
+		, blend{ { GL_ONE, GL_ZERO }, false }
+		, blend_mode{ GL_FUNC_ADD, false }
+		, depth{ GL_LESS, false }
+		, depth_writes{ true, false }
+		, issued(0)
+		, elided(0)
+		, guard_depth{ 0, 0, 0 }
+	{}
+
+	uint64_t StateCache::slot_key(GLuint index, GLenum target) {
+		return (static_cast<uint64_t>(index) << 32) | target;
+	}
+
+	bool StateCache::count(bool changed) {
+		if (changed) {
+			issued++;
+		}
+		else {
+			elided++;
+		}
+		return changed;
+	}
+
+
+	void StateCache::bind_buffer(GLenum target, GLuint id) {
+		if (count(buffers[target].assign(id))) {
+			glBindBuffer(target, id);
+		}
+	}
+
+	GLuint StateCache::bound_buffer(GLenum target) const {
+		auto iter = buffers.find(target);
+		return (iter == buffers.end()) ? 0 : iter->second.value;
+	}
+
+	void StateCache::bind_buffer_base(GLenum target, GLuint index, GLuint id) {
+		if (count(indexed_buffers[slot_key(index, target)].assign({ id, 0, 0 }))) {
+			glBindBufferBase(target, index, id);
+			buffers[target].assign(id);
+		}
+	}
+
+	void StateCache::bind_buffer_range(GLenum target, GLuint index, GLuint id, size_t offset, size_t size) {
+		if (count(indexed_buffers[slot_key(index, target)].assign({ id, offset, size }))) {
+			glBindBufferRange(target, index, id, offset, size);
+			buffers[target].assign(id);
+		}
+	}
+
+	void StateCache::use_program(GLuint id) {
+		if (count(program.assign(id))) {
+			glUseProgram(id);
+		}
+	}
+
+	GLuint StateCache::current_program() const {
+		return program.value;
+	}
+
+	void StateCache::bind_program_pipeline(GLuint id) {
+		use_program(0);
+		if (count(pipeline.assign(id))) {
+			glBindProgramPipeline(id);
+		}
+	}
+
+	GLuint StateCache::bound_program_pipeline() const {
+		return pipeline.value;
+	}
+
+	void StateCache::bind_vertex_array(GLuint id) {
+		if (count(vertex_array.assign(id))) {
+			glBindVertexArray(id);
+			// The element array binding belongs to the VAO, not the context
+			buffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+		}
+	}
+
+	GLuint StateCache::bound_vertex_array() const {
+		return vertex_array.value;
+	}
+
+	void StateCache::active_texture(GLuint unit) {
+		if (count(active_unit.assign(unit))) {
+			glActiveTexture(GL_TEXTURE0 + unit);
+		}
+	}
+
+	void StateCache::bind_texture(GLenum target, GLuint id) {
+		bind_texture(active_unit.value, target, id);
+	}
+
+	void StateCache::bind_texture(GLuint unit, GLenum target, GLuint id) {
+		if (count(textures[slot_key(unit, target)].assign(id))) {
+			active_texture(unit);
+			glBindTexture(target, id);
+		}
+	}
+
+	GLuint StateCache::bound_texture(GLenum target) const {
+		auto iter = textures.find(slot_key(active_unit.value, target));
+		return (iter == textures.end()) ? 0 : iter->second.value;
+	}
+
+	void StateCache::bind_sampler(GLuint unit, GLuint id) {
+		if (count(samplers[unit].assign(id))) {
+			glBindSampler(unit, id);
+		}
+	}
+
+	void StateCache::set_enabled(GLenum cap, bool enabled) {
+		if (count(capabilities[cap].assign(enabled))) {
+			if (enabled) {
+				glEnable(cap);
+			}
+			else {
+				glDisable(cap);
+			}
+		}
+	}
+
+	void StateCache::enable(GLenum cap) {
+		set_enabled(cap, true);
+	}
+
+	void StateCache::disable(GLenum cap) {
+		set_enabled(cap, false);
+	}
+
+	void StateCache::pixel_store(GLenum name, GLint value) {
+		if (count(pixel_store_values[name].assign(value))) {
+			glPixelStorei(name, value);
+		}
+	}
+
+	void StateCache::blend_func(GLenum source, GLenum dest) {
+		if (count(blend.assign({ source, dest }))) {
+			glBlendFunc(source, dest);
+		}
+	}
+
+	void StateCache::blend_equation(GLenum mode) {
+		if (count(blend_mode.assign(mode))) {
+			glBlendEquation(mode);
+		}
+	}
+
+	void StateCache::depth_func(GLenum func) {
+		if (count(depth.assign(func))) {
+			glDepthFunc(func);
+		}
+	}
+
+	void StateCache::depth_mask(bool writes) {
+		if (count(depth_writes.assign(writes))) {
+			glDepthMask(writes ? GL_TRUE : GL_FALSE);
+		}
+	}
+
+
+	void StateCache::forget_buffer(GLuint id) {
+		for (auto& entry : buffers) {
+			if (entry.second.value == id) {
+				entry.second.value = 0;
+			}
+		}
+		for (auto& entry : indexed_buffers) {
+			if (entry.second.value.id == id) {
+				entry.second.value = { 0, 0, 0 };
+			}
+		}
+	}
+
+	void StateCache::forget_vertex_array(GLuint id) {
+		if (vertex_array.value == id) {
+			vertex_array.value = 0;
+			buffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+		}
+	}
+
+	void StateCache::forget_program(GLuint id) {
+		if (program.value == id) {
+			program.known = false;
+		}
+	}
+
+	void StateCache::forget_program_pipeline(GLuint id) {
+		if (pipeline.value == id) {
+			pipeline.value = 0;
+		}
+	}
+
+	void StateCache::forget_texture(GLuint id) {
+		for (auto& entry : textures) {
+			if (entry.second.value == id) {
+				entry.second.value = 0;
+			}
+		}
+	}
+
+	void StateCache::forget_sampler(GLuint id) {
+		for (auto& entry : samplers) {
+			if (entry.second.value == id) {
+				entry.second.value = 0;
+			}
+		}
+	}
+
+
+	void StateCache::invalidate() {
+		buffers.clear();
+		indexed_buffers.clear();
+		program.known = false;
+		pipeline.known = false;
+		vertex_array.known = false;
+		active_unit.known = false;
+		textures.clear();
+		samplers.clear();
+		capabilities.clear();
+		pixel_store_values.clear();
+		blend.known = false;
+		blend_mode.known = false;
+		depth.known = false;
+		depth_writes.known = false;
+	}
+
+	StateCache::Counters StateCache::counters() const {
+		return { issued, elided };
+	}
+
+	void StateCache::reset_counters() {
+		issued = 0;
+		elided = 0;
+	}
+
+}
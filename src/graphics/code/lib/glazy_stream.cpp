@@ -0,0 +1,278 @@
+
+#include "glazy_stream.h"
+#include "glazy_bake.h"
+
+// Kept private to this file, so that apps may still include their own copy
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <cstring>
+#include <algorithm>
+
+namespace glazy {
+
+	StreamedTexture::StreamedTexture(std::string path)
+		: path(std::move(path))
+		, resident(-1)
+	{}
+
+	TextureStorage* StreamedTexture::get() {
+		return (resident < 0) ? nullptr : texture.get();
+	}
+
+	GLint StreamedTexture::resident_level() const {
+		return resident;
+	}
+
+	bool StreamedTexture::complete() const {
+		return resident == 0;
+	}
+
+	bool StreamedTexture::failed() const {
+		return !error.empty();
+	}
+
+	std::string const& StreamedTexture::failure() const {
+		return error;
+	}
+
+	std::string const& StreamedTexture::file_path() const {
+		return path;
+	}
+
+
+	double TextureStreamer::Metrics::mean_decode_seconds() const {
+		size_t decoded = uploading + completed + failed;
+		return (decoded == 0) ? 0.0 : (decode_seconds / decoded);
+	}
+
+	double TextureStreamer::Metrics::bytes_per_second() const {
+		return (upload_seconds <= 0.0) ? 0.0 : (bytes_uploaded / upload_seconds);
+	}
+
+
+	TextureStreamer::TextureStreamer(size_t worker_count, size_t bytes_per_frame, size_t frame_count)
+		: decoding(0)
+		, stopping(false)
+		, staging(bytes_per_frame, frame_count)
+		, completed(0)
+		, failed(0)
+		, decode_seconds(0)
+		, bytes_uploaded(0)
+	{
+		if (worker_count == 0) {
+			size_t hardware = std::thread::hardware_concurrency();
+			worker_count = (hardware > 1) ? (hardware - 1) : 1;
+		}
+		for (size_t i = 0; i < worker_count; i++) {
+			workers.emplace_back(&TextureStreamer::run, this);
+		}
+	}
+
+	TextureStreamer::~TextureStreamer() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			requests.clear();
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		StateCache& cache = StateCache::current();
+		if (cache.bound_buffer(GL_PIXEL_UNPACK_BUFFER) == staging) {
+			cache.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+	}
+
+	void TextureStreamer::run() {
+		while (true) {
+			Request request;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !requests.empty(); });
+				if (requests.empty()) {
+					break;
+				}
+				request = std::move(requests.front());
+				requests.pop_front();
+				decoding++;
+			}
+			auto start = std::chrono::steady_clock::now();
+			Decoded result = decode(request);
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			std::lock_guard<std::mutex> lock(mutex);
+			decoding--;
+			decode_seconds += elapsed.count();
+			decoded.push_back(std::move(result));
+		}
+	}
+
+	TextureStreamer::Decoded TextureStreamer::decode(Request const& request) {
+		Decoded result = { request.target, {}, 0, 0, "" };
+		int width, height, channels;
+		unsigned char* data = stbi_load(request.path.c_str(), &width, &height, &channels, 4);
+		if (data == nullptr) {
+			result.error = "Failed to load image '" + request.path + "': " + stbi_failure_reason();
+			return result;
+		}
+		result.width = width;
+		result.height = height;
+		std::vector<format::RGBA8> level(size_t(width) * height);
+		std::memcpy(level.data(), data, level.size() * sizeof(format::RGBA8));
+		stbi_image_free(data);
+
+		// Every worker of the streamer decodes at once, so each chain is
+		// built on its worker's thread alone
+		mip::Options options;
+		options.threads = 1;
+		result.levels = bake::mip_chain(std::move(level), width, height, options);
+		std::reverse(result.levels.begin(), result.levels.end());
+		return result;
+	}
+
+	std::shared_ptr<StreamedTexture> TextureStreamer::load(std::string path) {
+		auto target = std::make_shared<StreamedTexture>(path);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			requests.push_back({ target, std::move(path) });
+		}
+		wake.notify_one();
+		return target;
+	}
+
+	void TextureStreamer::begin_upload(Decoded& result) {
+		StreamedTexture& target = *result.target;
+		if (!result.error.empty()) {
+			target.error = result.error;
+			failed++;
+			return;
+		}
+		// Every row must fit in one frame's staging region
+		if (result.width * sizeof(format::RGBA8) > staging.capacity()) {
+			target.error = "Rows of '" + target.path + "' are wider than the streamer's per-frame budget.";
+			failed++;
+			return;
+		}
+		target.texture = std::make_unique<Texture2D<format::RGBA8>>(result.width, result.height, GLsizei(result.levels.size()));
+		uploads.push_back({ result.target, std::move(result.levels), 0, 0 });
+	}
+
+	void TextureStreamer::update() {
+		safety::entry_guard("TextureStreamer::update");
+		std::deque<Decoded> arrived;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::swap(arrived, decoded);
+		}
+		for (Decoded& result : arrived) {
+			begin_upload(result);
+		}
+		if (uploads.empty()) {
+			safety::exit_guard("TextureStreamer::update");
+			return;
+		}
+
+		// Bands of rows copied into staging this frame, uploaded once the whole
+		// frame's region has been written
+		struct Band {
+			Upload* upload;
+			GLint   level;
+			size_t  row;
+			size_t  rows;
+			size_t  width;
+			size_t  offset;
+		};
+		std::vector<Band> bands;
+		staging.begin_frame();
+		size_t budget = staging.capacity();
+		while (budget > 0) {
+			// Smallest remaining level first, across every texture, so that each
+			// becomes drawable before any gains detail
+			Upload* next = nullptr;
+			for (Upload& upload : uploads) {
+				if ((upload.step < upload.levels.size()) && ((next == nullptr) || (upload.step < next->step))) {
+					next = &upload;
+				}
+			}
+			if (next == nullptr) {
+				break;
+			}
+			GLint level = GLint(next->levels.size() - 1 - next->step);
+			size_t width = std::max<size_t>(next->target->texture->width() >> level, 1);
+			size_t height = std::max<size_t>(next->target->texture->height() >> level, 1);
+			size_t row_bytes = width * sizeof(format::RGBA8);
+			size_t rows = std::min(height - next->row, budget / row_bytes);
+			if (rows == 0) {
+				break;
+			}
+			auto slice = staging.allocate(rows * row_bytes);
+			std::memcpy(slice.data, next->levels[next->step].data() + next->row * width, rows * row_bytes);
+			bands.push_back({ next, level, next->row, rows, width, slice.offset() });
+			budget -= rows * row_bytes;
+			next->row += rows;
+			if (next->row == height) {
+				next->step++;
+				next->row = 0;
+			}
+		}
+		staging.commit();
+
+		StateCache& cache = StateCache::current();
+		cache.bind_buffer(GL_PIXEL_UNPACK_BUFFER, staging);
+		size_t bytes = 0;
+		for (Band const& band : bands) {
+			Texture2D<format::RGBA8>& texture = *band.upload->target->texture;
+			texture.unpack(band.level, 0, band.row, band.width, band.rows, band.offset);
+			bytes += band.rows * band.width * sizeof(format::RGBA8);
+			size_t height = std::max<size_t>(texture.height() >> band.level, 1);
+			if (band.row + band.rows == height) {
+				// The level is whole, so sampling may now reach it
+				texture.set_base_level(band.level);
+				band.upload->target->resident = band.level;
+			}
+		}
+		// Client-memory uploads elsewhere must not be read as buffer offsets
+		cache.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		staging.end_frame();
+
+		auto now = std::chrono::steady_clock::now();
+		if (bytes_uploaded == 0) {
+			first_upload = now;
+		}
+		bytes_uploaded += bytes;
+		last_upload = now;
+
+		for (size_t i = 0; i < uploads.size(); ) {
+			if (uploads[i].step == uploads[i].levels.size()) {
+				completed++;
+				uploads.erase(uploads.begin() + i);
+			}
+			else {
+				i++;
+			}
+		}
+		safety::exit_guard("TextureStreamer::update");
+	}
+
+	bool TextureStreamer::idle() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return requests.empty() && (decoding == 0) && decoded.empty() && uploads.empty();
+	}
+
+	TextureStreamer::Metrics TextureStreamer::metrics() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::chrono::duration<double> elapsed = last_upload - first_upload;
+		return {
+			requests.size() + decoding,
+			uploads.size() + decoded.size(),
+			completed,
+			failed,
+			decode_seconds,
+			bytes_uploaded,
+			elapsed.count()
+		};
+	}
+
+}
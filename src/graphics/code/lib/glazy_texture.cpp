@@ -1,45 +1,243 @@
-
 #include "glazy_texture.h"
+#include "glazy_objects.h"
+#include <algorithm>
 
 namespace glazy {
 
-	Texture::Texture(std::vector<Texture::RGB8> data, size_t width, size_t height, bool mipmap) {
-		safety::entry_guard("Texture::Texture");
-		id = 0;
-		glGenTextures(1, &id);
-		if (id == 0) {
-			throw std::runtime_error("Failed to allocate texture id.");
+	// Runs 'body' with the texture bound to GL_TEXTURE_2D, restoring the previous
+	// binding afterward
+	template<typename F>
+	static void with_bound(GLuint id, F body) {
+		StateCache& cache = StateCache::current();
+		GLuint old = cache.bound_texture(GL_TEXTURE_2D);
+		cache.bind_texture(GL_TEXTURE_2D, id);
+		body();
+		cache.bind_texture(GL_TEXTURE_2D, old);
+	}
+
+	TextureStorage::TextureStorage(GLenum internal, GLenum layout, GLenum type, size_t texel_size, size_t width, size_t height, GLsizei levels)
+		: internal(internal)
+		, layout(layout)
+		, type(type)
+		, texel_size(texel_size)
+		, storage_width(width)
+		, storage_height(height)
+		, levels((levels == 0) ? full_mip_count(width, height) : levels)
+	{
+		safety::entry_guard("TextureStorage::TextureStorage");
+		if ((width == 0) || (height == 0)) {
+			throw std::runtime_error("Cannot create a texture with no texels.");
 		}
-		glBindTexture(GL_TEXTURE_2D, id);
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data.data());
-		if (mipmap) {
-			glGenerateMipmap(GL_TEXTURE_2D);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		id = ContextObjects::current().textures.acquire();
+		GLenum min_filter = (this->levels > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR;
+		if (context::capabilities().direct_state_access) {
+			glTextureStorage2D(id, this->levels, internal, width, height);
+			glTextureParameteri(id, GL_TEXTURE_MIN_FILTER, min_filter);
+			glTextureParameteri(id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		}
 		else {
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			with_bound(id, [&]() {
+				if (context::capabilities().texture_storage) {
+					glTexStorage2D(GL_TEXTURE_2D, this->levels, internal, width, height);
+				}
+				else {
+					// Allocating every level up front, and capping the level range
+					// to match, gives the same texture immutable storage would
+					for (GLsizei level = 0; level < this->levels; level++) {
+						GLsizei level_width = std::max<size_t>(width >> level, 1);
+						GLsizei level_height = std::max<size_t>(height >> level, 1);
+						glTexImage2D(GL_TEXTURE_2D, level, internal, level_width, level_height, 0, layout, type, nullptr);
+					}
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, this->levels - 1);
+				}
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			});
 		}
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		safety::exit_guard("Texture::Texture");
+		safety::exit_guard("TextureStorage::TextureStorage");
 	}
 
-	Texture::~Texture() {
-		glDeleteTextures(1, &id);
+	TextureStorage::~TextureStorage() {
+		ContextObjects::current().deletions.defer(DeletionQueue::Kind::texture, id);
+	}
+
+	void TextureStorage::check_region(GLint level, size_t x, size_t y, size_t width, size_t height) const {
+		if ((level < 0) || (level >= levels)) {
+			throw std::runtime_error("Mip level " + std::to_string(level) + " is outside the texture's "
+				+ std::to_string(levels) + " levels.");
+		}
+		size_t level_width = std::max<size_t>(storage_width >> level, 1);
+		size_t level_height = std::max<size_t>(storage_height >> level, 1);
+		if ((x + width > level_width) || (y + height > level_height)) {
+			throw std::runtime_error("Texture update of " + std::to_string(width) + "x" + std::to_string(height)
+				+ " at (" + std::to_string(x) + "," + std::to_string(y) + ") is outside the "
+				+ std::to_string(level_width) + "x" + std::to_string(level_height) + " level.");
+		}
+	}
+
+	void TextureStorage::transfer(GLint level, size_t x, size_t y, size_t width, size_t height, void const* data, size_t row_length) {
+		// Rows are read at the widest alignment their stride allows, as drivers
+		// take a slower path for anything narrower than four bytes
+		size_t row_bytes = row_length * texel_size;
+		GLint alignment = 8;
+		while ((row_bytes % alignment) != 0) {
+			alignment /= 2;
+		}
+		StateCache& cache = StateCache::current();
+		cache.pixel_store(GL_UNPACK_ALIGNMENT, alignment);
+		cache.pixel_store(GL_UNPACK_ROW_LENGTH, (row_length == width) ? 0 : GLint(row_length));
+		if (context::capabilities().direct_state_access) {
+			glTextureSubImage2D(id, level, x, y, width, height, layout, type, data);
+		}
+		else {
+			with_bound(id, [&]() {
+				glTexSubImage2D(GL_TEXTURE_2D, level, x, y, width, height, layout, type, data);
+			});
+		}
+	}
+
+	void TextureStorage::upload(GLint level, size_t x, size_t y, size_t width, size_t height, void const* data, size_t count, size_t row_length) {
+		safety::entry_guard("TextureStorage::upload");
+		check_region(level, x, y, width, height);
+		if (row_length < width) {
+			throw std::runtime_error("Texture update rows are shorter than the updated rectangle.");
+		}
+		if ((width == 0) || (height == 0)) {
+			safety::exit_guard("TextureStorage::upload");
+			return;
+		}
+		if (count < row_length * (height - 1) + width) {
+			throw std::runtime_error("Texture update of " + std::to_string(width) + "x" + std::to_string(height)
+				+ " was given only " + std::to_string(count) + " texels.");
+		}
+		transfer(level, x, y, width, height, data, row_length);
+		safety::exit_guard("TextureStorage::upload");
+	}
+
+	void TextureStorage::unpack(GLint level, size_t x, size_t y, size_t width, size_t height, size_t offset) {
+		safety::entry_guard("TextureStorage::unpack");
+		check_region(level, x, y, width, height);
+		if (StateCache::current().bound_buffer(GL_PIXEL_UNPACK_BUFFER) == 0) {
+			throw std::runtime_error("Cannot unpack into a texture with no pixel unpack buffer bound.");
+		}
+		if ((width != 0) && (height != 0)) {
+			transfer(level, x, y, width, height, reinterpret_cast<void const*>(offset), width);
+		}
+		safety::exit_guard("TextureStorage::unpack");
+	}
+
+	void TextureStorage::upload_compressed(GLint level, size_t x, size_t y, size_t width, size_t height, void const* data, size_t size) {
+		safety::entry_guard("TextureStorage::upload_compressed");
+		check_region(level, x, y, width, height);
+		if (context::capabilities().direct_state_access) {
+			glCompressedTextureSubImage2D(id, level, x, y, width, height, internal, size, data);
+		}
+		else {
+			with_bound(id, [&]() {
+				glCompressedTexSubImage2D(GL_TEXTURE_2D, level, x, y, width, height, internal, size, data);
+			});
+		}
+		safety::exit_guard("TextureStorage::upload_compressed");
+	}
+
+	void TextureStorage::generate_mipmaps() {
+		safety::entry_guard("TextureStorage::generate_mipmaps");
+		if (context::capabilities().direct_state_access) {
+			glGenerateTextureMipmap(id);
+		}
+		else {
+			with_bound(id, []() {
+				glGenerateMipmap(GL_TEXTURE_2D);
+			});
+		}
+		safety::exit_guard("TextureStorage::generate_mipmaps");
 	}
 
-	Texture::operator GLuint() {
+	void TextureStorage::set_base_level(GLint level) {
+		if ((level < 0) || (level >= levels)) {
+			throw std::runtime_error("Base level " + std::to_string(level) + " is outside the texture's "
+				+ std::to_string(levels) + " levels.");
+		}
+		if (context::capabilities().direct_state_access) {
+			glTextureParameteri(id, GL_TEXTURE_BASE_LEVEL, level);
+		}
+		else {
+			with_bound(id, [&]() {
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+			});
+		}
+	}
+
+	void TextureStorage::set_filter(GLenum min, GLenum mag) {
+		if (context::capabilities().direct_state_access) {
+			glTextureParameteri(id, GL_TEXTURE_MIN_FILTER, min);
+			glTextureParameteri(id, GL_TEXTURE_MAG_FILTER, mag);
+		}
+		else {
+			with_bound(id, [&]() {
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag);
+			});
+		}
+	}
+
+	void TextureStorage::set_wrap(GLenum s, GLenum t) {
+		if (context::capabilities().direct_state_access) {
+			glTextureParameteri(id, GL_TEXTURE_WRAP_S, s);
+			glTextureParameteri(id, GL_TEXTURE_WRAP_T, t);
+		}
+		else {
+			with_bound(id, [&]() {
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, s);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, t);
+			});
+		}
+	}
+
+	size_t TextureStorage::width() const {
+		return storage_width;
+	}
+
+	size_t TextureStorage::height() const {
+		return storage_height;
+	}
+
+	GLsizei TextureStorage::level_count() const {
+		return levels;
+	}
+
+	TextureStorage::operator GLuint() {
 		return id;
 	}
 
+	GLsizei TextureStorage::full_mip_count(size_t width, size_t height) {
+		GLsizei levels = 1;
+		for (size_t extent = std::max(width, height); extent > 1; extent /= 2) {
+			levels++;
+		}
+		return levels;
+	}
+
+
+	Texture::Texture(std::span<Texture::RGB8 const> data, size_t width, size_t height, bool mipmap)
+		: TextureStorage(GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, sizeof(RGB8), width, height, mipmap ? 0 : 1)
+	{
+		upload(0, 0, 0, width, height, data.data(), data.size(), width);
+		if (mipmap) {
+			generate_mipmaps();
+		}
+		else {
+			set_filter(GL_NEAREST, GL_LINEAR);
+		}
+	}
+
 
 	Sampler::Sampler() {
-		glGenSamplers(1, &id);
+		id = ContextObjects::current().samplers.acquire();
 	}
 
 	Sampler::~Sampler() {
-		glDeleteSamplers(1, &id);
+		ContextObjects::current().deletions.defer(DeletionQueue::Kind::sampler, id);
 	}
 
 }
@@ -0,0 +1,70 @@
+
+#include "glazy_upload.h"
+#include "glazy_objects.h"
+
+namespace glazy {
+
+	UploadService::UploadService(GLFWwindow* render_window)
+		: window(context::setup_shared(render_window))
+		, in_flight(0)
+		, stopping(false)
+	{
+		worker = std::thread(&UploadService::run, this);
+	}
+
+	UploadService::~UploadService() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		worker.join();
+		StateCache::release(window);
+		glfwDestroyWindow(window);
+	}
+
+	void UploadService::run() {
+		glfwMakeContextCurrent(window);
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (jobs.empty()) {
+					break;
+				}
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+			// Objects the job let go of are deleted once the GPU is done with them
+			ContextObjects::current().deletions.end_frame();
+			std::lock_guard<std::mutex> lock(mutex);
+			in_flight--;
+		}
+		ContextObjects::release(window);
+		glfwMakeContextCurrent(nullptr);
+	}
+
+	void UploadService::enqueue(std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+			in_flight++;
+		}
+		wake.notify_one();
+	}
+
+	std::future<Published<Texture>> UploadService::upload_texture(std::vector<Texture::RGB8> data, size_t width, size_t height, bool mipmap) {
+		auto shared_data = std::make_shared<std::vector<Texture::RGB8>>(std::move(data));
+		return submit<Texture>([shared_data, width, height, mipmap]() {
+			return std::make_shared<Texture>(std::move(*shared_data), width, height, mipmap);
+		});
+	}
+
+	size_t UploadService::pending() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return in_flight;
+	}
+
+}
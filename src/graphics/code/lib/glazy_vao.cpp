@@ -1,23 +1,25 @@
 
 #include "glazy_vao.h"
+#include "glazy_objects.h"
 
 namespace glazy {
 
 
 
-	VAO::VAO() {
+	VAO::VAO()
+		: highest_lone_attribute(-1)
+	{
 		safety::entry_guard("VAO::VAO()");
-		id = 0;
-		glGenVertexArrays(1, &id);
-		if (id == 0) {
-			throw std::runtime_error("Failed to allocate id for VAO.");
-		}
+		id = ContextObjects::current().vertex_arrays.acquire();
 		safety::exit_guard("VAO::VAO()");
 	}
 
 
 	VAO::VAO(VAO&& other)
 		: id(other.id)
+		, layout_sources(std::move(other.layout_sources))
+		, attribute_sources(std::move(other.attribute_sources))
+		, highest_lone_attribute(other.highest_lone_attribute)
 	{
 		safety::entry_guard("VAO::VAO(VAO&&)");
 		other.id = 0;
@@ -25,39 +27,38 @@ namespace glazy {
 	}
 
 	VAO::~VAO() {
-		if (glIsVertexArray(id)) {
-			glDeleteVertexArrays(1, &id);
-		}
+		ContextObjects::current().deletions.defer(DeletionQueue::Kind::vertex_array, id);
 	}
 
 	VAO::operator GLuint() const {
 		return id;
 	}
 
-	VAO::BindGuard::BindGuard(VAO& vao) : vao(vao) {
+	VAO::BindGuard::BindGuard(VAO& vao) {
 		safety::entry_guard("VAO::BindGuard::BindGuard");
-		if (bind_stack.empty() || (bind_stack.top() != vao.id)) {
-			glBindVertexArray(vao.id);
-		}
-		bind_stack.push(vao.id);
+		StateCache& cache = StateCache::current();
+		previous = cache.bound_vertex_array();
+		nested = (cache.guard_depth.vertex_array++ > 0);
+		cache.bind_vertex_array(vao.id);
 		safety::exit_guard("VAO::BindGuard::BindGuard");
 	}
 
 	VAO::BindGuard::~BindGuard() {
-		if (bind_stack.empty()) {
+		StateCache& cache = StateCache::current();
+		if (cache.guard_depth.vertex_array == 0) {
 			std::cerr << "ERROR: BindGuard has run more destructors than constructors! "
 				"Do not manually invoke the destructor of a BindGuard!\n";
 			return;
 		}
-		bind_stack.pop();
-		if ((!bind_stack.empty()) && (bind_stack.top() != vao.id)) {
-			glBindVertexArray(bind_stack.top());
+		cache.guard_depth.vertex_array--;
+		if (nested) {
+			cache.bind_vertex_array(previous);
 		}
 	}
 
 	void VAO::bind() {
 		safety::entry_guard("VAO::bind");
-		glBindVertexArray(id);
+		StateCache::current().bind_vertex_array(id);
 		safety::exit_guard("VAO::bind");
 	}
 
@@ -70,7 +71,10 @@ namespace glazy {
 
 	VAO::Attribute& VAO::Attribute::enable() {
 		safety::entry_guard("AttributeAccessor::enable");
-		{
+		if (context::capabilities().direct_state_access) {
+			glEnableVertexArrayAttrib(vao.id, index);
+		}
+		else {
 			BindGuard bind_guard(vao);
 			glEnableVertexAttribArray(index);
 		}
@@ -80,7 +84,10 @@ namespace glazy {
 
 	VAO::Attribute& VAO::Attribute::disable() {
 		safety::entry_guard("AttributeAccessor::disable");
-		{
+		if (context::capabilities().direct_state_access) {
+			glDisableVertexArrayAttrib(vao.id, index);
+		}
+		else {
 			BindGuard bind_guard(vao);
 			glDisableVertexAttribArray(index);
 		}
@@ -89,12 +96,148 @@ namespace glazy {
 	}
 
 
+	void VAO::Attribute::set_pointer(GLuint buffer, GLint size, GLenum type, bool normalized, GLsizei stride, size_t offset) {
+		safety::entry_guard("AttributeAccessor::set_pointer");
+		// Normalized integers are read as floats
+		bool integral = type::is_integral(type) && !normalized;
+		if (context::capabilities().direct_state_access) {
+			if ((index <= layout_binding()) && (index + vao.layout_sources.size() > layout_binding())) {
+				throw std::runtime_error("Attribute " + std::to_string(index)
+					+ " would take the vertex buffer binding of one of this VAO's interleaved layouts.");
+			}
+			vao.release_layout_source(index);
+			vao.highest_lone_attribute = std::max(vao.highest_lone_attribute, GLint(index));
+			// Each attribute gets the vertex buffer binding point of the same index
+			glVertexArrayVertexBuffer(vao.id, index, buffer, offset, stride);
+			if (integral) {
+				glVertexArrayAttribIFormat(vao.id, index, size, type, 0);
+			}
+			else {
+				glVertexArrayAttribFormat(vao.id, index, size, type, normalized, 0);
+			}
+			glVertexArrayAttribBinding(vao.id, index, index);
+		}
+		else {
+			BindGuard bind_guard(vao);
+			GLuint old = compat::bound_array_buffer();
+			compat::bind_array_buffer(buffer);
+			void const* pointer = reinterpret_cast<void const*>(offset);
+			if (integral) {
+				glVertexAttribIPointer(index, size, type, stride, pointer);
+			}
+			else {
+				glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+			}
+			compat::bind_array_buffer(old);
+		}
+		safety::exit_guard("AttributeAccessor::set_pointer");
+	}
+
+
+	void VAO::set_vertices(GLuint buffer, GLsizei stride, layout::Format const* formats, size_t count) {
+		safety::entry_guard("VAO::set_vertices");
+		if (count == 0) {
+			throw std::runtime_error("Vertex layout must have at least one field.");
+		}
+		if (context::capabilities().direct_state_access) {
+			// Locations this layout takes over no longer hold their old source
+			// to its buffer, which frees any source left with no locations
+			for (size_t i = 0; i < count; i++) {
+				release_layout_source(formats[i].location);
+			}
+			size_t source = 0;
+			while ((source < layout_sources.size())
+				&& (layout_sources[source].uses != 0)
+				&& ((layout_sources[source].buffer != buffer) || (layout_sources[source].stride != stride))) {
+				source++;
+			}
+			if (source == layout_sources.size()) {
+				if ((source > layout_binding()) || (GLint(layout_binding() - source) <= highest_lone_attribute)) {
+					throw std::runtime_error("This VAO has no vertex buffer binding left for another "
+						"interleaved layout that lone attributes do not already use.");
+				}
+				layout_sources.push_back({ buffer, stride, 0 });
+			}
+			layout_sources[source].buffer = buffer;
+			layout_sources[source].stride = stride;
+			layout_sources[source].uses += count;
+			GLuint binding = GLuint(layout_binding() - source);
+			glVertexArrayVertexBuffer(id, binding, buffer, 0, stride);
+			for (size_t i = 0; i < count; i++) {
+				layout::Format const& format = formats[i];
+				glEnableVertexArrayAttrib(id, format.location);
+				if (type::is_integral(format.type) && !format.normalized) {
+					glVertexArrayAttribIFormat(id, format.location, format.size, format.type, format.offset);
+				}
+				else {
+					glVertexArrayAttribFormat(id, format.location, format.size, format.type, format.normalized, format.offset);
+				}
+				glVertexArrayAttribBinding(id, format.location, binding);
+				if (attribute_sources.size() <= format.location) {
+					attribute_sources.resize(format.location + 1, -1);
+				}
+				attribute_sources[format.location] = int(source);
+			}
+		}
+		else {
+			BindGuard bind_guard(*this);
+			GLuint old = compat::bound_array_buffer();
+			compat::bind_array_buffer(buffer);
+			for (size_t i = 0; i < count; i++) {
+				layout::Format const& format = formats[i];
+				void const* pointer = reinterpret_cast<void const*>(format.offset);
+				glEnableVertexAttribArray(format.location);
+				if (type::is_integral(format.type) && !format.normalized) {
+					glVertexAttribIPointer(format.location, format.size, format.type, stride, pointer);
+				}
+				else {
+					glVertexAttribPointer(format.location, format.size, format.type, format.normalized, stride, pointer);
+				}
+			}
+			compat::bind_array_buffer(old);
+		}
+		safety::exit_guard("VAO::set_vertices");
+	}
+
+
+	void VAO::release_layout_source(GLuint location) {
+		if ((location < attribute_sources.size()) && (attribute_sources[location] >= 0)) {
+			layout_sources[attribute_sources[location]].uses--;
+			attribute_sources[location] = -1;
+		}
+	}
+
+
+	GLuint VAO::layout_binding() {
+		// A limit of the implementation, so asked for once
+		static GLuint const binding = []() {
+			GLint bindings = 0;
+			glGetIntegerv(GL_MAX_VERTEX_ATTRIB_BINDINGS, &bindings);
+			// At least 16 on any context with vertex attribute bindings
+			return GLuint(std::max(bindings, 16) - 1);
+		}();
+		return binding;
+	}
+
+
+	void VAO::set_indices(GLuint indices) {
+		safety::entry_guard("VAO::set_indices");
+		if (context::capabilities().direct_state_access) {
+			glVertexArrayElementBuffer(id, indices);
+		}
+		else {
+			// The element array binding is part of the VAO's state
+			BindGuard bind_guard(*this);
+			StateCache::current().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, indices);
+		}
+		safety::exit_guard("VAO::set_indices");
+	}
+
+
 	VAO::Attribute VAO::operator[] (size_t index) {
 		return Attribute(*this, index);
 	}
 
-	std::stack<GLuint> VAO::BindGuard::bind_stack;
-
 
 	SharedVAO::SharedVAO() : vao(new VAO) {}
 
@@ -110,17 +253,49 @@ namespace glazy {
 		return (*vao)[index];
 	}
 
+	void SharedVAO::set_indices(GLuint indices) {
+		vao->set_indices(indices);
+	}
+
 
 
 	VAO::BindGuard::BindGuard(SharedVAO& svao)
-		: vao(svao)
-	{
-		safety::entry_guard("VAO::BindGuard::BindGuard");
-		if (bind_stack.empty() || (bind_stack.top() != vao.id)) {
-			glBindVertexArray(vao.id);
+		: BindGuard(static_cast<VAO&>(svao))
+	{}
+
+
+
+	namespace draw {
+
+		static size_t draw_count(IndexBuffer const& indices, size_t count, size_t first) {
+			if (first > indices.size()) {
+				throw std::runtime_error("Draw starts past the end of the index buffer.");
+			}
+			if (count == 0) {
+				return indices.size() - first;
+			}
+			if (count > (indices.size() - first)) {
+				throw std::runtime_error("Draw reads past the end of the index buffer.");
+			}
+			return count;
 		}
-		bind_stack.push(vao.id);
-		safety::exit_guard("VAO::BindGuard::BindGuard");
+
+		void elements(GLenum mode, IndexBuffer const& indices, size_t count, size_t first) {
+			safety::entry_guard("draw::elements");
+			count = draw_count(indices, count, first);
+			void const* offset = reinterpret_cast<void const*>(first * indices.index_size());
+			glDrawElements(mode, count, indices.type(), offset);
+			safety::exit_guard("draw::elements");
+		}
+
+		void elements_base_vertex(GLenum mode, IndexBuffer const& indices, GLint base_vertex, size_t count, size_t first) {
+			safety::entry_guard("draw::elements_base_vertex");
+			count = draw_count(indices, count, first);
+			void const* offset = reinterpret_cast<void const*>(first * indices.index_size());
+			glDrawElementsBaseVertex(mode, count, indices.type(), offset, base_vertex);
+			safety::exit_guard("draw::elements_base_vertex");
+		}
+
 	}
 
 }
@@ -104,6 +104,73 @@ namespace glazy {
 			return result;
 		}
 
+
+
+		std::vector<std::uint32_t> grid_indices(size_t w, size_t h) {
+			std::vector<std::uint32_t> result;
+			result.resize(w * h * 3 * 2);
+			auto vertex = [h](size_t x, size_t y) {
+				return static_cast<std::uint32_t>(x * (h + 1) + y);
+			};
+			for (size_t x = 0; x < w; x++) {
+				for (size_t y = 0; y < h; y++) {
+					size_t offset = (x * h + y) * 3 * 2;
+					result[offset + 0] = vertex(x, y + 1);
+					result[offset + 1] = vertex(x + 1, y + 1);
+					result[offset + 2] = vertex(x + 1, y);
+					result[offset + 3] = vertex(x, y + 1);
+					result[offset + 4] = vertex(x + 1, y);
+					result[offset + 5] = vertex(x, y);
+				}
+			}
+			return result;
+		}
+
+
+		Indexed<glm::vec2> indexed_uv_grid(size_t w, size_t h) {
+			Indexed<glm::vec2> result;
+			result.vertices.resize((w + 1) * (h + 1));
+			for (size_t x = 0; x <= w; x++) {
+				for (size_t y = 0; y <= h; y++) {
+					result.vertices[x * (h + 1) + y] = glm::vec2{ x / (float)w, y / (float)h };
+				}
+			}
+			result.indices = grid_indices(w, h);
+			return result;
+		}
+
+
+		Indexed<glm::vec3> indexed_quad() {
+			return deduplicate(quad());
+		}
+
+
+		Indexed<glm::vec3> indexed_box(float w, float h, float d) {
+			return deduplicate(box(w, h, d));
+		}
+
+
+		Indexed<glm::vec3> indexed_sphere(size_t wedges, size_t layers, float radius) {
+			Indexed<glm::vec3> result;
+			float phi_step = (1.0f / layers) * M_PI;
+			float theta_step = (1.0f / layers) * M_PI * 2.0f;
+			// Vertices along the seam and at the poles are repeated, so that
+			// they can each be given their own uv coordinates
+			result.vertices.resize((wedges + 1) * (layers + 1));
+			for (size_t w = 0; w <= wedges; w++) {
+				for (size_t l = 0; l <= layers; l++) {
+					float phi = l * phi_step;
+					float theta = w * theta_step;
+					result.vertices[w * (layers + 1) + l] = glm::vec3{
+						sin(phi) * cos(theta),
+						cos(phi),
+						sin(phi) * sin(theta)
+					} *radius;
+				}
+			}
+			result.indices = grid_indices(wedges, layers);
+			return result;
+		}
+
 	}
 }
-
@@ -1,4 +1,4 @@
-#version 130
+#version 140
 
 in  vec3 model_coord;
 in  vec3 world_coord;
@@ -7,36 +7,30 @@ in  vec3 view_coord;
 out vec4 pColor;
 
 uniform float time;
-uniform bool show_model;
-uniform bool show_world;
-uniform bool show_view;
 
-
-bool on_grid(vec3 point, float freq){
-	bool result = false;
-	if        (fract(point.x/freq) < 0.1) {
-		result = true;
-	} else if (fract(point.y/freq) < 0.1) {
-		result = true;
-	} else if (fract(point.z/freq) < 0.1) {
-		result = true;
-	}
-	return result;
-}
+// Which grids are drawn is chosen by the SHOW_MODEL, SHOW_WORLD and SHOW_VIEW
+// defines, so each combination is compiled as its own program
+#include "grid.glsl"
 
 
 void main() {
 	vec2 screen_coord = gl_FragCoord.xy / 400.0;
 	vec3 color = vec3(1,1,1);
-	if(on_grid(model_coord,0.5) && show_model){
+#ifdef SHOW_MODEL
+	if(on_grid(model_coord,0.5)){
 		color.r = 0.0;
 	}
-	if(on_grid(world_coord,0.5) && show_world){
+#endif
+#ifdef SHOW_WORLD
+	if(on_grid(world_coord,0.5)){
 		color.g = 0.0;
 	}
-	if(on_grid(view_coord,0.5) && show_view){
+#endif
+#ifdef SHOW_VIEW
+	if(on_grid(view_coord,0.5)){
 		color.b = 0.0;
 	}
+#endif
 	pColor = vec4(color,1);	
 }
 
@@ -1,4 +1,4 @@
-#version 130
+#version 140
 
 
 in  vec3 point;
@@ -10,8 +10,12 @@ out vec3 view_coord;
 uniform float time;
 
 uniform mat4  modl_transform;
-uniform mat4  view_transform;
-uniform mat4  proj_transform;
+
+// Shared by every program, and written once per frame
+layout(std140) uniform Camera {
+	mat4 view_transform;
+	mat4 proj_transform;
+};
 
 
 
@@ -0,0 +1,14 @@
+#pragma once
+
+// True near the planes where a coordinate of 'point' is a multiple of 'freq'
+bool on_grid(vec3 point, float freq){
+	bool result = false;
+	if        (fract(point.x/freq) < 0.1) {
+		result = true;
+	} else if (fract(point.y/freq) < 0.1) {
+		result = true;
+	} else if (fract(point.z/freq) < 0.1) {
+		result = true;
+	}
+	return result;
+}
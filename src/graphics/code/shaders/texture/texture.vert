@@ -1,4 +1,4 @@
-#version 130
+#version 140
 
 
 in  vec3 pos;
@@ -10,8 +10,12 @@ out vec2 vuv;
 uniform float time;
 
 uniform mat4  modl_transform;
-uniform mat4  view_transform;
-uniform mat4  proj_transform;
+
+// Shared by every program, and written once per frame
+layout(std140) uniform Camera {
+	mat4 view_transform;
+	mat4 proj_transform;
+};
 
 
 
@@ -1,10 +1,18 @@
-#version 130
+#version 140
 
 in  vec2 vuv;
 
 out vec4 pColor;
 
-uniform float     dim;
+// Written once per tile, through a slice of a shared uniform buffer
+layout(std140) uniform Tile {
+	vec2  offset;
+	vec2  scale;
+	vec2  uv_offset;
+	vec2  uv_scale;
+	float dim;
+};
+
 uniform sampler2D the_texture;
 
 void main() {
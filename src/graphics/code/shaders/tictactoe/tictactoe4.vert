@@ -1,17 +1,23 @@
-#version 130
+#version 140
 
 in  vec3  pos;
 in  vec2  uv;
 
 out vec2  vuv;
 
-uniform vec2 offset;
-uniform vec2 scale;
+// Written once per tile, through a slice of a shared uniform buffer
+layout(std140) uniform Tile {
+	vec2  offset;
+	vec2  scale;
+	vec2  uv_offset;
+	vec2  uv_scale;
+	float dim;
+};
 
 void main() {
 	vec3 position = pos;
 	position.xy *= scale;
 	position.xy += offset;
-	vuv = uv;
+	vuv = uv_offset + uv * uv_scale;
 	gl_Position = vec4(position,1);
 }